@@ -0,0 +1,153 @@
+#version 460
+
+// Tiled deferred lighting: one work group per 16x16 tile culls the lights against the
+// view space box of its pixels and shades them from the G-buffer.
+layout(local_size_x = 16, local_size_y = 16) in;
+
+#define TILE_LIGHTS 1024
+
+layout(binding = 0) uniform sampler2D gAlbedo;
+layout(binding = 1) uniform sampler2D gNormal;
+layout(binding = 2) uniform sampler2D gMaterial;
+layout(binding = 3) uniform sampler2D depthTexture;
+layout(binding = 4) uniform sampler2D gIrradiance;
+
+layout(rgba8, binding = 0) uniform writeonly image2D outputImage;
+
+// tiles with more than TILE_LIGHTS lights, summed over all frames
+layout(std430, binding = 5) buffer TileOverflow
+{
+    uint overflowTiles;
+};
+
+#include "lights.glsl"
+#include "shadows.glsl"
+#include "probes.glsl"
+
+uniform mat4 view;
+// 1 / projection[0][0] and 1 / projection[1][1], NDC to eye space at depth 1
+uniform vec2 projectionScale;
+// projection[2][2] and projection[3][2], to linearize depth
+uniform vec2 projectionZ;
+uniform vec2 renderSize;
+uniform int outputMode;
+uniform int lightCount;
+uniform vec3 clearColor;
+
+shared uint tileMinDepth;
+shared uint tileMaxDepth;
+shared uint tileLightCount;
+shared uint tileLights[TILE_LIGHTS];
+
+vec3 decodeNormal(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+// eye space position of an NDC xy at a linear depth
+vec3 eyePosition(vec2 ndc, float depth)
+{
+    return vec3(ndc * projectionScale * depth, -depth);
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    bool inside = all(lessThan(pixel, ivec2(renderSize)));
+    uint localIndex = gl_LocalInvocationIndex;
+    if (localIndex == 0)
+    {
+        tileMinDepth = 0x7f7fffffu;
+        tileMaxDepth = 0u;
+        tileLightCount = 0u;
+    }
+    barrier();
+
+    float ndcDepth = inside ? texelFetch(depthTexture, pixel, 0).r * 2.0 - 1.0 : 1.0;
+    bool geometry = ndcDepth < 1.0;
+    float depth = projectionZ.y / (ndcDepth + projectionZ.x);
+    // positive floats compare like their bits
+    if (geometry)
+    {
+        atomicMin(tileMinDepth, floatBitsToUint(depth));
+        atomicMax(tileMaxDepth, floatBitsToUint(depth));
+    }
+    barrier();
+
+    if (lightingEnable && tileMaxDepth > 0u)
+    {
+        float minDepth = uintBitsToFloat(tileMinDepth);
+        float maxDepth = uintBitsToFloat(tileMaxDepth);
+        vec2 ndcMin = vec2(gl_WorkGroupID.xy * gl_WorkGroupSize.xy) / renderSize * 2.0 - 1.0;
+        vec2 ndcMax = vec2((gl_WorkGroupID.xy + 1) * gl_WorkGroupSize.xy) / renderSize * 2.0 - 1.0;
+        // the tile frustum between minDepth and maxDepth, bounded by a box
+        vec3 boxMin = min(min(eyePosition(ndcMin, minDepth), eyePosition(ndcMin, maxDepth)),
+            min(eyePosition(ndcMax, minDepth), eyePosition(ndcMax, maxDepth)));
+        vec3 boxMax = max(max(eyePosition(ndcMin, minDepth), eyePosition(ndcMin, maxDepth)),
+            max(eyePosition(ndcMax, minDepth), eyePosition(ndcMax, maxDepth)));
+
+        for (uint i = localIndex; i < uint(lightCount); i += gl_WorkGroupSize.x * gl_WorkGroupSize.y)
+        {
+            vec4 sphere = vec4((view * vec4(lights[i].positionRadius.xyz, 1.0)).xyz, lights[i].positionRadius.w);
+            vec3 offset = max(max(boxMin - sphere.xyz, sphere.xyz - boxMax), 0.0);
+            if (dot(offset, offset) > sphere.w * sphere.w)
+                continue;
+            uint slot = atomicAdd(tileLightCount, 1u);
+            if (slot < TILE_LIGHTS)
+                tileLights[slot] = i;
+        }
+    }
+    barrier();
+    // such a tile tests every light at every pixel instead of dropping lights
+    bool overflow = tileLightCount > uint(TILE_LIGHTS);
+    if (overflow && localIndex == 0)
+        atomicAdd(overflowTiles, 1u);
+
+    if (!inside)
+        return;
+    if (!geometry)
+    {
+        imageStore(outputImage, pixel, vec4(clearColor, 1.0));
+        return;
+    }
+
+    vec4 albedo = texelFetch(gAlbedo, pixel, 0);
+    vec3 normal = decodeNormal(texelFetch(gNormal, pixel, 0).xy);
+    vec4 material = texelFetch(gMaterial, pixel, 0);
+    if (outputMode == 1)
+    {
+        imageStore(outputImage, pixel, vec4(normal, 1.0));
+        return;
+    }
+    vec4 irradiance = texelFetch(gIrradiance, pixel, 0);
+    if (!lightingEnable && !sunEnable && !probeEnable && irradiance.a == 0.0)
+    {
+        // unlit is all ambient
+        imageStore(outputImage, pixel, vec4(albedo.rgb * material.g, albedo.a));
+        return;
+    }
+
+    vec3 position = eyePosition((vec2(pixel) + 0.5) / renderSize * 2.0 - 1.0, depth);
+    vec3 eyeNormal = normalize(mat3(view) * normal);
+    vec3 color = vec3(ambient * material.g);
+    // baked objects carry their sun and sky lighting
+    if (irradiance.a > 0.0)
+        color = irradiance.rgb * material.g;
+    else
+    {
+        if (probeEnable)
+            color = probeIrradiance(position, normal) * material.g;
+        if (sunEnable)
+            color += sunLight(position, eyeNormal);
+    }
+    uint count = overflow ? uint(lightCount) : tileLightCount;
+    for (uint i = 0; i < count; ++i)
+    {
+        PointLight light = lights[overflow ? i : tileLights[i]];
+        color += pointLight(light, (view * vec4(light.positionRadius.xyz, 1.0)).xyz, position, eyeNormal);
+    }
+    imageStore(outputImage, pixel, vec4(albedo.rgb * color, albedo.a));
+}
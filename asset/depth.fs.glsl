@@ -0,0 +1,16 @@
+#version 460
+
+in vec2 texcoord;
+
+#ifdef ALPHA_TEST
+layout(binding = 7) uniform sampler2D textureMask;
+#endif
+
+// only the depth is written, alpha-tested meshes drop their masked out fragments
+void main()
+{
+#ifdef ALPHA_TEST
+    if (texture(textureMask, texcoord).r < 0.5)
+        discard;
+#endif
+}
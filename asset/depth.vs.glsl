@@ -0,0 +1,21 @@
+#version 460
+
+layout(location = 0) in vec3 iv3vertex;
+layout(location = 2) in vec2 iv2tex_coord;
+layout(location = 8) in mat4 instanceTransform;
+
+uniform mat4 um4m;
+uniform mat4 um4mv;
+uniform mat4 um4p;
+
+// the color pass tests GL_EQUAL against this depth, both compute it the same way
+invariant gl_Position;
+
+out vec2 texcoord;
+
+void main()
+{
+    mat4 model = um4m * instanceTransform;
+    gl_Position = um4p * (um4mv * model * vec4(iv3vertex, 1.0));
+    texcoord = iv2tex_coord;
+}
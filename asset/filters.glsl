@@ -0,0 +1,139 @@
+// Filter functions shared by the frame pass and the passes generated by the post-process graph.
+// texture0 is the input of the pass, the blur textures are the separable blurs of that input.
+
+layout(binding = 0) uniform sampler2D texture0;
+layout(binding = 1) uniform sampler2D textureNoise;
+layout(binding = 3) uniform sampler2D blurTexture9;
+layout(binding = 5) uniform sampler2D dogTexture;
+layout(binding = 7) uniform sampler2D bloomTexture;
+
+uniform int timer;
+// frameSize, magnifierCenter and magnifierRadius are in render pixels, texcoords cover [0, uvScale]
+uniform vec2 uvScale;
+uniform vec2 frameSize;
+uniform vec2 magnifierCenter;
+uniform float magnifierRadius;
+uniform float bloomIntensity;
+
+#define M_PI 3.1415926535897932384626433832795
+
+// 9x9 box blur, computed by the separable passes in frameBlur.fs.glsl
+vec4 medianBlur(vec2 texcoord)
+{
+    return texture(blurTexture9, texcoord);
+}
+
+// point-wise, can be fused into the pass producing its input
+vec4 quantizeColor(vec4 color)
+{
+    float nbins = 4.0;
+    return floor(color * nbins) / nbins;
+}
+
+vec4 quantization(vec2 texcoord)
+{
+    return quantizeColor(texture(texture0, texcoord));
+}
+
+vec4 differenceOfGaussian(vec2 texcoord)
+{
+
+    const float phi = 3.4f;
+    const float tau = 0.99f;
+
+    // gaussian weighted luminance for sigma_e and sigma_r, from the separable passes
+    vec4 DOGColor;
+    vec2 sum = texture(dogTexture, texcoord).rg;
+    float H = 100.0 * (sum.x - tau * sum.y);
+    float edge =( H > 0.0 )?1.0:2.0 * smoothstep(-2.0, 2.0, phi * H );
+    DOGColor = vec4(edge, edge, edge, 1.0);
+
+    return DOGColor;
+}
+
+vec4 imageAbstraction(vec2 texcoord)
+{
+    vec4 BQColor = (medianBlur(texcoord) + quantization(texcoord)) / 2.0f;
+    vec4 DOGColor = differenceOfGaussian(texcoord);
+    return DOGColor * BQColor;
+}
+
+vec4 quantize(vec4 color, float n)
+{
+    color.x = floor(color.x * 255.0f / n) * n / 255.0f;
+    color.y = floor(color.y * 255.0f / n) * n / 255.0f;
+    color.z = floor(color.z * 255.0f / n) * n / 255.0f;
+
+    return color;
+}
+
+vec4 waterColor(vec2 texcoord)
+{
+    const vec2 texSize = vec2(256.0f, 256.0f);
+    // the noise and its offsets span the rendered part like at full scale
+    vec4 noiseColor = 2 * texture(textureNoise, texcoord / uvScale);
+    vec2 newUV = texcoord + noiseColor.xy / texSize * uvScale;
+    vec4 fColor = texture(texture0, newUV);                  
+
+    vec4 color1 = quantize(fColor, 255.0f / pow(2.0f, 3));
+    vec4 color2 = medianBlur(texcoord);
+    return color1 * 0.7 + color2 * 0.3;
+}
+
+vec4 magnifier(vec2 texcoord)
+{
+    const vec2 center = magnifierCenter / frameSize * uvScale;
+    vec2 coord;
+    vec4 color;
+
+    if (distance(gl_FragCoord.xy, magnifierCenter - vec2(0.0f, magnifierRadius + 1)) < 6)
+    {
+        color = vec4(0.5f);
+    }
+    else if (distance(gl_FragCoord.xy, magnifierCenter - vec2(0.0f, magnifierRadius + 1)) < 8)
+    {
+        color = vec4(1.0f);
+    }
+    else if (distance(gl_FragCoord.xy, magnifierCenter) < magnifierRadius)
+    {
+        coord = center + (texcoord - center) / 2.0f;
+        color = texture(texture0, coord);
+    }
+    else if (distance(gl_FragCoord.xy, magnifierCenter) < magnifierRadius + 2)
+    {
+        color = vec4(1.0f);
+    }
+    else
+    {
+        color = texture(texture0, texcoord);
+    }
+    return color;
+}
+
+// bloomTexture is the top of the mip chain of frameBloom.fs.glsl, at half resolution
+vec4 bloomEffect(vec2 texcoord)
+{
+    vec4 color = texture(texture0, texcoord);
+    vec4 bloom = texture(bloomTexture, texcoord);
+    return vec4(color.rgb + bloom.rgb * bloomIntensity, 1.0f);
+}
+
+vec4 pixelization(vec2 texcoord)
+{
+    const float pixels = 512.0;
+    // a pixels x pixels grid over the rendered part
+    float dx = 8.0 * (uvScale.x / pixels);
+    float dy = 8.0 * (uvScale.y / pixels);
+    vec2 coord = vec2(dx * floor(texcoord.x / dx), dy * floor(texcoord.y / dy));
+    vec4 color = texture(texture0, coord);
+    return color;
+}
+
+vec4 sineWave(vec2 texcoord)
+{
+    float offset = 10;
+    vec2 coord = texcoord;
+    coord.x += 0.06 * uvScale.x * sin(radians((texcoord.y / uvScale.y * 500) + timer * 2));
+    vec4 color = texture(texture0, coord);
+    return color;
+}
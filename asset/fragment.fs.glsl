@@ -11,7 +11,9 @@ in VertexData
     vec3 L; // eye space light vector
     vec3 H; // eye space halfway vector
     vec3 normal;
+    vec3 position; // eye space position
     vec2 texcoord;
+    vec2 lightmapCoord;
 } vertexData;
 
 uniform int outputMode;
@@ -19,11 +21,89 @@ uniform int outputMode;
 layout(binding = 0) uniform sampler2D texture1;
 layout(binding = 1) uniform sampler2D texture2;
 layout(binding = 2) uniform sampler2D texture3;
+#ifdef ALPHA_TEST
+layout(binding = 7) uniform sampler2D textureMask;
+#endif
+// baked sun and sky lighting (lightmap.hpp), replaces the ambient and sun terms
+uniform bool lightmapEnable;
+layout(binding = 8) uniform sampler2D lightmap;
+// screen space ambient occlusion (ssao.hpp) of the ambient term, drawn after the depth
+uniform bool ssaoEnable;
+layout(binding = 10) uniform sampler2D occlusionTexture;
+
+#include "lights.glsl"
+#include "shadows.glsl"
+#include "probes.glsl"
+
+// clustered lights, binned on the CPU (clusteredlights.hpp)
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+
+// offset and count in lightIndices of every cluster
+layout(std430, binding = 2) readonly buffer Clusters
+{
+    uvec2 clusters[];
+};
+
+layout(std430, binding = 3) readonly buffer LightIndices
+{
+    uint lightIndices[];
+};
+
+uniform vec2 clusterTileSize;
+// slice = log(depth) * x + y, slice 0 before the first exponential one
+uniform vec2 clusterSlice;
+
+float getOcclusion()
+{
+    return ssaoEnable ? texelFetch(occlusionTexture, ivec2(gl_FragCoord.xy), 0).r : 1.0;
+}
+
+vec3 shadeLights(vec3 albedo)
+{
+    vec3 normal = normalize(vertexData.N);
+    vec3 color = vec3(ambient) * getOcclusion();
+    if (lightmapEnable)
+        color = texture(lightmap, vertexData.lightmapCoord).rgb * getOcclusion();
+    else
+    {
+        if (probeEnable)
+            color = probeIrradiance(vertexData.position, normalize(vertexData.normal)) * getOcclusion();
+        if (sunEnable)
+            color += sunLight(vertexData.position, normal);
+    }
+    if (!lightingEnable)
+        return albedo * color;
+
+    float depth = -vertexData.position.z;
+    int slice = clamp(int(log(depth) * clusterSlice.x + clusterSlice.y), 0, CLUSTER_Z - 1);
+    ivec2 tile = min(ivec2(gl_FragCoord.xy / clusterTileSize), ivec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+    uvec2 cluster = clusters[tile.x + tile.y * CLUSTER_X + slice * CLUSTER_X * CLUSTER_Y];
+    for (uint i = 0; i < cluster.y; ++i)
+    {
+        PointLight light = lights[lightIndices[cluster.x + i]];
+        vec3 lightPosition = (um4mv * vec4(light.positionRadius.xyz, 1.0)).xyz;
+        color += pointLight(light, lightPosition, vertexData.position, normal);
+    }
+    return albedo * color;
+}
 
 void main()
 {
+#ifdef ALPHA_TEST
+    if (texture(textureMask, vertexData.texcoord).r < 0.5)
+        discard;
+#endif
     if (outputMode == 0)
+    {
        fragColor = texture(texture1, vertexData.texcoord);
+       if (lightingEnable || sunEnable || lightmapEnable || probeEnable)
+           fragColor.rgb = shadeLights(fragColor.rgb);
+       else
+           // unlit is all ambient
+           fragColor.rgb *= getOcclusion();
+    }
     else
        fragColor = vec4(vertexData.normal, 1.0);
 
@@ -0,0 +1,61 @@
+#version 460
+
+in vec2 texCoords;
+out vec4 fragColor;
+
+// downsample: the previous (larger) level
+// upsample: the next (smaller) level, added to the downsample result of this level
+layout(binding = 0) uniform sampler2D bloomSource;
+layout(binding = 1) uniform sampler2D bloomBase;
+
+// 0 bright-pass and first downsample, 1 downsample, 2 upsample
+uniform int bloomPass;
+// half a texel of bloomSource
+uniform vec2 halfTexel;
+uniform float bloomThreshold;
+uniform float bloomKnee;
+
+// soft knee around the threshold, so bright areas do not pop in and out
+vec4 brightPass(vec4 color)
+{
+    float brightness = max(color.r, max(color.g, color.b));
+    float soft = clamp(brightness - bloomThreshold + bloomKnee, 0.0f, 2.0f * bloomKnee);
+    soft = soft * soft / (4.0f * bloomKnee + 1e-5f);
+    float contribution = max(soft, brightness - bloomThreshold) / max(brightness, 1e-5f);
+    return vec4(color.rgb * contribution, 1.0f);
+}
+
+// dual Kawase, 5 taps at half texel offsets
+vec4 downsample(vec2 texcoord)
+{
+    vec4 sum = texture(bloomSource, texcoord) * 4.0f;
+    sum += texture(bloomSource, texcoord - halfTexel);
+    sum += texture(bloomSource, texcoord + halfTexel);
+    sum += texture(bloomSource, texcoord + vec2(halfTexel.x, -halfTexel.y));
+    sum += texture(bloomSource, texcoord - vec2(halfTexel.x, -halfTexel.y));
+    return sum / 8.0f;
+}
+
+// dual Kawase, 8 taps in a tent around the sample
+vec4 upsample(vec2 texcoord)
+{
+    vec4 sum = texture(bloomSource, texcoord + vec2(-halfTexel.x * 2.0f, 0.0f));
+    sum += texture(bloomSource, texcoord + vec2(-halfTexel.x, halfTexel.y)) * 2.0f;
+    sum += texture(bloomSource, texcoord + vec2(0.0f, halfTexel.y * 2.0f));
+    sum += texture(bloomSource, texcoord + vec2(halfTexel.x, halfTexel.y)) * 2.0f;
+    sum += texture(bloomSource, texcoord + vec2(halfTexel.x * 2.0f, 0.0f));
+    sum += texture(bloomSource, texcoord + vec2(halfTexel.x, -halfTexel.y)) * 2.0f;
+    sum += texture(bloomSource, texcoord + vec2(0.0f, -halfTexel.y * 2.0f));
+    sum += texture(bloomSource, texcoord + vec2(-halfTexel.x, -halfTexel.y)) * 2.0f;
+    return sum / 12.0f;
+}
+
+void main()
+{
+    if (bloomPass == 0)
+        fragColor = brightPass(downsample(texCoords));
+    else if (bloomPass == 1)
+        fragColor = downsample(texCoords);
+    else
+        fragColor = upsample(texCoords) + texture(bloomBase, texCoords);
+}
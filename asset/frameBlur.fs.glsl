@@ -0,0 +1,87 @@
+#version 460
+
+in vec2 texCoords;
+
+layout(location = 0) out vec4 box9Color;
+layout(location = 1) out vec4 dogColor;
+
+// horizontal pass: both read the frame color
+// vertical pass: each reads the matching horizontal result
+// the 9x9 box is always produced, the DoG only when the filter needs it
+layout(binding = 0) uniform sampler2D box9Source;
+layout(binding = 1) uniform sampler2D dogSource;
+
+uniform bool horizontal;
+uniform vec2 blurStep;
+uniform bool dogEnable;
+
+// same constants as the former 2D loops in frameFragment.fs.glsl
+const int box9Half = 4;
+const float sigmaE = 2.0f;
+const float sigmaR = 2.8f;
+const int dogHalf = 6;
+
+float luminance(vec4 color)
+{
+    return 0.299 * color.r + 0.587 * color.g + 0.114 * color.b;
+}
+
+// exp(-(i*i + j*j) / 2s^2) = exp(-i*i / 2s^2) * exp(-j*j / 2s^2), so the DoG kernels separate exactly
+vec2 dogKernel(int i)
+{
+    float d2 = float(i * i);
+    return vec2(exp(-d2 / (2.0 * sigmaE * sigmaE)), exp(-d2 / (2.0 * sigmaR * sigmaR)));
+}
+
+void horizontalPass()
+{
+    int range = dogEnable ? dogHalf : box9Half;
+
+    vec4 sum9 = vec4(0.0f);
+    vec2 sumDog = vec2(0.0f);
+    vec2 normDog = vec2(0.0f);
+    for (int i = -range; i <= range; ++i)
+    {
+        vec4 color = texture(box9Source, texCoords + blurStep * float(i));
+        if (abs(i) <= box9Half)
+            sum9 += color;
+        if (abs(i) <= dogHalf)
+        {
+            vec2 kernel = dogKernel(i);
+            sumDog += kernel * luminance(color);
+            normDog += kernel;
+        }
+    }
+
+    box9Color = sum9 / float(2 * box9Half + 1);
+    dogColor = vec4(sumDog / normDog, 0.0f, 1.0f);
+}
+
+void verticalPass()
+{
+    vec4 sum9 = vec4(0.0f);
+    for (int i = -box9Half; i <= box9Half; ++i)
+        sum9 += texture(box9Source, texCoords + blurStep * float(i));
+    box9Color = sum9 / float(2 * box9Half + 1);
+
+    vec2 sumDog = vec2(0.0f);
+    vec2 normDog = vec2(0.0f);
+    if (dogEnable)
+    {
+        for (int i = -dogHalf; i <= dogHalf; ++i)
+        {
+            vec2 kernel = dogKernel(i);
+            sumDog += kernel * texture(dogSource, texCoords + blurStep * float(i)).rg;
+            normDog += kernel;
+        }
+    }
+    dogColor = vec4(sumDog / max(normDog, vec2(1e-6f)), 0.0f, 1.0f);
+}
+
+void main()
+{
+    if (horizontal)
+        horizontalPass();
+    else
+        verticalPass();
+}
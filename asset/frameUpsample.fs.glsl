@@ -0,0 +1,66 @@
+#version 460
+
+in vec2 texCoords;
+
+layout(location = 0) out vec4 box9Color;
+layout(location = 1) out vec4 dogColor;
+
+// the blur results at a fraction of the frame size
+layout(binding = 0) uniform sampler2D box9Low;
+layout(binding = 1) uniform sampler2D dogLow;
+// full resolution color the blurs were computed from, and the scene depth
+layout(binding = 2) uniform sampler2D guideTexture;
+layout(binding = 3) uniform sampler2D depthTexture;
+
+uniform vec2 lowSize;
+uniform bool dogEnable;
+// projection[2][2] and projection[3][2], to linearize depth
+uniform vec2 projectionZ;
+// relative linear depth and luminance differences where the weight falls to 1 / e
+uniform float depthSigma;
+uniform float lumaSigma;
+
+float luminance(vec4 color)
+{
+    return 0.299 * color.r + 0.587 * color.g + 0.114 * color.b;
+}
+
+float linearDepth(float depth)
+{
+    return projectionZ.y / (depth * 2.0f - 1.0f + projectionZ.x);
+}
+
+// Joint bilateral upsample: the 4 bilinear neighbours are weighted down when their
+// depth or luminance differs from this pixel's, so blurred colors do not bleed over
+// silhouettes and hard edges.
+void main()
+{
+    vec2 lowCoord = texCoords * lowSize - 0.5f;
+    vec2 base = floor(lowCoord);
+    vec2 fraction = lowCoord - base;
+
+    float depth = linearDepth(texture(depthTexture, texCoords).r);
+    float luma = luminance(texture(guideTexture, texCoords));
+
+    vec4 sum9 = vec4(0.0f);
+    vec4 sumDog = vec4(0.0f);
+    float weightSum = 0.0f;
+    for (int i = 0; i < 4; ++i)
+    {
+        vec2 offset = vec2(i & 1, i >> 1);
+        vec2 lowUV = (base + offset + 0.5f) / lowSize;
+        vec2 bilinear = mix(1.0f - fraction, fraction, offset);
+
+        float sampleDepth = linearDepth(texture(depthTexture, lowUV).r);
+        float sampleLuma = luminance(texture(guideTexture, lowUV));
+        float weight = bilinear.x * bilinear.y;
+        weight *= exp(-abs(sampleDepth - depth) / (depthSigma * depth)) * exp(-abs(sampleLuma - luma) / lumaSigma) + 1e-4f;
+
+        sum9 += texture(box9Low, lowUV) * weight;
+        if (dogEnable)
+            sumDog += texture(dogLow, lowUV) * weight;
+        weightSum += weight;
+    }
+    box9Color = sum9 / weightSum;
+    dogColor = vec4((sumDog / weightSum).rg, 0.0f, 1.0f);
+}
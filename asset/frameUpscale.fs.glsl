@@ -0,0 +1,53 @@
+#version 460
+
+in vec2 texCoords;
+out vec4 fragColor;
+
+// the filtered frame, in the bottom left render scale part of the texture
+layout(binding = 0) uniform sampler2D texture0;
+uniform vec2 uvScale;
+
+// Catmull-Rom in 9 bilinear taps instead of 16 point taps, sharper than plain
+// bilinear when the render scale is low
+vec4 catmullRom(vec2 texcoord)
+{
+    vec2 texSize = vec2(textureSize(texture0, 0));
+    vec2 samplePos = texcoord * texSize;
+    vec2 texPos1 = floor(samplePos - 0.5f) + 0.5f;
+    vec2 f = samplePos - texPos1;
+
+    vec2 w0 = f * (-0.5f + f * (1.0f - 0.5f * f));
+    vec2 w1 = 1.0f + f * f * (-2.5f + 1.5f * f);
+    vec2 w2 = f * (0.5f + f * (2.0f - 1.5f * f));
+    vec2 w3 = f * f * (-0.5f + 0.5f * f);
+
+    vec2 w12 = w1 + w2;
+    vec2 offset12 = w2 / w12;
+
+    // stay inside the rendered part, the rest of the target holds older frames
+    // and off the other edge, the pool targets are shared by the passes
+    vec2 texMin = 0.5f / texSize;
+    vec2 texMax = uvScale - 0.5f / texSize;
+    vec2 texPos0 = clamp((texPos1 - 1.0f) / texSize, texMin, texMax);
+    vec2 texPos3 = clamp((texPos1 + 2.0f) / texSize, texMin, texMax);
+    vec2 texPos12 = clamp((texPos1 + offset12) / texSize, texMin, texMax);
+
+    vec4 result = vec4(0.0f);
+    result += texture(texture0, vec2(texPos0.x, texPos0.y)) * w0.x * w0.y;
+    result += texture(texture0, vec2(texPos12.x, texPos0.y)) * w12.x * w0.y;
+    result += texture(texture0, vec2(texPos3.x, texPos0.y)) * w3.x * w0.y;
+
+    result += texture(texture0, vec2(texPos0.x, texPos12.y)) * w0.x * w12.y;
+    result += texture(texture0, vec2(texPos12.x, texPos12.y)) * w12.x * w12.y;
+    result += texture(texture0, vec2(texPos3.x, texPos12.y)) * w3.x * w12.y;
+
+    result += texture(texture0, vec2(texPos0.x, texPos3.y)) * w0.x * w3.y;
+    result += texture(texture0, vec2(texPos12.x, texPos3.y)) * w12.x * w3.y;
+    result += texture(texture0, vec2(texPos3.x, texPos3.y)) * w3.x * w3.y;
+    return max(result, vec4(0.0f));
+}
+
+void main()
+{
+    fragColor = catmullRom(texCoords);
+}
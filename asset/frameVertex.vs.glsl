@@ -5,8 +5,13 @@ layout (location = 1) in vec2 texcoords;
 
 out vec2 texCoords;
 
+// render scale, the passes only use the bottom left part of their targets
+uniform vec2 uvScale;
+// NDC depth of the quad, masked passes move it to test against their depth mask
+uniform float quadDepth;
+
 void main()
 {
-    gl_Position = vec4(position.x, position.y, 0.0f, 1.0f);
-    texCoords = texcoords;
+    gl_Position = vec4(position.x, position.y, quadDepth, 1.0f);
+    texCoords = texcoords * uvScale;
 }
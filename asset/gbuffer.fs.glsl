@@ -0,0 +1,47 @@
+#version 460
+
+// G-buffer of the deferred path, lit by deferredLighting.cs.glsl
+layout(location = 0) out vec4 gAlbedo;
+layout(location = 1) out vec2 gNormal;
+layout(location = 2) out vec4 gMaterial;
+layout(location = 3) out vec4 gIrradiance;
+
+in VertexData
+{
+    vec3 N; // eye space normal
+    vec3 L; // eye space light vector
+    vec3 H; // eye space halfway vector
+    vec3 normal;
+    vec3 position; // eye space position
+    vec2 texcoord;
+    vec2 lightmapCoord;
+} vertexData;
+
+layout(binding = 0) uniform sampler2D texture1;
+#ifdef ALPHA_TEST
+layout(binding = 7) uniform sampler2D textureMask;
+#endif
+uniform bool lightmapEnable;
+layout(binding = 8) uniform sampler2D lightmap;
+
+// octahedral mapping of the unit sphere onto [-1, 1]^2
+vec2 encodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return n.xy;
+}
+
+void main()
+{
+#ifdef ALPHA_TEST
+    if (texture(textureMask, vertexData.texcoord).r < 0.5)
+        discard;
+#endif
+    gAlbedo = texture(texture1, vertexData.texcoord);
+    gNormal = encodeNormal(normalize(vertexData.normal));
+    // r marks lit geometry against the cleared background, g is the ambient occlusion
+    gMaterial = vec4(1.0, 1.0, 0.0, 0.0);
+    gIrradiance = lightmapEnable ? vec4(texture(lightmap, vertexData.lightmapCoord).rgb, 1.0) : vec4(0.0);
+}
@@ -0,0 +1,25 @@
+// Point lights shared by the forward scene pass and the deferred lighting pass,
+// the buffer is filled by clusteredlights.hpp.
+
+struct PointLight
+{
+    vec4 positionRadius; // world space
+    vec4 color;
+};
+
+layout(std430, binding = 1) readonly buffer Lights
+{
+    PointLight lights[];
+};
+
+uniform bool lightingEnable;
+uniform float ambient;
+
+// Lambert with a (1 - d / r)^2 falloff, everything in eye space
+vec3 pointLight(PointLight light, vec3 lightPosition, vec3 position, vec3 normal)
+{
+    vec3 toLight = lightPosition - position;
+    float distance = length(toLight);
+    float attenuation = max(1.0 - distance / light.positionRadius.w, 0.0);
+    return light.color.rgb * max(dot(normal, toLight / max(distance, 1e-4)), 0.0) * attenuation * attenuation;
+}
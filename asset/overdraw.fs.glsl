@@ -0,0 +1,11 @@
+#version 460
+
+// Only fragments which pass the depth test are counted, like the shaded fragments of the scene pass
+layout(early_fragment_tests) in;
+
+layout(r32ui, binding = 0) uniform coherent uimage2D overdrawCounter;
+
+void main()
+{
+    imageAtomicAdd(overdrawCounter, ivec2(gl_FragCoord.xy), 1u);
+}
@@ -0,0 +1,44 @@
+#version 460
+
+layout(local_size_x = 16, local_size_y = 16) in;
+
+layout(r32ui, binding = 0) uniform readonly uimage2D overdrawCounter;
+
+layout(std430, binding = 0) buffer OverdrawResult
+{
+    uint fragmentSum;
+    uint coveredPixels;
+    uint maxOverdraw;
+};
+
+shared uint groupSum;
+shared uint groupCovered;
+shared uint groupMax;
+
+void main()
+{
+    if (gl_LocalInvocationIndex == 0)
+    {
+        groupSum = 0u;
+        groupCovered = 0u;
+        groupMax = 0u;
+    }
+    barrier();
+
+    ivec2 coord = ivec2(gl_GlobalInvocationID.xy);
+    if (all(lessThan(coord, imageSize(overdrawCounter))))
+    {
+        uint count = imageLoad(overdrawCounter, coord).r;
+        atomicAdd(groupSum, count);
+        atomicAdd(groupCovered, count > 0u ? 1u : 0u);
+        atomicMax(groupMax, count);
+    }
+    barrier();
+
+    if (gl_LocalInvocationIndex == 0)
+    {
+        atomicAdd(fragmentSum, groupSum);
+        atomicAdd(coveredPixels, groupCovered);
+        atomicMax(maxOverdraw, groupMax);
+    }
+}
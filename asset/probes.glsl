@@ -0,0 +1,33 @@
+// Irradiance probe volume, baked by probevolume.hpp. Every probe holds L2 spherical
+// harmonics of the incoming light, convolved with the cosine lobe and divided by pi like
+// the ambient term, as 27 values in 7 texels, one slab of the grid per texel.
+
+#define PROBE_SH_TEXELS 7
+
+layout(binding = 9) uniform sampler3D probeVolume;
+
+uniform bool probeEnable;
+uniform mat4 probeInverseView;
+uniform vec3 probeOrigin; // world space, first probe
+uniform vec3 probeGrid;   // probes along each axis
+uniform float probeSpacing;
+
+// eye space position, world space normal
+vec3 probeIrradiance(vec3 position, vec3 normal)
+{
+    vec3 world = (probeInverseView * vec4(position, 1.0)).xyz;
+    // half a cell off the surface, so probes behind it weigh less
+    vec3 cell = clamp((world - probeOrigin) / probeSpacing + normal * 0.5, vec3(0.0), probeGrid - 1.0);
+    vec3 size = vec3(probeGrid.xy, probeGrid.z * PROBE_SH_TEXELS);
+    vec4 c[PROBE_SH_TEXELS];
+    for (int i = 0; i < PROBE_SH_TEXELS; ++i)
+        c[i] = texture(probeVolume, (cell + vec3(0.0, 0.0, i * probeGrid.z) + 0.5) / size);
+
+    vec3 n = normal;
+    vec3 result = 0.282095 * c[0].rgb
+        + 0.488603 * (vec3(c[0].a, c[1].rg) * n.y + vec3(c[1].ba, c[2].r) * n.z + c[2].gba * n.x)
+        + 1.092548 * (c[3].rgb * n.x * n.y + vec3(c[3].a, c[4].rg) * n.y * n.z + c[5].gba * n.x * n.z)
+        + 0.315392 * vec3(c[4].ba, c[5].r) * (3.0 * n.z * n.z - 1.0)
+        + 0.546274 * c[6].rgb * (n.x * n.x - n.y * n.y);
+    return max(result, vec3(0.0));
+}
@@ -0,0 +1,40 @@
+// Sun light with cascaded shadow maps, set up by shadows.hpp.
+
+#define SHADOW_CASCADES 4
+
+layout(binding = 6) uniform sampler2DArrayShadow shadowMap;
+
+uniform bool sunEnable;
+uniform vec3 sunDirection; // eye space, towards the sun
+uniform vec3 sunColor;
+// eye space to the [0, 1] texture space of each cascade
+uniform mat4 shadowMatrices[SHADOW_CASCADES];
+// far eye depth of each cascade
+uniform vec4 cascadeSplits;
+// size of a shadow texel of each cascade, for the normal offset
+uniform vec4 cascadeTexels;
+
+float sunShadow(vec3 position, vec3 normal)
+{
+    int cascade = 0;
+    while (cascade < SHADOW_CASCADES && -position.z > cascadeSplits[cascade])
+        cascade++;
+    if (cascade == SHADOW_CASCADES)
+        return 1.0;
+
+    // moved along the normal by about a texel against shadow acne
+    vec4 coord = shadowMatrices[cascade] * vec4(position + normal * cascadeTexels[cascade] * 1.5, 1.0);
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int i = 0; i < 4; ++i)
+    {
+        vec2 offset = (vec2(i & 1, i >> 1) - 0.5) * texel;
+        lit += texture(shadowMap, vec4(coord.xy + offset, cascade, min(coord.z, 1.0)));
+    }
+    return lit * 0.25;
+}
+
+vec3 sunLight(vec3 position, vec3 normal)
+{
+    return sunColor * max(dot(normal, sunDirection), 0.0) * sunShadow(position, normal);
+}
@@ -0,0 +1,72 @@
+#version 460
+
+// Ambient occlusion at half resolution from the frame depth, set up by ssao.hpp. Every
+// pixel takes a few samples on a spiral inside the projected radius, rotated by its
+// place in a 4x4 pattern, so the blur afterwards averages 16 different rotations.
+layout(local_size_x = 8, local_size_y = 8) in;
+
+#define SSAO_SAMPLES 8
+#define SSAO_BACKGROUND 65504.0
+
+layout(binding = 0) uniform sampler2D depthTexture;
+
+// occlusion, linear depth for the blur
+layout(rg16f, binding = 0) uniform writeonly image2D outputImage;
+
+// 1 / projection[0][0] and 1 / projection[1][1], NDC to eye space at depth 1
+uniform vec2 projectionScale;
+// projection[2][2] and projection[3][2], to linearize depth
+uniform vec2 projectionZ;
+uniform vec2 renderSize;
+// pixels of a world unit at depth 1
+uniform float projectedScale;
+uniform float radius;
+uniform float intensity;
+
+vec3 eyePosition(ivec2 pixel)
+{
+    pixel = clamp(pixel, ivec2(0), ivec2(renderSize) - 1);
+    float depth = projectionZ.y / (texelFetch(depthTexture, pixel, 0).r * 2.0 - 1.0 + projectionZ.x);
+    vec2 ndc = (vec2(pixel) + 0.5) / renderSize * 2.0 - 1.0;
+    return vec3(ndc * projectionScale * depth, -depth);
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(pixel, (ivec2(renderSize) + 1) / 2)))
+        return;
+    ivec2 center = pixel * 2;
+    if (texelFetch(depthTexture, center, 0).r >= 1.0)
+    {
+        imageStore(outputImage, pixel, vec4(1.0, SSAO_BACKGROUND, 0.0, 0.0));
+        return;
+    }
+
+    vec3 position = eyePosition(center);
+    // from the closer neighbour on each axis, so depth edges do not bend the normal
+    vec3 dx0 = position - eyePosition(center - ivec2(1, 0));
+    vec3 dx1 = eyePosition(center + ivec2(1, 0)) - position;
+    vec3 dy0 = position - eyePosition(center - ivec2(0, 1));
+    vec3 dy1 = eyePosition(center + ivec2(0, 1)) - position;
+    vec3 normal = normalize(cross(abs(dx0.z) < abs(dx1.z) ? dx0 : dx1, abs(dy0.z) < abs(dy1.z) ? dy0 : dy1));
+
+    float depth = -position.z;
+    float diskRadius = clamp(projectedScale * radius / depth, 2.0, 128.0);
+    float pattern = float((pixel.x & 3) + (pixel.y & 3) * 4) / 16.0;
+    float radius2 = radius * radius;
+    float occlusion = 0.0;
+    for (int i = 0; i < SSAO_SAMPLES; ++i)
+    {
+        // golden angle spiral, turned and pushed outwards by the pattern
+        float angle = (i + pattern) * 2.3999632 + pattern * 6.2831853;
+        float distance = sqrt((i + pattern + 0.5) / SSAO_SAMPLES) * diskRadius;
+        vec3 v = eyePosition(center + ivec2(round(vec2(cos(angle), sin(angle)) * distance))) - position;
+        float vv = dot(v, v);
+        // cosine to the normal, less a bias against flat surfaces, fading out at the radius
+        float cosine = dot(v, normal) * inversesqrt(vv + 1e-4 * radius2);
+        occlusion += max(cosine - 0.1, 0.0) * max(1.0 - vv / radius2, 0.0);
+    }
+    occlusion = clamp(1.0 - intensity * 2.0 * occlusion / SSAO_SAMPLES, 0.0, 1.0);
+    imageStore(outputImage, pixel, vec4(occlusion, depth, 0.0, 0.0));
+}
@@ -0,0 +1,40 @@
+#version 460
+
+// One direction of the separable depth aware blur of the half resolution occlusion.
+layout(local_size_x = 8, local_size_y = 8) in;
+
+#define SSAO_BLUR_RADIUS 4
+#define SSAO_BACKGROUND 65504.0
+
+layout(binding = 0) uniform sampler2D inputTexture;
+layout(rg16f, binding = 0) uniform writeonly image2D outputImage;
+
+uniform vec2 direction;
+uniform vec2 size;
+// how fast the weight drops with the relative depth difference
+uniform float sharpness;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(pixel, ivec2(size))))
+        return;
+    vec2 center = texelFetch(inputTexture, pixel, 0).rg;
+    if (center.g >= SSAO_BACKGROUND)
+    {
+        imageStore(outputImage, pixel, vec4(center, 0.0, 0.0));
+        return;
+    }
+
+    float sum = 0.0;
+    float weightSum = 0.0;
+    for (int i = -SSAO_BLUR_RADIUS; i <= SSAO_BLUR_RADIUS; ++i)
+    {
+        ivec2 neighbour = clamp(pixel + ivec2(direction) * i, ivec2(0), ivec2(size) - 1);
+        vec2 value = texelFetch(inputTexture, neighbour, 0).rg;
+        float weight = exp(-float(i * i) / 8.0) * max(1.0 - sharpness * abs(value.g - center.g) / center.g, 0.0);
+        sum += value.r * weight;
+        weightSum += weight;
+    }
+    imageStore(outputImage, pixel, vec4(sum / weightSum, center.g, 0.0, 0.0));
+}
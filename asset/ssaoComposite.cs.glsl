@@ -0,0 +1,49 @@
+#version 460
+
+// Upsamples the blurred occlusion to full resolution from the 4 nearest half resolution
+// pixels, weighted by how close their depth is. The forward path samples the result in
+// its ambient term, the deferred one multiplies it into the ambient slot of the G-buffer
+// material.
+layout(local_size_x = 16, local_size_y = 16) in;
+
+layout(binding = 0) uniform sampler2D occlusionTexture;
+layout(binding = 1) uniform sampler2D depthTexture;
+#ifdef MATERIAL_OUTPUT
+layout(rgba8, binding = 0) uniform image2D materialImage;
+#else
+layout(r8, binding = 0) uniform writeonly image2D outputImage;
+#endif
+
+uniform vec2 projectionZ;
+uniform vec2 renderSize;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(pixel, ivec2(renderSize))))
+        return;
+    float ndcDepth = texelFetch(depthTexture, pixel, 0).r * 2.0 - 1.0;
+    if (ndcDepth >= 1.0)
+        return;
+    float depth = projectionZ.y / (ndcDepth + projectionZ.x);
+
+    ivec2 halfSize = (ivec2(renderSize) + 1) / 2;
+    ivec2 base = (pixel - 1) / 2;
+    float sum = 0.0;
+    float weightSum = 0.0;
+    for (int i = 0; i < 4; ++i)
+    {
+        ivec2 neighbour = clamp(base + ivec2(i & 1, i >> 1), ivec2(0), halfSize - 1);
+        vec2 value = texelFetch(occlusionTexture, neighbour, 0).rg;
+        float weight = 1.0 / (1e-3 + abs(value.g - depth) / depth);
+        sum += value.r * weight;
+        weightSum += weight;
+    }
+    float occlusion = sum / weightSum;
+#ifdef MATERIAL_OUTPUT
+    vec4 material = imageLoad(materialImage, pixel);
+    imageStore(materialImage, pixel, vec4(material.r, material.g * occlusion, material.ba));
+#else
+    imageStore(outputImage, pixel, vec4(occlusion));
+#endif
+}
@@ -0,0 +1,95 @@
+#version 460
+
+layout(local_size_x = 16, local_size_y = 16) in;
+
+layout(binding = 0) uniform sampler2D sceneTexture;
+layout(binding = 1) uniform sampler2D depthTexture;
+// rgb the filtered color, a the scene luminance it was filtered from
+layout(binding = 2) uniform sampler2D historyColor;
+// linear depth
+layout(binding = 3) uniform sampler2D historyDepth;
+
+layout(rgba16f, binding = 0) uniform writeonly image2D reprojectedImage;
+// 2: some pixel has no usable history, 1: refreshed only, 0: reused
+layout(r8ui, binding = 1) uniform writeonly uimage2D changedTilesImage;
+
+// NDC of this frame to clip space of the last one
+uniform mat4 currentToPrevious;
+// projection[2][2] and projection[3][2], to linearize depth
+uniform vec2 projectionZ;
+uniform bool historyValid;
+uniform int refreshSubset;
+uniform int subsetCount;
+uniform float depthThreshold;
+uniform float lumaThreshold;
+
+shared uint tileInvalid;
+
+float luminance(vec4 color)
+{
+    return 0.299 * color.r + 0.587 * color.g + 0.114 * color.b;
+}
+
+float linearDepth(float ndcDepth)
+{
+    return projectionZ.y / (ndcDepth + projectionZ.x);
+}
+
+// History is rejected when the pixel was off screen, hidden behind something else
+// (disocclusion) or lit differently last frame.
+bool reproject(ivec2 coord, ivec2 size, out vec3 color)
+{
+    color = vec3(0.0f);
+    if (!historyValid)
+        return false;
+
+    vec2 ndc = (vec2(coord) + 0.5f) / vec2(size) * 2.0f - 1.0f;
+    float depth = texelFetch(depthTexture, coord, 0).r * 2.0f - 1.0f;
+    vec4 previous = currentToPrevious * vec4(ndc, depth, 1.0f);
+    if (previous.w <= 0.0f)
+        return false;
+    previous.xyz /= previous.w;
+    vec2 previousUV = previous.xy * 0.5f + 0.5f;
+    if (any(lessThan(previousUV, vec2(0.0f))) || any(greaterThan(previousUV, vec2(1.0f))))
+        return false;
+
+    float expected = linearDepth(previous.z);
+    float found = texelFetch(historyDepth, min(ivec2(previousUV * vec2(size)), size - 1), 0).r;
+    if (abs(found - expected) > depthThreshold * expected)
+        return false;
+
+    vec4 history = texture(historyColor, previousUV);
+    if (abs(history.a - luminance(texelFetch(sceneTexture, coord, 0))) > lumaThreshold)
+        return false;
+
+    color = history.rgb;
+    return true;
+}
+
+void main()
+{
+    if (gl_LocalInvocationIndex == 0)
+        tileInvalid = 0;
+    barrier();
+
+    ivec2 size = textureSize(sceneTexture, 0);
+    ivec2 coord = ivec2(gl_GlobalInvocationID.xy);
+    if (all(lessThan(coord, size)))
+    {
+        vec3 color;
+        bool valid = reproject(coord, size, color);
+        imageStore(reprojectedImage, coord, vec4(color, valid ? 1.0f : 0.0f));
+        if (!valid)
+            atomicOr(tileInvalid, 1u);
+    }
+    barrier();
+
+    // every subsetCount frames each tile is refreshed anyway, so the bilinear
+    // resampling and slow lighting changes do not accumulate
+    if (gl_LocalInvocationIndex == 0)
+    {
+        ivec2 tile = ivec2(gl_WorkGroupID.xy);
+        bool refresh = (tile.x + tile.y * 3) % subsetCount == refreshSubset;
+        imageStore(changedTilesImage, tile, uvec4(tileInvalid != 0 ? 2u : (refresh ? 1u : 0u)));
+    }
+}
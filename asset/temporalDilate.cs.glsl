@@ -0,0 +1,51 @@
+#version 460
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+// of temporalClassify.cs.glsl, 2: some pixel has no usable history, 1: refreshed only
+layout(binding = 0) uniform usampler2D changedTiles;
+
+layout(r8ui, binding = 1) uniform writeonly uimage2D tileMaskImage;
+
+layout(std430, binding = 0) buffer TemporalResult
+{
+    uint recomputedPixels;
+};
+
+// tiles the filter support of a pixel reaches into
+uniform int dilation;
+uniform vec2 frameSize;
+
+const int tileSize = 16;
+
+// A tile is filtered again when it is refreshed or any tile within the filter support
+// lost its history, otherwise the blurs of its border pixels would keep reading the old
+// content of the neighbour.
+void main()
+{
+    ivec2 tiles = textureSize(changedTiles, 0);
+    ivec2 tile = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(tile, tiles)))
+        return;
+
+    bool recompute = texelFetch(changedTiles, tile, 0).r != 0u;
+    for (int y = -dilation; y <= dilation && !recompute; ++y)
+    {
+        for (int x = -dilation; x <= dilation; ++x)
+        {
+            ivec2 neighbour = clamp(tile + ivec2(x, y), ivec2(0), tiles - 1);
+            if (texelFetch(changedTiles, neighbour, 0).r == 2u)
+            {
+                recompute = true;
+                break;
+            }
+        }
+    }
+    imageStore(tileMaskImage, tile, uvec4(recompute ? 1u : 0u));
+
+    if (recompute)
+    {
+        ivec2 pixels = min(ivec2(frameSize) - tile * tileSize, ivec2(tileSize));
+        atomicAdd(recomputedPixels, uint(pixels.x * pixels.y));
+    }
+}
@@ -0,0 +1,36 @@
+#version 460
+
+in vec2 texCoords;
+
+layout(binding = 0) uniform usampler2D tileMask;
+
+// tiles around a recomputed one, far enough for the vertical blur taps
+uniform int dilation;
+
+const int tileSize = 16;
+
+// Depth 0: the tile is filtered again, 0.5: only its horizontal blur is needed by a
+// neighbour, 1: the reprojected history is used.
+void main()
+{
+    ivec2 tile = ivec2(gl_FragCoord.xy) / tileSize;
+    ivec2 tiles = textureSize(tileMask, 0);
+    if (texelFetch(tileMask, tile, 0).r != 0u)
+    {
+        gl_FragDepth = 0.0f;
+        return;
+    }
+    for (int y = -dilation; y <= dilation; ++y)
+    {
+        for (int x = -dilation; x <= dilation; ++x)
+        {
+            ivec2 neighbour = clamp(tile + ivec2(x, y), ivec2(0), tiles - 1);
+            if (texelFetch(tileMask, neighbour, 0).r != 0u)
+            {
+                gl_FragDepth = 0.5f;
+                return;
+            }
+        }
+    }
+    gl_FragDepth = 1.0f;
+}
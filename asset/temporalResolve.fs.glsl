@@ -0,0 +1,33 @@
+#version 460
+
+in vec2 texCoords;
+
+layout(location = 0) out vec4 historyColor;
+layout(location = 1) out vec4 historyDepth;
+
+layout(binding = 0) uniform sampler2D filteredTexture;
+layout(binding = 1) uniform sampler2D reprojectedTexture;
+layout(binding = 2) uniform usampler2D tileMask;
+layout(binding = 3) uniform sampler2D sceneTexture;
+layout(binding = 4) uniform sampler2D depthTexture;
+
+uniform vec2 projectionZ;
+
+const int tileSize = 16;
+
+float luminance(vec4 color)
+{
+    return 0.299 * color.r + 0.587 * color.g + 0.114 * color.b;
+}
+
+// the next history: fresh filter results in recomputed tiles, reprojection elsewhere
+void main()
+{
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    bool recompute = texelFetch(tileMask, coord / tileSize, 0).r != 0u;
+    vec3 color = recompute ? texelFetch(filteredTexture, coord, 0).rgb : texelFetch(reprojectedTexture, coord, 0).rgb;
+    historyColor = vec4(color, luminance(texelFetch(sceneTexture, coord, 0)));
+
+    float depth = texelFetch(depthTexture, coord, 0).r * 2.0f - 1.0f;
+    historyDepth = vec4(projectionZ.y / (depth + projectionZ.x));
+}
@@ -3,9 +3,25 @@
 layout(location = 0) in vec3 iv3vertex;
 layout(location = 1) in vec3 iv3normal;
 layout(location = 2) in vec2 iv2tex_coord;
+layout(location = 7) in vec2 iv2lightmap_coord;
+// placement of the instance in the model, identity for meshes drawn once
+layout(location = 8) in mat4 instanceTransform;
 
+uniform mat4 um4m;
 uniform mat4 um4mv;
 uniform mat4 um4p;
+uniform bool lightmapEnable;
+// first entry of the mesh in lightmapRects, one per instance
+uniform int lightmapSlot;
+
+// scale and offset of the instance rectangles in the lightmap atlas
+layout(std430, binding = 4) readonly buffer LightmapRects
+{
+    vec4 lightmapRects[];
+};
+
+// matches the depth prepass (depth.vs.glsl) exactly
+invariant gl_Position;
 
 out VertexData
 {
@@ -13,12 +29,24 @@ out VertexData
     vec3 L; // eye space light vector
     vec3 H; // eye space halfway vector
     vec3 normal;
+    vec3 position; // eye space position
     vec2 texcoord;
+    vec2 lightmapCoord;
 } vertexData;
 
 void main()
 {
-    gl_Position = um4p * um4mv * vec4(iv3vertex, 1.0);
+    mat4 model = um4m * instanceTransform;
+    vec4 position = um4mv * model * vec4(iv3vertex, 1.0);
+    gl_Position = um4p * position;
+    vertexData.position = position.xyz;
     vertexData.texcoord = iv2tex_coord;
-    vertexData.normal = iv3normal;
+    vertexData.lightmapCoord = vec2(0.0);
+    if (lightmapEnable)
+    {
+        vec4 rect = lightmapRects[lightmapSlot + gl_InstanceID];
+        vertexData.lightmapCoord = iv2lightmap_coord * rect.xy + rect.zw;
+    }
+    vertexData.normal = normalize(mat3(model) * iv3normal);
+    vertexData.N = mat3(um4mv * model) * iv3normal;
 }
@@ -0,0 +1,209 @@
+#ifndef BAKESCENE_HPP
+#define BAKESCENE_HPP
+
+#include "common.h"
+#include "model.hpp"
+#include "bvh.hpp"
+#include <map>
+
+// Static scene as seen by the CPU bakers (lightmap.hpp, probevolume.hpp): world space
+// triangles of the static opaque meshes in a BVH4, with a face normal and the mean
+// albedo of their mesh. Lighting values use the convention of the scene shader,
+// albedo * (ambient + sunColor * N.L), so the result of a bake replaces that term.
+class BakeScene
+{
+public:
+    vec3 sun = vec3(0.0f, 1.0f, 0.0f);
+    vec3 sunColor = vec3(1.0f);
+    vec3 skyColor = vec3(0.12f, 0.14f, 0.18f);
+    vec3 boundsMin = vec3(0.0f);
+    vec3 boundsMax = vec3(0.0f);
+    double buildTime = 0.0;
+
+    struct Random
+    {
+        uint32_t state;
+
+        float next()
+        {
+            state = state * 747796405u + 2891336453u;
+            uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+            return ((word >> 22u) ^ word) * (1.0f / 4294967296.0f);
+        }
+    };
+
+    void build(vector<Model>& models, vec3 sunDirection, vec3 sunLight, vec3 sky)
+    {
+        double startTime = glfwGetTime();
+        sun = normalize(sunDirection);
+        sunColor = sunLight;
+        skyColor = sky;
+        vector<vec3> positions;
+        triangleNormals.clear();
+        triangleAlbedos.clear();
+        map<GLuint, vec3> albedos;
+        // meshes sharing buffers keep the vertices only in one of them
+        map<GLuint, Mesh*> sources;
+        for (auto& model: models)
+        {
+            for (auto& mesh: model.getMeshes())
+            {
+                if (!mesh.vertices.empty())
+                    sources[mesh.getGeometryKey()] = &mesh;
+            }
+        }
+        boundsMin = vec3(1e30f);
+        boundsMax = vec3(-1e30f);
+        for (auto& model: models)
+        {
+            if (model.isDynamic())
+                continue;
+            for (auto& mesh: model.getMeshes())
+            {
+                auto found = sources.find(mesh.getGeometryKey());
+                if (found == sources.end() || mesh.isMasked())
+                    continue;
+                const Mesh* source = found->second;
+                vec3 albedo = getAlbedo(mesh, albedos);
+                for (auto& instance: mesh.getInstanceTransforms())
+                {
+                    mat4 world = model.transform * instance;
+                    for (size_t i = 0; i + 2 < source->indices.size(); i += 3)
+                    {
+                        vec3 p[3];
+                        vec3 vertexNormal = vec3(0.0f);
+                        for (int j = 0; j < 3; ++j)
+                        {
+                            const Vertex& vertex = source->vertices[source->indices[i + j]];
+                            p[j] = vec3(world * vec4(vertex.position, 1.0f));
+                            vertexNormal += mat3(world) * vertex.normal;
+                            positions.push_back(p[j]);
+                            boundsMin = min(boundsMin, p[j]);
+                            boundsMax = max(boundsMax, p[j]);
+                        }
+                        // the side the vertex normals point to is the front
+                        vec3 normal = cross(p[1] - p[0], p[2] - p[0]);
+                        normal = length(normal) > 0.0f ? normalize(normal) : vec3(0.0f, 1.0f, 0.0f);
+                        if (dot(normal, vertexNormal) < 0.0f)
+                            normal = -normal;
+                        triangleNormals.push_back(normal);
+                        triangleAlbedos.push_back(albedo);
+                    }
+                }
+            }
+        }
+        rayEpsilon = std::max(length(boundsMax - boundsMin) * 1e-5f, 1e-4f);
+        bvh.build(positions);
+        buildTime = glfwGetTime() - startTime;
+    }
+
+    size_t getTriangleCount()
+    {
+        return triangleNormals.size();
+    }
+
+    size_t getNodeCount()
+    {
+        return bvh.getNodeCount();
+    }
+
+    float getRayEpsilon()
+    {
+        return rayEpsilon;
+    }
+
+    // sunlight arriving at a surface, 0 in shadow
+    vec3 getDirect(vec3 position, vec3 normal, size_t& rays)
+    {
+        float cosine = dot(normal, sun);
+        if (cosine <= 0.0f)
+            return vec3(0.0f);
+        rays++;
+        Ray ray;
+        ray.origin = position + normal * rayEpsilon;
+        ray.direction = sun;
+        return bvh.occluded(ray) ? vec3(0.0f) : sunColor * cosine;
+    }
+
+    // Radiance coming back along ray, from the sky or from diffuse surfaces lit by the
+    // sun and by up to bounces further cosine sampled paths. backface is set when the
+    // ray hits the back of a triangle, the origin is then inside closed geometry.
+    vec3 traceRadiance(Ray ray, int bounces, Random& random, size_t& rays, bool& backface)
+    {
+        vec3 radiance = vec3(0.0f);
+        vec3 throughput = vec3(1.0f);
+        backface = false;
+        for (int bounce = 0; bounce <= bounces; ++bounce)
+        {
+            RayHit hit;
+            rays++;
+            if (!bvh.intersect(ray, hit))
+                return radiance + throughput * skyColor;
+            vec3 normal = triangleNormals[hit.triangle];
+            if (dot(ray.direction, normal) > 0.0f)
+            {
+                backface = bounce == 0;
+                break;
+            }
+            vec3 position = ray.origin + ray.direction * hit.t;
+            throughput *= triangleAlbedos[hit.triangle];
+            radiance += throughput * getDirect(position, normal, rays);
+            ray.origin = position + normal * rayEpsilon;
+            ray.direction = sampleHemisphere(normal, random);
+        }
+        return radiance;
+    }
+
+    // cosine weighted around normal
+    static vec3 sampleHemisphere(vec3 normal, Random& random)
+    {
+        float phi = 2.0f * M_PI * random.next();
+        float r2 = random.next();
+        float r = sqrt(r2);
+        float sign = normal.z >= 0.0f ? 1.0f : -1.0f;
+        float a = -1.0f / (sign + normal.z);
+        float b = normal.x * normal.y * a;
+        vec3 tangent = vec3(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+        vec3 bitangent = vec3(b, sign + normal.y * normal.y * a, -normal.y);
+        return normalize(tangent * (r * cos(phi)) + bitangent * (r * sin(phi)) + normal * sqrt(std::max(1.0f - r2, 0.0f)));
+    }
+
+    static vec3 sampleSphere(Random& random)
+    {
+        float z = 1.0f - 2.0f * random.next();
+        float r = sqrt(std::max(1.0f - z * z, 0.0f));
+        float phi = 2.0f * M_PI * random.next();
+        return vec3(r * cos(phi), r * sin(phi), z);
+    }
+
+private:
+    BVH4 bvh;
+    vector<vec3> triangleNormals;
+    vector<vec3> triangleAlbedos;
+    float rayEpsilon = 1e-3f;
+
+    // mean color of the diffuse texture, from its smallest mipmap level
+    vec3 getAlbedo(Mesh& mesh, map<GLuint, vec3>& cache)
+    {
+        for (auto& it: mesh.textures)
+        {
+            if (it.type != "textureDiffuse")
+                continue;
+            auto found = cache.find(it.id);
+            if (found != cache.end())
+                return found->second;
+            int level = (int)floor(log2((float)std::max(std::max(it.width, it.height), 1)));
+            vec4 color = vec4(0.5f);
+            glBindTexture(GL_TEXTURE_2D, it.id);
+            GLint width = 0;
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+            if (width == 1)
+                glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_FLOAT, &color[0]);
+            cache[it.id] = vec3(color);
+            return vec3(color);
+        }
+        return vec3(0.5f);
+    }
+};
+
+#endif
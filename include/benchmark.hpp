@@ -0,0 +1,98 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include "common.h"
+#include "scene.hpp"
+#include "profiler.hpp"
+#include <vector>
+
+// what the frames were rendered with, written to the CSV line
+struct BenchmarkSetup
+{
+    int lights = 0;
+    bool deferred = false;
+    int width = INIT_WIDTH;
+    int height = INIT_HEIGHT;
+    // deferred tiles shaded with all lights since their light list was full, and the
+    // frames shaded deferred
+    int overflowTiles = 0;
+    int deferredFrames = 0;
+};
+
+// Runs a fixed number of frames without user input and prints frame time statistics.
+// The CSV line at the end is meant to be collected over several scene files to plot
+// frame time and load time against object, triangle and light count, and to find
+// where deferred shading overtakes forward for a light count and resolution.
+class Benchmark
+{
+public:
+    Benchmark(int frames, int warmupFrames = 30)
+        : totalFrames(frames), warmupFrames(warmupFrames)
+    {
+    }
+
+    bool isEnabled()
+    {
+        return totalFrames > 0;
+    }
+
+    bool isFinished()
+    {
+        return isEnabled() && frameCount >= warmupFrames + totalFrames;
+    }
+
+    void beginFrame()
+    {
+        frameStart = glfwGetTime();
+    }
+
+    void endFrame()
+    {
+        // wait for the GPU so the frame time covers the whole frame, not only the submission
+        glFinish();
+        if (frameCount >= warmupFrames)
+            frameTimes.push_back((glfwGetTime() - frameStart) * 1000.0f);
+        frameCount++;
+        if (frameCount == warmupFrames)
+            profiler.reset();
+    }
+
+    void report(const string scenePath, const SceneStats& stats, const BenchmarkSetup& setup)
+    {
+        if (frameTimes.empty())
+            return;
+        vector<float> sorted = frameTimes;
+        sort(sorted.begin(), sorted.end());
+        float sum = 0.0f;
+        for (auto& it: sorted)
+            sum += it;
+        float average = sum / sorted.size();
+        float p95 = sorted[std::min(sorted.size() - 1, (size_t)(sorted.size() * 0.95f))];
+
+        cout << "BENCHMARK::SCENE: " << scenePath << endl;
+        cout << "BENCHMARK::OBJECTS: " << stats.objects << " meshes: " << stats.meshes
+             << " triangles: " << stats.triangles << " materials: " << stats.materials << endl;
+        cout << "BENCHMARK::INSTANCING: " << stats.instancedMeshes << " instanced meshes, " << stats.collapsedDraws
+             << " draws collapsed, " << stats.savedBytes << " bytes saved" << endl;
+        cout << "BENCHMARK::LOAD: " << stats.loadTime << " s" << endl;
+        if (setup.deferredFrames > 0)
+            cout << "BENCHMARK::DEFERRED: overflowing tiles: " << setup.overflowTiles << " in " << setup.deferredFrames << " frames, "
+                 << (float)setup.overflowTiles / setup.deferredFrames << " per frame" << endl;
+        cout << "BENCHMARK::FRAME: frames: " << sorted.size() << " avg: " << average << " ms min: " << sorted.front()
+             << " ms p95: " << p95 << " ms max: " << sorted.back() << " ms" << endl;
+        cout << "BENCHMARK::CSV: scene,objects,meshes,triangles,materials,lights,path,width,height,load_s,avg_ms,p95_ms" << endl;
+        cout << "BENCHMARK::CSV: " << scenePath << "," << stats.objects << "," << stats.meshes << "," << stats.triangles << ","
+             << stats.materials << "," << setup.lights << "," << (setup.deferred ? "deferred" : "forward") << "," << setup.width << ","
+             << setup.height << "," << stats.loadTime << "," << average << "," << p95 << endl;
+        profiler.report();
+    }
+
+private:
+    int totalFrames;
+    int warmupFrames;
+    int frameCount = 0;
+    double frameStart = 0.0;
+    vector<float> frameTimes;
+};
+
+#endif
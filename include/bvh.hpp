@@ -0,0 +1,381 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include "common.h"
+#include <algorithm>
+#include <vector>
+#include <xmmintrin.h>
+
+#define BVH_LEAF_SIZE 4
+#define BVH_BINS 12
+// traversal stack on the call stack, deeper trees use a heap allocated one
+#define BVH_STACK_SIZE 64
+
+struct Ray
+{
+    vec3 origin;
+    vec3 direction;
+    float tMax = 1e30f;
+};
+
+struct RayHit
+{
+    float t = 1e30f;
+    // index in the positions given to build()
+    int triangle = -1;
+};
+
+// Bounding volume hierarchy with 4 children per node over a triangle soup, for the CPU
+// ray tracing of the lightmap baker. It is built as a binary tree with binned SAH and
+// then collapsed, so one SSE slab test covers the 4 boxes of a node.
+class BVH4
+{
+public:
+    // three positions per triangle
+    void build(const vector<vec3>& positions)
+    {
+        nodes.clear();
+        triangles.clear();
+        triangleIds.clear();
+        buildNodes.clear();
+        depth = 0;
+        size_t count = positions.size() / 3;
+        if (count == 0)
+            return;
+
+        vector<vec3> boundsMin(count), boundsMax(count), centroids(count);
+        vector<int> order(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            boundsMin[i] = min(positions[i * 3], min(positions[i * 3 + 1], positions[i * 3 + 2]));
+            boundsMax[i] = max(positions[i * 3], max(positions[i * 3 + 1], positions[i * 3 + 2]));
+            centroids[i] = (boundsMin[i] + boundsMax[i]) * 0.5f;
+            order[i] = i;
+        }
+        buildRecursive(order, 0, count, boundsMin, boundsMax, centroids);
+
+        // triangles in leaf order
+        for (auto& it: order)
+        {
+            vec3 v0 = positions[it * 3];
+            triangles.push_back({v0, positions[it * 3 + 1] - v0, positions[it * 3 + 2] - v0});
+            triangleIds.push_back(it);
+        }
+        collapse(0, 1);
+        buildNodes.clear();
+    }
+
+    // closest hit, hit.t starts as the ray length
+    bool intersect(const Ray& ray, RayHit& hit) const
+    {
+        hit.t = ray.tMax;
+        hit.triangle = -1;
+        traverse(ray, hit, false);
+        return hit.triangle >= 0;
+    }
+
+    // any hit, for shadow rays
+    bool occluded(const Ray& ray) const
+    {
+        RayHit hit;
+        hit.t = ray.tMax;
+        return traverse(ray, hit, true);
+    }
+
+    size_t getNodeCount() const
+    {
+        return nodes.size();
+    }
+
+    // levels of 4-wide nodes
+    int getDepth() const
+    {
+        return depth;
+    }
+
+private:
+    struct alignas(16) Node
+    {
+        float minX[4], minY[4], minZ[4];
+        float maxX[4], maxY[4], maxZ[4];
+        // first triangle and count of a leaf, node index and 0 of an inner node, -1 and 0 when empty
+        int child[4];
+        int count[4];
+    };
+
+    struct BuildNode
+    {
+        vec3 boundsMin;
+        vec3 boundsMax;
+        int left = -1;
+        int right = -1;
+        int first = 0;
+        int count = 0;
+    };
+
+    struct Triangle
+    {
+        vec3 v0;
+        vec3 edge1;
+        vec3 edge2;
+    };
+
+    vector<Node> nodes;
+    vector<Triangle> triangles;
+    vector<int> triangleIds;
+    vector<BuildNode> buildNodes;
+    int depth = 0;
+
+    static float getArea(vec3 size)
+    {
+        size = max(size, vec3(0.0f));
+        return size.x * size.y + size.y * size.z + size.z * size.x;
+    }
+
+    int buildRecursive(vector<int>& order, int first, int count, const vector<vec3>& boundsMin, const vector<vec3>& boundsMax,
+        const vector<vec3>& centroids)
+    {
+        int index = buildNodes.size();
+        buildNodes.push_back(BuildNode());
+        BuildNode node;
+        node.boundsMin = vec3(1e30f);
+        node.boundsMax = vec3(-1e30f);
+        vec3 centroidMin = vec3(1e30f);
+        vec3 centroidMax = vec3(-1e30f);
+        for (int i = first; i < first + count; ++i)
+        {
+            node.boundsMin = min(node.boundsMin, boundsMin[order[i]]);
+            node.boundsMax = max(node.boundsMax, boundsMax[order[i]]);
+            centroidMin = min(centroidMin, centroids[order[i]]);
+            centroidMax = max(centroidMax, centroids[order[i]]);
+        }
+        node.first = first;
+        node.count = count;
+
+        vec3 extent = centroidMax - centroidMin;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        if (count <= BVH_LEAF_SIZE || extent[axis] <= 0.0f)
+        {
+            buildNodes[index] = node;
+            return index;
+        }
+
+        // binned SAH along the longest centroid axis
+        int binCount[BVH_BINS] = {0};
+        vec3 binMin[BVH_BINS], binMax[BVH_BINS];
+        for (int i = 0; i < BVH_BINS; ++i)
+        {
+            binMin[i] = vec3(1e30f);
+            binMax[i] = vec3(-1e30f);
+        }
+        float binScale = BVH_BINS * 0.9999f / extent[axis];
+        for (int i = first; i < first + count; ++i)
+        {
+            int bin = (int)((centroids[order[i]][axis] - centroidMin[axis]) * binScale);
+            binCount[bin]++;
+            binMin[bin] = min(binMin[bin], boundsMin[order[i]]);
+            binMax[bin] = max(binMax[bin], boundsMax[order[i]]);
+        }
+        float rightArea[BVH_BINS];
+        int rightCount[BVH_BINS];
+        vec3 sweepMin = vec3(1e30f), sweepMax = vec3(-1e30f);
+        int sweepCount = 0;
+        for (int i = BVH_BINS - 1; i > 0; --i)
+        {
+            sweepMin = min(sweepMin, binMin[i]);
+            sweepMax = max(sweepMax, binMax[i]);
+            sweepCount += binCount[i];
+            rightArea[i] = getArea(sweepMax - sweepMin);
+            rightCount[i] = sweepCount;
+        }
+        float bestCost = 1e30f;
+        int bestSplit = -1;
+        sweepMin = vec3(1e30f);
+        sweepMax = vec3(-1e30f);
+        sweepCount = 0;
+        for (int i = 0; i < BVH_BINS - 1; ++i)
+        {
+            sweepMin = min(sweepMin, binMin[i]);
+            sweepMax = max(sweepMax, binMax[i]);
+            sweepCount += binCount[i];
+            if (sweepCount == 0 || rightCount[i + 1] == 0)
+                continue;
+            float cost = getArea(sweepMax - sweepMin) * sweepCount + rightArea[i + 1] * rightCount[i + 1];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestSplit = i;
+            }
+        }
+        if (bestSplit < 0)
+        {
+            buildNodes[index] = node;
+            return index;
+        }
+
+        int* middle = partition(order.data() + first, order.data() + first + count, [&](int triangle) {
+            return (int)((centroids[triangle][axis] - centroidMin[axis]) * binScale) <= bestSplit;
+        });
+        int leftCount = middle - (order.data() + first);
+        node.left = buildRecursive(order, first, leftCount, boundsMin, boundsMax, centroids);
+        node.right = buildRecursive(order, first + leftCount, count - leftCount, boundsMin, boundsMax, centroids);
+        buildNodes[index] = node;
+        return index;
+    }
+
+    // Pulls up the grandchildren with the largest boxes until a node has 4 children.
+    int collapse(int buildIndex, int level)
+    {
+        depth = std::max(depth, level);
+        vector<int> children;
+        const BuildNode& root = buildNodes[buildIndex];
+        if (root.left < 0)
+            children.push_back(buildIndex);
+        else
+            children = {root.left, root.right};
+        while (children.size() < 4)
+        {
+            int largest = -1;
+            float largestArea = -1.0f;
+            for (size_t i = 0; i < children.size(); ++i)
+            {
+                const BuildNode& child = buildNodes[children[i]];
+                float area = getArea(child.boundsMax - child.boundsMin);
+                if (child.left >= 0 && area > largestArea)
+                {
+                    largest = i;
+                    largestArea = area;
+                }
+            }
+            if (largest < 0)
+                break;
+            BuildNode opened = buildNodes[children[largest]];
+            children[largest] = opened.left;
+            children.push_back(opened.right);
+        }
+
+        int index = nodes.size();
+        nodes.push_back(Node());
+        for (int i = 0; i < 4; ++i)
+        {
+            Node& node = nodes[index];
+            if (i >= (int)children.size())
+            {
+                node.minX[i] = node.minY[i] = node.minZ[i] = 1e30f;
+                node.maxX[i] = node.maxY[i] = node.maxZ[i] = -1e30f;
+                node.child[i] = -1;
+                node.count[i] = 0;
+                continue;
+            }
+            const BuildNode& child = buildNodes[children[i]];
+            node.minX[i] = child.boundsMin.x;
+            node.minY[i] = child.boundsMin.y;
+            node.minZ[i] = child.boundsMin.z;
+            node.maxX[i] = child.boundsMax.x;
+            node.maxY[i] = child.boundsMax.y;
+            node.maxZ[i] = child.boundsMax.z;
+            if (child.left < 0)
+            {
+                node.child[i] = child.first;
+                node.count[i] = child.count;
+            }
+            else
+            {
+                // nodes may grow, the reference above must not be used after this
+                int childIndex = collapse(children[i], level + 1);
+                nodes[index].child[i] = childIndex;
+                nodes[index].count[i] = 0;
+            }
+        }
+        return index;
+    }
+
+    // Moller-Trumbore
+    bool intersectTriangle(const Triangle& triangle, const Ray& ray, float& t) const
+    {
+        vec3 p = cross(ray.direction, triangle.edge2);
+        float determinant = dot(triangle.edge1, p);
+        if (fabs(determinant) < 1e-12f)
+            return false;
+        float inverse = 1.0f / determinant;
+        vec3 toOrigin = ray.origin - triangle.v0;
+        float u = dot(toOrigin, p) * inverse;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+        vec3 q = cross(toOrigin, triangle.edge1);
+        float v = dot(ray.direction, q) * inverse;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+        t = dot(triangle.edge2, q) * inverse;
+        return t > 0.0f;
+    }
+
+    bool traverse(const Ray& ray, RayHit& hit, bool anyHit) const
+    {
+        if (nodes.empty())
+            return false;
+        vec3 direction = ray.direction;
+        for (int i = 0; i < 3; ++i)
+        {
+            if (fabs(direction[i]) < 1e-12f)
+                direction[i] = direction[i] < 0.0f ? -1e-12f : 1e-12f;
+        }
+        const __m128 originX = _mm_set1_ps(ray.origin.x);
+        const __m128 originY = _mm_set1_ps(ray.origin.y);
+        const __m128 originZ = _mm_set1_ps(ray.origin.z);
+        const __m128 inverseX = _mm_set1_ps(1.0f / direction.x);
+        const __m128 inverseY = _mm_set1_ps(1.0f / direction.y);
+        const __m128 inverseZ = _mm_set1_ps(1.0f / direction.z);
+        const __m128 zero = _mm_setzero_ps();
+
+        // every level pops one node and pushes up to 4
+        int stackLimit = 3 * depth + 1;
+        int localStack[BVH_STACK_SIZE];
+        vector<int> heapStack;
+        int* stack = localStack;
+        if (stackLimit > BVH_STACK_SIZE)
+        {
+            heapStack.resize(stackLimit);
+            stack = heapStack.data();
+        }
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0)
+        {
+            const Node& node = nodes[stack[--stackSize]];
+            __m128 x0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minX), originX), inverseX);
+            __m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxX), originX), inverseX);
+            __m128 y0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minY), originY), inverseY);
+            __m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxY), originY), inverseY);
+            __m128 z0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minZ), originZ), inverseZ);
+            __m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxZ), originZ), inverseZ);
+            __m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)), _mm_max_ps(_mm_min_ps(z0, z1), zero));
+            __m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)), _mm_min_ps(_mm_max_ps(z0, z1), _mm_set1_ps(hit.t)));
+            int mask = _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+
+            for (int i = 0; i < 4; ++i)
+            {
+                if (!(mask & (1 << i)) || node.child[i] < 0)
+                    continue;
+                if (node.count[i] == 0)
+                {
+                    stack[stackSize++] = node.child[i];
+                    continue;
+                }
+                for (int j = node.child[i]; j < node.child[i] + node.count[i]; ++j)
+                {
+                    float t;
+                    if (!intersectTriangle(triangles[j], ray, t) || t >= hit.t)
+                        continue;
+                    hit.t = t;
+                    hit.triangle = triangleIds[j];
+                    if (anyHit)
+                        return true;
+                }
+            }
+        }
+        return hit.triangle >= 0;
+    }
+};
+
+#endif
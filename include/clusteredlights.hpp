@@ -0,0 +1,295 @@
+#ifndef CLUSTEREDLIGHTS_HPP
+#define CLUSTEREDLIGHTS_HPP
+
+#include "common.h"
+#include "shader.hpp"
+#include "workerpool.hpp"
+#include <random>
+#include <xmmintrin.h>
+
+// same grid as fragment.fs.glsl
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_SLICE_SIZE (CLUSTER_X * CLUSTER_Y)
+#define CLUSTER_COUNT (CLUSTER_SLICE_SIZE * CLUSTER_Z)
+
+// std430 layout, world space
+struct PointLight
+{
+    vec4 positionRadius;
+    vec4 color;
+};
+
+// Clustered forward shading. The view frustum is split into CLUSTER_X x CLUSTER_Y
+// screen tiles and CLUSTER_Z exponential depth slices. Every frame the lights are
+// binned into the clusters their sphere touches, each worker thread owning a range
+// of slices and testing 4 cluster boxes at a time with SSE. The per cluster lists
+// are packed into one index buffer, so a fragment only loops over the lights of
+// its own cluster.
+class ClusteredLights
+{
+public:
+    bool enabled = false;
+    int lightCount = 0;
+    float ambient = 0.15f;
+    // end of the first slice, the slices before it would be thinner than the geometry
+    float clusterNear = 5.0f;
+
+    // Random lights inside the scene bounds, radius a fraction of the scene size.
+    void generate(int count, vec3 boundsMin, vec3 boundsMax, unsigned int seed = 1)
+    {
+        lightCount = count;
+        lights.clear();
+        mt19937 random(seed);
+        uniform_real_distribution<float> unit(0.0f, 1.0f);
+        float size = length(boundsMax - boundsMin);
+        for (int i = 0; i < count; ++i)
+        {
+            vec3 position = boundsMin + (boundsMax - boundsMin) * vec3(unit(random), unit(random), unit(random));
+            float radius = size * (0.03f + 0.05f * unit(random));
+            vec3 color = vec3(unit(random), unit(random), unit(random));
+            color /= std::max(color.r, std::max(color.g, color.b));
+            lights.push_back({vec4(position, radius), vec4(color, 1.0f)});
+        }
+        lightsChanged = true;
+    }
+
+    // Bins the lights for this camera and uploads the cluster lists.
+    void update(const mat4& view, const mat4& projection, float near, float far, int width, int height)
+    {
+        if (!initialized)
+            initialize();
+        double startTime = glfwGetTime();
+        renderWidth = width;
+        renderHeight = height;
+
+        if (projection != clusterProjection || near != clusterNearPlane || far != clusterFar)
+            createClusterBounds(projection, near, far);
+
+        viewLights.resize(lights.size());
+        for (size_t i = 0; i < lights.size(); ++i)
+        {
+            vec3 position = vec3(view * vec4(vec3(lights[i].positionRadius), 1.0f));
+            viewLights[i] = vec4(position, lights[i].positionRadius.w);
+        }
+
+        workers.run([this](int part, int partCount) {
+            int first = CLUSTER_Z * part / partCount;
+            int last = CLUSTER_Z * (part + 1) / partCount;
+            binSlices(first, last);
+        });
+
+        // prefix sum of the list sizes, then one packed index array
+        lightIndices.clear();
+        maxClusterLights = 0;
+        for (int i = 0; i < CLUSTER_COUNT; ++i)
+        {
+            clusterRanges[i * 2] = lightIndices.size();
+            clusterRanges[i * 2 + 1] = clusterLights[i].size();
+            lightIndices.insert(lightIndices.end(), clusterLights[i].begin(), clusterLights[i].end());
+            maxClusterLights = std::max(maxClusterLights, clusterLights[i].size());
+        }
+        upload();
+        binTime = (glfwGetTime() - startTime) * 1000.0;
+    }
+
+    // The light buffer alone, for passes which cull the lights themselves.
+    void uploadLights()
+    {
+        if (!initialized)
+            initialize();
+        if (!lightsChanged)
+            return;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(lights.size(), (size_t)1) * sizeof(PointLight), lights.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        renderCounters.uploadBytes += lights.size() * sizeof(PointLight);
+        lightsChanged = false;
+    }
+
+    // after shader.use()
+    void setupShader(Shader& shader)
+    {
+        shader.setBool("lightingEnable", enabled && initialized);
+        shader.setFloat("ambient", ambient);
+        shader.setVec2("clusterTileSize", (float)renderWidth / CLUSTER_X, (float)renderHeight / CLUSTER_Y);
+        shader.setVec2("clusterSlice", sliceScale, sliceBias);
+    }
+
+    void bind()
+    {
+        if (!initialized)
+            return;
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, lightBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, clusterBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, indexBuffer);
+    }
+
+    // CPU time of the last update, binning and upload
+    double getBinTime()
+    {
+        return binTime;
+    }
+
+    float getAverageClusterLights()
+    {
+        return (float)lightIndices.size() / CLUSTER_COUNT;
+    }
+
+    size_t getMaxClusterLights()
+    {
+        return maxClusterLights;
+    }
+
+    int getThreadCount()
+    {
+        return workers.getThreadCount();
+    }
+
+private:
+    WorkerPool workers;
+    bool initialized = false;
+    bool lightsChanged = true;
+    GLuint lightBuffer = 0;
+    GLuint clusterBuffer = 0;
+    GLuint indexBuffer = 0;
+
+    vector<PointLight> lights;
+    vector<vec4> viewLights;
+    vector<vector<GLuint>> clusterLights = vector<vector<GLuint>>(CLUSTER_COUNT);
+    vector<GLuint> clusterRanges = vector<GLuint>(CLUSTER_COUNT * 2);
+    vector<GLuint> lightIndices;
+    size_t maxClusterLights = 0;
+    double binTime = 0.0;
+    int renderWidth = INIT_WIDTH;
+    int renderHeight = INIT_HEIGHT;
+
+    // view space cluster boxes, structure of arrays so SSE loads 4 clusters at once
+    alignas(16) float boxMinX[CLUSTER_COUNT];
+    alignas(16) float boxMinY[CLUSTER_COUNT];
+    alignas(16) float boxMinZ[CLUSTER_COUNT];
+    alignas(16) float boxMaxX[CLUSTER_COUNT];
+    alignas(16) float boxMaxY[CLUSTER_COUNT];
+    alignas(16) float boxMaxZ[CLUSTER_COUNT];
+    // view depth where each slice starts, CLUSTER_Z + 1 entries
+    float sliceDepths[CLUSTER_Z + 1];
+    float sliceScale = 0.0f;
+    float sliceBias = 0.0f;
+    mat4 clusterProjection = mat4(0.0f);
+    float clusterNearPlane = 0.0f;
+    float clusterFar = 0.0f;
+
+    void initialize()
+    {
+        glGenBuffers(1, &lightBuffer);
+        glGenBuffers(1, &clusterBuffer);
+        glGenBuffers(1, &indexBuffer);
+        initialized = true;
+    }
+
+    // slice 0 is [near, clusterNear], the others split [clusterNear, far] exponentially:
+    // slice = log(depth) * sliceScale + sliceBias
+    void createClusterBounds(const mat4& projection, float near, float far)
+    {
+        clusterProjection = projection;
+        clusterNearPlane = near;
+        clusterFar = far;
+        sliceScale = (CLUSTER_Z - 1) / log(far / clusterNear);
+        sliceBias = 1.0f - log(clusterNear) * sliceScale;
+        sliceDepths[0] = near;
+        for (int z = 1; z <= CLUSTER_Z; ++z)
+            sliceDepths[z] = clusterNear * pow(far / clusterNear, (float)(z - 1) / (CLUSTER_Z - 1));
+
+        // a point at NDC (x, y) and view depth d is at (x * d / P00, y * d / P11, -d)
+        for (int z = 0; z < CLUSTER_Z; ++z)
+        {
+            for (int y = 0; y < CLUSTER_Y; ++y)
+            {
+                for (int x = 0; x < CLUSTER_X; ++x)
+                {
+                    int index = x + y * CLUSTER_X + z * CLUSTER_SLICE_SIZE;
+                    vec2 ndcMin = vec2(x, y) / vec2(CLUSTER_X, CLUSTER_Y) * 2.0f - 1.0f;
+                    vec2 ndcMax = vec2(x + 1, y + 1) / vec2(CLUSTER_X, CLUSTER_Y) * 2.0f - 1.0f;
+                    vec2 scale = vec2(1.0f / projection[0][0], 1.0f / projection[1][1]);
+                    vec2 boxMin = vec2(1e30f);
+                    vec2 boxMax = vec2(-1e30f);
+                    for (int i = 0; i < 2; ++i)
+                    {
+                        float depth = sliceDepths[z + i];
+                        boxMin = min(boxMin, min(ndcMin * scale * depth, ndcMax * scale * depth));
+                        boxMax = max(boxMax, max(ndcMin * scale * depth, ndcMax * scale * depth));
+                    }
+                    boxMinX[index] = boxMin.x;
+                    boxMinY[index] = boxMin.y;
+                    boxMinZ[index] = -sliceDepths[z + 1];
+                    boxMaxX[index] = boxMax.x;
+                    boxMaxY[index] = boxMax.y;
+                    boxMaxZ[index] = -sliceDepths[z];
+                }
+            }
+        }
+    }
+
+    // slices [first, last) belong to one thread, so are their cluster lists
+    void binSlices(int first, int last)
+    {
+        for (int i = first * CLUSTER_SLICE_SIZE; i < last * CLUSTER_SLICE_SIZE; ++i)
+            clusterLights[i].clear();
+
+        const __m128 zero = _mm_setzero_ps();
+        for (size_t light = 0; light < viewLights.size(); ++light)
+        {
+            vec4 sphere = viewLights[light];
+            float nearest = -sphere.z - sphere.w;
+            float farthest = -sphere.z + sphere.w;
+            int sliceFirst = std::max(getSlice(nearest), first);
+            int sliceLast = std::min(getSlice(farthest) + 1, last);
+            if (farthest < sliceDepths[0] || sliceFirst >= sliceLast)
+                continue;
+
+            __m128 centerX = _mm_set1_ps(sphere.x);
+            __m128 centerY = _mm_set1_ps(sphere.y);
+            __m128 centerZ = _mm_set1_ps(sphere.z);
+            __m128 radius2 = _mm_set1_ps(sphere.w * sphere.w);
+            for (int i = sliceFirst * CLUSTER_SLICE_SIZE; i < sliceLast * CLUSTER_SLICE_SIZE; i += 4)
+            {
+                // distance from the center to the box, per axis 0 when inside
+                __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(boxMinX + i), centerX),
+                    _mm_sub_ps(centerX, _mm_load_ps(boxMaxX + i))), zero);
+                __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(boxMinY + i), centerY),
+                    _mm_sub_ps(centerY, _mm_load_ps(boxMaxY + i))), zero);
+                __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(boxMinZ + i), centerZ),
+                    _mm_sub_ps(centerZ, _mm_load_ps(boxMaxZ + i))), zero);
+                __m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                int hits = _mm_movemask_ps(_mm_cmple_ps(distance2, radius2));
+                for (int j = 0; j < 4; ++j)
+                {
+                    if (hits & (1 << j))
+                        clusterLights[i + j].push_back(light);
+                }
+            }
+        }
+    }
+
+    int getSlice(float depth)
+    {
+        if (depth <= clusterNear)
+            return 0;
+        return glm::clamp((int)(log(depth) * sliceScale + sliceBias), 0, CLUSTER_Z - 1);
+    }
+
+    void upload()
+    {
+        uploadLights();
+        // orphaned every frame, the driver hands out new storage instead of waiting
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, clusterRanges.size() * sizeof(GLuint), clusterRanges.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, indexBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(lightIndices.size(), (size_t)1) * sizeof(GLuint), lightIndices.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        renderCounters.uploadBytes += (clusterRanges.size() + lightIndices.size()) * sizeof(GLuint);
+    }
+};
+
+#endif
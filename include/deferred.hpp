@@ -0,0 +1,101 @@
+#ifndef DEFERRED_HPP
+#define DEFERRED_HPP
+
+#include "common.h"
+#include "shader.hpp"
+#include "frame.hpp"
+#include "clusteredlights.hpp"
+#include "shadows.hpp"
+#include "probevolume.hpp"
+
+#define DEFERRED_TILE_SIZE 16
+#define DEFERRED_OVERFLOW_BINDING 5
+
+// Deferred path next to the clustered forward one. The scene pass only writes the
+// G-buffer of the frame, then a compute pass with one work group per 16x16 tile finds
+// the depth range of its tile, culls the lights against the tile box in shared memory
+// and shades its pixels into the frame color texture, where the filters pick it up.
+// The output modes are resolved from the G-buffer by the same pass. A tile with more
+// lights than its shared list holds falls back to all lights and is counted, so the
+// forward and deferred timings of the benchmark stay comparable.
+class DeferredShading
+{
+public:
+    Shader gbufferShader;
+    Shader maskedGBufferShader;
+
+    DeferredShading()
+        : gbufferShader("asset/vertex.vs.glsl", "asset/gbuffer.fs.glsl"),
+          maskedGBufferShader(Shader::withDefines("asset/vertex.vs.glsl", "asset/gbuffer.fs.glsl", "#define ALPHA_TEST\n")),
+          lightingShader("asset/deferredLighting.cs.glsl")
+    {
+        GLuint zero = 0;
+        glGenBuffers(1, &overflowBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, overflowBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), &zero, GL_DYNAMIC_READ);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // after the G-buffer of frame was drawn, the light buffer has to be bound
+    void shade(Frame& frame, ClusteredLights& lights, CascadedShadows& shadows, ProbeVolume& probes, const mat4& view,
+        const mat4& projection, int outputMode, vec3 clearColor)
+    {
+        GBuffer gbuffer = frame.getGBuffer();
+        lightingShader.use();
+        lightingShader.setMat4("view", view);
+        lightingShader.setVec2("projectionScale", 1.0f / projection[0][0], 1.0f / projection[1][1]);
+        lightingShader.setVec2("projectionZ", projection[2][2], projection[3][2]);
+        lightingShader.setVec2("renderSize", frame.getRenderWidth(), frame.getRenderHeight());
+        lightingShader.setInt("outputMode", outputMode);
+        // the light buffer is only kept up to date for the lit output
+        bool lightingEnable = lights.enabled && outputMode == 0;
+        lightingShader.setBool("lightingEnable", lightingEnable);
+        lightingShader.setInt("lightCount", lightingEnable ? lights.lightCount : 0);
+        lightingShader.setFloat("ambient", lights.ambient);
+        lightingShader.setVec3("clearColor", clearColor.x, clearColor.y, clearColor.z);
+        shadows.setupShader(lightingShader);
+        probes.setupShader(lightingShader, view);
+
+        const GLuint textures[5] = {gbuffer.albedo.texture, gbuffer.normal.texture, gbuffer.material.texture, frame.getDepthTarget().texture,
+            gbuffer.irradiance.texture};
+        for (int i = 0; i < 5; ++i)
+        {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+        }
+        glBindImageTexture(0, frame.getColorTarget().texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DEFERRED_OVERFLOW_BINDING, overflowBuffer);
+        glDispatchCompute((frame.getRenderWidth() + DEFERRED_TILE_SIZE - 1) / DEFERRED_TILE_SIZE,
+            (frame.getRenderHeight() + DEFERRED_TILE_SIZE - 1) / DEFERRED_TILE_SIZE, 1);
+        // the filters sample the result, the blit of the compare bar reads it as a framebuffer
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+        glActiveTexture(GL_TEXTURE0);
+        renderCounters.drawCalls++;
+        renderCounters.stateChanges += 7;
+        shadedFrames++;
+    }
+
+    // Tiles that fell back to all lights since the start, waits for the GPU. Only for the
+    // end of a benchmark.
+    GLuint getOverflowTiles()
+    {
+        GLuint count = 0;
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, overflowBuffer);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &count);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        return count;
+    }
+
+    int getShadedFrames()
+    {
+        return shadedFrames;
+    }
+
+private:
+    Shader lightingShader;
+    GLuint overflowBuffer = 0;
+    int shadedFrames = 0;
+};
+
+#endif
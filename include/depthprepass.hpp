@@ -0,0 +1,51 @@
+#ifndef DEPTHPREPASS_HPP
+#define DEPTHPREPASS_HPP
+
+#include "common.h"
+#include "shader.hpp"
+#include "profiler.hpp"
+
+// Shaders of the depth-only prepass and of the alpha-tested meshes. With the prepass
+// every mesh first writes depth (opaque ones from the position-only stream), then the
+// color pass tests GL_EQUAL without depth writes, so each pixel is shaded once and the
+// masked meshes need no discard any more. The fragment shader invocations of the scene
+// pass are kept for both settings to show what the prepass saves.
+class DepthPrepass
+{
+public:
+    Shader depthShader;
+    Shader maskedDepthShader;
+    // the scene shader with the alpha test, for masked meshes without the prepass
+    Shader maskedShader;
+
+    DepthPrepass()
+        : depthShader("asset/depth.vs.glsl", "asset/depth.fs.glsl"),
+          maskedDepthShader(Shader::withDefines("asset/depth.vs.glsl", "asset/depth.fs.glsl", "#define ALPHA_TEST\n")),
+          maskedShader(Shader::withDefines("asset/vertex.vs.glsl", "asset/fragment.fs.glsl", "#define ALPHA_TEST\n"))
+    {
+    }
+
+    // after a frame which drew the scene
+    void update(const PassStatistics& scene, bool prepass)
+    {
+        invocations[prepass] = scene.pipeline[STAT_FRAGMENT_INVOCATIONS];
+    }
+
+    // smoothed over the last frames drawn with (or without) the prepass
+    double getInvocations(bool prepass)
+    {
+        return invocations[prepass];
+    }
+
+    float getSavedFraction()
+    {
+        if (invocations[0] <= 0.0 || invocations[1] <= 0.0)
+            return 0.0f;
+        return 1.0f - invocations[1] / invocations[0];
+    }
+
+private:
+    double invocations[2] = {0.0, 0.0};
+};
+
+#endif
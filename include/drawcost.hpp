@@ -0,0 +1,176 @@
+#ifndef DRAWCOST_HPP
+#define DRAWCOST_HPP
+
+#include "common.h"
+#include "mesh.hpp"
+#include <fstream>
+#include <map>
+#include <vector>
+
+#define DRAWCOST_LATENCY 3
+
+struct DrawCost
+{
+    string name;
+    string material;
+    size_t triangles = 0;
+    int instances = 0;
+    float gpuTime = 0.0f; // microseconds per frame, summed over all instances
+};
+
+// Wraps mesh draws in timestamp queries. Only a window of drawsPerFrame draws is
+// measured each frame and the window walks over the whole frame, so the cost of
+// the queries is amortized and a full table is rebuilt every few frames. Results
+// are read DRAWCOST_LATENCY frames later to avoid stalling on the GPU.
+class DrawCostProfiler
+{
+public:
+    bool enabled = false;
+    int drawsPerFrame = 64;
+
+    void beginFrame()
+    {
+        drawIndex = 0;
+        if (!enabled)
+            return;
+        collect(pools[frameIndex % DRAWCOST_LATENCY]);
+    }
+
+    void beginDraw(const Mesh& mesh)
+    {
+        if (!enabled)
+            return;
+        if ((size_t)drawIndex >= drawMeshes.size())
+        {
+            drawMeshes.resize(drawIndex + 1, NULL);
+            drawTimes.resize(drawIndex + 1, 0.0f);
+        }
+        drawMeshes[drawIndex] = &mesh;
+
+        if (isMeasured(drawIndex))
+        {
+            Pool& pool = pools[frameIndex % DRAWCOST_LATENCY];
+            if (pool.used == pool.queries.size())
+            {
+                GLuint ids[2];
+                glGenQueries(2, ids);
+                pool.queries.push_back({ids[0], ids[1], 0});
+            }
+            Query& query = pool.queries[pool.used++];
+            query.drawIndex = drawIndex;
+            glQueryCounter(query.start, GL_TIMESTAMP);
+        }
+    }
+
+    void endDraw()
+    {
+        if (!enabled)
+            return;
+        if (isMeasured(drawIndex))
+        {
+            Pool& pool = pools[frameIndex % DRAWCOST_LATENCY];
+            glQueryCounter(pool.queries[pool.used - 1].end, GL_TIMESTAMP);
+        }
+        drawIndex++;
+    }
+
+    void endFrame()
+    {
+        if (!enabled)
+            return;
+        frameDraws = drawIndex;
+        drawMeshes.resize(frameDraws);
+        drawTimes.resize(frameDraws);
+        windowStart += drawsPerFrame;
+        if (windowStart >= frameDraws)
+            windowStart = 0;
+        frameIndex++;
+    }
+
+    // Per mesh cost, most expensive first.
+    vector<DrawCost> getTable()
+    {
+        map<const Mesh*, DrawCost> rows;
+        for (size_t i = 0; i < drawMeshes.size(); ++i)
+        {
+            const Mesh* mesh = drawMeshes[i];
+            if (mesh == NULL)
+                continue;
+            DrawCost& row = rows[mesh];
+            row.name = mesh->name;
+            row.material = mesh->material;
+            row.triangles = mesh->getTriangleCount();
+            row.instances++;
+            row.gpuTime += drawTimes[i];
+        }
+
+        vector<DrawCost> table;
+        for (auto& it: rows)
+            table.push_back(it.second);
+        sort(table.begin(), table.end(), [](const DrawCost& a, const DrawCost& b) { return a.gpuTime > b.gpuTime; });
+        return table;
+    }
+
+    void exportCSV(const string path)
+    {
+        ofstream file(path);
+        if (!file.is_open())
+        {
+            cout << "ERROR::DRAWCOST::EXPORT: Failed to open " << path << endl;
+            return;
+        }
+        file << "mesh,material,triangles,instances,gpu_us" << endl;
+        for (auto& it: getTable())
+            file << "\"" << it.name << "\",\"" << it.material << "\"," << it.triangles << "," << it.instances << "," << it.gpuTime << endl;
+        cout << "DEBUG::DRAWCOST::EXPORT: " << path << endl;
+    }
+
+private:
+    struct Query
+    {
+        GLuint start;
+        GLuint end;
+        int drawIndex;
+    };
+
+    struct Pool
+    {
+        vector<Query> queries;
+        size_t used = 0;
+    };
+
+    Pool pools[DRAWCOST_LATENCY];
+    vector<const Mesh*> drawMeshes;
+    vector<float> drawTimes;
+    int drawIndex = 0;
+    int frameDraws = 0;
+    int windowStart = 0;
+    unsigned long frameIndex = 0;
+
+    bool isMeasured(int index)
+    {
+        return index >= windowStart && index < windowStart + drawsPerFrame;
+    }
+
+    void collect(Pool& pool)
+    {
+        for (size_t i = 0; i < pool.used; ++i)
+        {
+            Query& query = pool.queries[i];
+            GLint available = 0;
+            glGetQueryObjectiv(query.end, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available || (size_t)query.drawIndex >= drawTimes.size())
+                continue;
+
+            GLuint64 start, end;
+            glGetQueryObjectui64v(query.start, GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(query.end, GL_QUERY_RESULT, &end);
+            drawTimes[query.drawIndex] = (end - start) / 1000.0f;
+        }
+        pool.used = 0;
+    }
+};
+
+DrawCostProfiler drawCostProfiler;
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef DYNAMICRESOLUTION_HPP
+#define DYNAMICRESOLUTION_HPP
+
+#include "common.h"
+#include "profiler.hpp"
+
+// Picks the render scale (per axis) from the measured GPU time of the resolution
+// dependent passes. Their cost is roughly proportional to the pixel count, i.e. to
+// scale squared, so the next scale is scale * sqrt(budget / time). Decisions are
+// taken every interval frames, long enough for the profiler to see the last one.
+class DynamicResolution
+{
+public:
+    bool enabled = false;
+    float targetTime = 16.6f;
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+    int interval = 20;
+
+    void update(float gpuTime)
+    {
+        if (!enabled)
+        {
+            scale = maxScale;
+            return;
+        }
+        if (++frames < interval || gpuTime <= 0.0f)
+            return;
+        frames = 0;
+
+        // aim a little under the budget, and leave the scale alone within the band
+        if (gpuTime <= targetTime && gpuTime >= targetTime * 0.75f)
+            return;
+        float next = scale * sqrt(targetTime * 0.9f / gpuTime);
+        // grow slowly, a too large step is paid with a missed frame
+        next = std::min(next, scale + 0.05f);
+        // whole 1/64 steps, so the viewport does not jitter by single pixels
+        next = glm::clamp(round(next * 64.0f) / 64.0f, minScale, maxScale);
+        if (next == scale)
+            return;
+
+        char text[128];
+        snprintf(text, sizeof(text), "render scale %.0f%% -> %.0f%% (GPU %.2f ms, budget %.2f ms)", scale * 100.0f, next * 100.0f, gpuTime, targetTime);
+        profiler.logEvent(text);
+        scale = next;
+    }
+
+    float getScale()
+    {
+        return scale;
+    }
+
+private:
+    float scale = 1.0f;
+    int frames = 0;
+};
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef FILTERSWEEP_HPP
+#define FILTERSWEEP_HPP
+
+#include "common.h"
+#include "frame.hpp"
+#include <fstream>
+#include <functional>
+#include <vector>
+#include <cmath>
+
+struct SweepResolution
+{
+    const char* name;
+    int width;
+    int height;
+};
+
+const SweepResolution sweepResolutions[] = {
+    {"720p", 1280, 720},
+    {"1080p", 1920, 1080},
+    {"1440p", 2560, 1440},
+    {"4K", 3840, 2160}
+};
+
+struct DivisorResult
+{
+    const char* filter;
+    const char* resolution;
+    int divisor;
+    float time;
+    float meanError = 0.0f; // of the RGB channels against the full resolution blurs, 0-255
+    int maxError = 0;
+    float psnr = 0.0f;
+};
+
+// Renders one fixed scene frame per resolution, then times only Frame::draw for every
+// filter mode with the compare bar off and on, with the generic and the specialized
+// frame program. The result is a matrix of GPU milliseconds, rows are filter/compare
+// bar/program combinations and columns are resolutions. The filters with blurs are
+// also rendered with each blur divisor and diffed against the full resolution image.
+class FilterSweep
+{
+public:
+    int iterations = 20;
+    int warmupIterations = 3;
+
+    void run(Frame& frame, Shader& frameShader, int filterCount, const char** filterNames, function<void()> renderScene)
+    {
+        const int resolutionCount = sizeof(sweepResolutions) / sizeof(sweepResolutions[0]);
+        vector<vector<float>> results(filterCount * 4, vector<float>(resolutionCount, 0.0f));
+
+        vector<DivisorResult> divisorResults;
+        glGenQueries(1, &query);
+        for (int r = 0; r < resolutionCount; ++r)
+        {
+            const SweepResolution& resolution = sweepResolutions[r];
+            frame.setFrameSize(resolution.width, resolution.height);
+            frame.setRenderScale(1.0f);
+            frame.setTemporalEnable(false);
+            frame.setCompareBarX(resolution.width / 2.0f);
+            frame.setMagnifierCeanter(vec2(resolution.width, resolution.height) / 2.0f);
+            frame.updateFrameBufferObject();
+            createTargetObject(resolution.width, resolution.height);
+            glViewport(0, 0, resolution.width, resolution.height);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, frame.FBO);
+            glClearColor(0.0f, 0.25f, 0.0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glEnable(GL_DEPTH_TEST);
+            renderScene();
+
+            glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+            glDisable(GL_DEPTH_TEST);
+            frame.setBlurDivisor(1);
+            for (int i = 0; i < filterCount * 4; ++i)
+            {
+                frame.setFilterMode(i / 4);
+                frame.setCompareBarEnable(i % 2 == 1);
+                frame.setSpecializeEnable(i / 2 % 2 == 1);
+                results[i][r] = timeDraw(frame, frameShader);
+            }
+
+            // abstraction and watercolor
+            for (int mode = 1; mode <= 2; ++mode)
+            {
+                frame.setFilterMode(mode);
+                frame.setCompareBarEnable(false);
+                frame.setSpecializeEnable(true);
+                vector<unsigned char> reference;
+                for (int divisor = 1; divisor <= 4; divisor *= 2)
+                {
+                    frame.setBlurDivisor(divisor);
+                    DivisorResult result = {filterNames[mode], resolution.name, divisor, timeDraw(frame, frameShader)};
+                    vector<unsigned char> pixels = readTarget(resolution.width, resolution.height);
+                    if (divisor == 1)
+                        reference = pixels;
+                    compareImage(reference, pixels, result);
+                    divisorResults.push_back(result);
+                }
+            }
+            frame.setBlurDivisor(1);
+
+            deleteTargetObject();
+        }
+        glDeleteQueries(1, &query);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        report(results, filterNames);
+        reportDivisors(divisorResults);
+    }
+
+private:
+    GLuint query = 0;
+    GLuint targetFBO = 0;
+    GLuint targetTexture = 0;
+
+    // average GPU ms of Frame::draw into the bound target
+    float timeDraw(Frame& frame, Shader& frameShader)
+    {
+        frame.finishVariant();
+        GLuint64 total = 0;
+        for (int n = 0; n < warmupIterations + iterations; ++n)
+        {
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            frame.draw(frameShader);
+            glEndQuery(GL_TIME_ELAPSED);
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+            if (n >= warmupIterations)
+                total += elapsed;
+        }
+        return total / 1000000.0f / iterations;
+    }
+
+    vector<unsigned char> readTarget(int width, int height)
+    {
+        vector<unsigned char> pixels(width * height * 4);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, targetFBO);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        return pixels;
+    }
+
+    void compareImage(const vector<unsigned char>& reference, const vector<unsigned char>& pixels, DivisorResult& result)
+    {
+        double sum = 0.0;
+        double squared = 0.0;
+        int maxError = 0;
+        size_t count = 0;
+        for (size_t i = 0; i < pixels.size(); ++i)
+        {
+            if (i % 4 == 3)
+                continue;
+            int error = abs((int)pixels[i] - (int)reference[i]);
+            sum += error;
+            squared += error * error;
+            maxError = std::max(maxError, error);
+            count++;
+        }
+        result.meanError = sum / count;
+        result.maxError = maxError;
+        double mse = squared / count;
+        result.psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+    }
+
+    void createTargetObject(int width, int height)
+    {
+        glGenTextures(1, &targetTexture);
+        glBindTexture(GL_TEXTURE_2D, targetTexture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+
+        glGenFramebuffers(1, &targetFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, targetFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, targetTexture, 0);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            cout << "ERROR::FILTERSWEEP::TARGET: Framebuffer is not complete!" << endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void deleteTargetObject()
+    {
+        glDeleteFramebuffers(1, &targetFBO);
+        glDeleteTextures(1, &targetTexture);
+    }
+
+    void report(const vector<vector<float>>& results, const char** filterNames)
+    {
+        ofstream file("filter_sweep.csv");
+        file << "filter,compare_bar,program";
+        cout << "FILTERSWEEP::MATRIX: GPU ms of Frame::draw" << endl;
+        printf("%-20s %-8s %-12s", "filter", "bar", "program");
+        for (auto& it: sweepResolutions)
+        {
+            file << "," << it.name << "_ms";
+            printf(" %10s", it.name);
+        }
+        file << endl;
+        printf("\n");
+
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const char* bar = i % 2 == 1 ? "on" : "off";
+            const char* program = i / 2 % 2 == 1 ? "specialized" : "generic";
+            file << filterNames[i / 4] << "," << bar << "," << program;
+            printf("%-20s %-8s %-12s", filterNames[i / 4], bar, program);
+            for (auto& it: results[i])
+            {
+                file << "," << it;
+                printf(" %10.3f", it);
+            }
+            file << endl;
+            printf("\n");
+        }
+        cout << "DEBUG::FILTERSWEEP::REPORT: filter_sweep.csv" << endl;
+    }
+
+    void reportDivisors(const vector<DivisorResult>& results)
+    {
+        ofstream file("filter_sweep_divisor.csv");
+        file << "filter,resolution,divisor,ms,mean_error,max_error,psnr_db" << endl;
+        cout << "FILTERSWEEP::DIVISOR: blur divisor against full resolution blurs" << endl;
+        printf("%-20s %-8s %8s %10s %10s %10s %10s\n", "filter", "res", "divisor", "ms", "mean err", "max err", "PSNR dB");
+        for (auto& it: results)
+        {
+            file << it.filter << "," << it.resolution << "," << it.divisor << "," << it.time << ","
+                << it.meanError << "," << it.maxError << "," << it.psnr << endl;
+            printf("%-20s %-8s %8d %10.3f %10.3f %10d %10.2f\n", it.filter, it.resolution, it.divisor,
+                it.time, it.meanError, it.maxError, it.psnr);
+        }
+        cout << "DEBUG::FILTERSWEEP::REPORT: filter_sweep_divisor.csv" << endl;
+    }
+};
+
+#endif
@@ -4,6 +4,9 @@
 #include "common.h"
 #include "texture.hpp"
 #include "shader.hpp"
+#include "postprocess.hpp"
+#include "shadervariants.hpp"
+#include "temporal.hpp"
 
 const GLfloat quadVertices[] = {
         -1.0f,  1.0f,  0.0f, 1.0f,
@@ -15,116 +18,376 @@ const GLfloat quadVertices[] = {
          1.0f,  1.0f,  1.0f, 1.0f
     }; 
 
+// how far each filter mode reads the scene away from the pixel it writes, in UV
+const vec2 filterMargins[] = {
+    vec2(0.0f),
+    vec2(0.0f),
+    vec2(2.0f / 256.0f),
+    vec2(0.0f),
+    vec2(0.0f),
+    vec2(8.0f / 512.0f),
+    vec2(0.06f, 0.0f),
+    vec2(0.0f)
+};
+
+// stages which can be chained by the "Filter Chain" filter mode
+enum ChainStage
+{
+    STAGE_ABSTRACTION,
+    STAGE_WATERCOLOR,
+    STAGE_BLOOM,
+    STAGE_PIXELIZATION,
+    STAGE_SINE_WAVE,
+    STAGE_QUANTIZE
+};
+
+// Render targets of the deferred path, sharing the depth texture of the frame.
+struct GBuffer
+{
+    RenderTarget albedo;   // RGBA8 diffuse texture
+    RenderTarget normal;   // RG16F octahedral world normal
+    RenderTarget material; // RGBA8 lit mask, occlusion
+    RenderTarget irradiance; // RGBA16F baked lighting, alpha 1 where lightmapped
+};
+
 class Frame
 {
 public:
     GLuint FBO;
+    // scene pass of the deferred path, 0 while it is off
+    GLuint gbufferFBO = 0;
 
     Frame()
+        : blurShader("asset/frameVertex.vs.glsl", "asset/frameBlur.fs.glsl"),
+          bloomShader("asset/frameVertex.vs.glsl", "asset/frameBloom.fs.glsl"),
+          upscaleShader("asset/frameVertex.vs.glsl", "asset/frameUpscale.fs.glsl"),
+          upsampleShader("asset/frameVertex.vs.glsl", "asset/frameUpsample.fs.glsl"),
+          frameVariants("asset/frameVertex.vs.glsl", "asset/frameFragment.fs.glsl")
     {
-        glGenFramebuffers(1, &FBO);
-        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
-        
-        createFrameTextureObject();
-
-        createFrameRenderObject();
-
-        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-            cout << "ERROR::FRAME::INIT: Framebuffer is not complete!" << endl;
-        else
-            cout << "DEBUG::FRAME::INIT: Framebuffer is complete!" << endl;
-
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        // glDeleteFramebuffers(1, &FBO);
+        createFrameBufferObject();
 
         createFrameVextexObject();
 
         filterTextures.push_back(Texture("asset/textures/noise_texture_0001.png", "textureUnknow"));
+
+        // queue the default variant now, so it links together with the startup programs
+        getFrameVariant();
     }
 
-    void draw(Shader& shader)
+    // Runs the post-process graph of the current filter settings into the bound framebuffer.
+    // genericShader is the uniform-driven frame program, used when variants are disabled
+    // or the one of the current modes is still compiling.
+    void draw(Shader& genericShader)
     {
-        shader.use();
+        GLint targetFBO;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFBO);
+        timerCounter = (timerCounter + 1) % 180;
 
-        setupShaderUniform(shader);
+        // a variant the driver is still compiling would stall the draw, the generic program
+        // renders the same until it is ready
+        Shader* variant = specializeEnable ? &getFrameVariant() : NULL;
+        Shader& shader = variant != NULL && variant->isReady() ? *variant : genericShader;
+
+        string key = getGraphKey(shader);
+        if (key != graphKey)
+        {
+            temporal.invalidate();
+            buildGraph(shader);
+            graphKey = key;
+        }
 
-        glBindVertexArray(quadVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, FBT);
-        int unit = 1;
-        for (auto& it: filterTextures) {
-            it.activeAndBind(shader, unit++);
+        // the unfiltered part of the frame is copied, only the rest goes through the filters
+        vec4 region = getFilterRegion();
+        bool temporalActive = isTemporalActive();
+        if (temporalActive)
+        {
+            temporal.setFrameSize(frameWidth, frameHeight);
+            temporal.classify(FBT, depthTexture, view, projection, getTemporalDilation());
+            graph.setExternal("temporalTiles", temporal.getTileMask());
+            graph.setExternal("reprojected", temporal.getReprojected());
+            graph.setExternal("historyColor", temporal.getNextColor());
+            graph.setExternal("historyDepth", temporal.getNextDepth());
         }
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        glBindVertexArray(0);
+        else
+            temporal.invalidate();
+        graph.setExternal("sceneDepth", depthTarget);
+        if (region != vec4(0.0f, 0.0f, 1.0f, 1.0f))
+            blitScene(targetFBO, filterMode == 3 ? 0 : (int)(region.z * frameWidth));
+
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, filterTextures[0].id);
+        if (overdrawEnable)
+        {
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, overdrawTexture);
+        }
+        graph.execute(targetPool, FBT, targetFBO, quadVAO, ivec2(allocatedWidth, allocatedHeight), ivec2(frameWidth, frameHeight),
+            region, getUVScale());
+        if (temporalActive)
+            temporal.swap();
+        changed = false;
     }
 
     void setTimerCounter(int val)
     {
-        timerCounter = val;
+        changeTo(timerCounter, val);
     }
 
     void setFilterMode(int val)
     {
-        filterMode = val;
+        changeTo(filterMode, val);
     }
 
     void setTestMode(int val)
     {
-        testMode = val;
+        changeTo(testMode, val);
     }
 
     void setFrameSize(int width, int height)
     {
-        frameWidth = width;
-        frameHeight = height;
+        changeTo(frameWidth, width);
+        changeTo(frameHeight, height);
     }
 
     void setCompareBarEnable(bool val)
     {
-        compareBarEnbale = val;
+        changeTo(compareBarEnbale, val);
     }
 
     void setCompareBarX(float val)
     {
-        compareBarX = val;
+        changeTo(compareBarX, val);
     }
 
     void setMagnifierCeanter(vec2 val)
     {
-        magnifierCenter = val;
+        changeTo(magnifierCenter, val);
     }
 
     void setMagnifierRadius(float val)
     {
-        magnifierRadius = val;
+        changeTo(magnifierRadius, val);
     }
 
-    void updateFrameBufferObject()
+    void setOverdrawEnable(bool val)
     {
-        glGenFramebuffers(1, &FBO);
-        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
-        
-        createFrameTextureObject();
+        changeTo(overdrawEnable, val);
+    }
 
-        createFrameRenderObject();
+    void setOverdrawTexture(GLuint val)
+    {
+        changeTo(overdrawTexture, val);
+    }
 
-        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-            cout << "ERROR::FRAME::INIT: Framebuffer is not complete!" << endl;
+    // the camera of the scene in FBO, for the temporal reprojection
+    void setCamera(const mat4& viewMatrix, const mat4& projectionMatrix)
+    {
+        changeTo(view, viewMatrix);
+        changeTo(projection, projectionMatrix);
+    }
+
+    // Reuse the last filtered frame where the reprojection is valid, the abstraction and
+    // watercolor modes are the only ones worth it (their blurs cost several passes).
+    void setTemporalEnable(bool val)
+    {
+        changeTo(temporalEnable, val);
+    }
+
+    // Frame size divisor of the blurs of the abstraction and watercolor filters (and
+    // chain stages), 1, 2 or 4. They are upsampled back with a bilateral filter.
+    void setBlurDivisor(int val)
+    {
+        changeTo(blurDivisor, val);
+    }
+
+    bool isTemporalActive()
+    {
+        return temporalEnable && (filterMode == 1 || filterMode == 2) && getUVScale() == vec2(1.0f) && !overdrawEnable;
+    }
+
+    float getRecomputedFraction()
+    {
+        return temporal.getRecomputedFraction();
+    }
+
+    void setFilterChain(const vector<int>& val)
+    {
+        changeTo(filterChain, val);
+    }
+
+    // Fraction of the frame size the scene and the filters render at, the targets keep
+    // the frame size and only their bottom left part is used.
+    void setRenderScale(float val)
+    {
+        changeTo(renderScale, val);
+    }
+
+    float getRenderScale()
+    {
+        // the overdraw heatmap reads the counters per window pixel
+        return overdrawEnable ? 1.0f : renderScale;
+    }
+
+    // the used part of the targets, which can be larger than the frame while resizing
+    vec2 getUVScale()
+    {
+        return getRenderScale() * vec2(frameWidth, frameHeight) / vec2(allocatedWidth, allocatedHeight);
+    }
+
+    int getRenderWidth()
+    {
+        return std::max((int)ceil(frameWidth * getRenderScale()), 1);
+    }
+
+    int getRenderHeight()
+    {
+        return std::max((int)ceil(frameHeight * getRenderScale()), 1);
+    }
+
+    // Whether the last image is out of date, because a parameter changed since the last
+    // draw or the filter moves on its own (sine wave uses the timer).
+    bool isChanged()
+    {
+        return changed || isAnimated();
+    }
+
+    bool isAnimated()
+    {
+        if (filterMode == 6)
+            return true;
+        return filterMode == 7 && find(filterChain.begin(), filterChain.end(), STAGE_SINE_WAVE) != filterChain.end();
+    }
+
+    void setSpecializeEnable(bool val)
+    {
+        changeTo(specializeEnable, val);
+    }
+
+    // Blocks until the variant of the current modes is linked, so measurements do not
+    // time the generic fallback.
+    void finishVariant()
+    {
+        if (specializeEnable)
+            getFrameVariant().use();
+    }
+
+    size_t getVariantCount()
+    {
+        return frameVariants.getVariantCount();
+    }
+
+    void setBloomLevels(int val)
+    {
+        changeTo(bloomLevels, val);
+    }
+
+    void setBloomThreshold(float val)
+    {
+        changeTo(bloomThreshold, val);
+    }
+
+    void setBloomIntensity(float val)
+    {
+        changeTo(bloomIntensity, val);
+    }
+
+    size_t getGraphPassCount()
+    {
+        return graph.getPassCount();
+    }
+
+    int getFusedPassCount()
+    {
+        return graph.getFusedCount();
+    }
+
+    size_t getTargetCount()
+    {
+        return targetPool.getTargetCount();
+    }
+
+    // After the frame size changed. The old targets are kept when the frame still fits
+    // them during a resize, otherwise they are handed to the target manager to delete.
+    void updateFrameBufferObject()
+    {
+        changed = true;
+        ivec2 allocation = targetManager.getAllocation(ivec2(allocatedWidth, allocatedHeight), ivec2(frameWidth, frameHeight));
+        if (allocation == ivec2(allocatedWidth, allocatedHeight))
+            return;
+
+        targetManager.destroyFramebuffer(FBO);
+        targetManager.destroy(colorTarget);
+        targetManager.destroy(depthTarget);
+        deleteGBufferObject();
+        allocatedWidth = allocation.x;
+        allocatedHeight = allocation.y;
+        createFrameBufferObject();
+        if (deferredEnable)
+            createGBufferObject();
+        targetPool.clear();
+    }
+
+    // The G-buffer exists only while the deferred path is in use.
+    void setDeferredEnable(bool val)
+    {
+        if (val == deferredEnable)
+            return;
+        deferredEnable = val;
+        if (deferredEnable)
+            createGBufferObject();
         else
-            cout << "DEBUG::FRAME::INIT: Framebuffer is complete!" << endl;
+            deleteGBufferObject();
+    }
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // written by the deferred lighting pass
+    RenderTarget getColorTarget()
+    {
+        return colorTarget;
+    }
+
+    RenderTarget getDepthTarget()
+    {
+        return depthTarget;
+    }
+
+    GBuffer getGBuffer()
+    {
+        return gbuffer;
     }
 
 private:
     GLuint FBT;
+    GLuint depthTexture;
+    RenderTarget colorTarget;
+    RenderTarget depthTarget;
+    GBuffer gbuffer;
+    bool deferredEnable = false;
     GLuint quadVAO;
     vector<Texture> filterTextures;
 
+    Shader blurShader;
+    Shader bloomShader;
+    Shader upscaleShader;
+    Shader upsampleShader;
+    ShaderVariants frameVariants;
+    TemporalReuse temporal;
+    bool specializeEnable = true;
+    PostProcessGraph graph;
+    RenderTargetPool targetPool;
+    string graphKey;
+    vector<int> filterChain;
+
     int frameWidth = INIT_WIDTH;
     int frameHeight = INIT_HEIGHT;
-    
+    int allocatedWidth = INIT_WIDTH;
+    int allocatedHeight = INIT_HEIGHT;
+    float renderScale = 1.0f;
+    bool changed = true;
+    bool temporalEnable = false;
+    int blurDivisor = 1;
+    mat4 view = mat4(1.0f);
+    mat4 projection = mat4(1.0f);
+
     int timerCounter = 0;
     int filterMode = 0;
     int testMode = 0;
@@ -135,42 +398,442 @@ private:
     vec2 magnifierCenter = vec2(frameWidth, frameHeight) / 2.0f;
     float magnifierRadius = 70.0f;
 
+    bool overdrawEnable = false;
+    GLuint overdrawTexture = 0;
+    float overdrawScale = 8.0f;
+
+    int bloomLevels = 5;
+    float bloomThreshold = 0.7f;
+    float bloomKnee = 0.2f;
+    float bloomIntensity = 0.6f;
+
+    template <typename T>
+    void changeTo(T& member, const T& val)
+    {
+        if (member == val)
+            return;
+        member = val;
+        changed = true;
+    }
+
+    // positions are given in render pixels, gl_FragCoord of the filter passes
     void setupShaderUniform(Shader& shader)
     {
-        timerCounter = (timerCounter + 1) % 180;
+        float scale = getRenderScale();
         shader.setInt("timer", timerCounter);
         shader.setInt("testMode", testMode);
-        shader.setInt("filterMode", filterMode);
+        shader.setInt("filterMode", getShaderFilterMode());
         shader.setBool("compareBarEnable", compareBarEnbale);
-        shader.setFloat("compareBarX", compareBarX);
-        shader.setVec2("textureSizeReciprocal", 1.0f / (float)frameWidth, 1.0f / (float)frameHeight);
-        shader.setVec2("frameSize", (float)frameWidth, (float)frameHeight);
-        shader.setVec2("magnifierCenter", magnifierCenter.x, magnifierCenter.y);
-        shader.setFloat("magnifierRadius", magnifierRadius);
+        shader.setFloat("compareBarX", compareBarX * scale);
+        shader.setVec2("frameSize", frameWidth * scale, frameHeight * scale);
+        shader.setVec2("magnifierCenter", magnifierCenter.x * scale, magnifierCenter.y * scale);
+        shader.setFloat("magnifierRadius", magnifierRadius * scale);
+        shader.setBool("overdrawEnable", overdrawEnable);
+        shader.setFloat("overdrawScale", overdrawScale);
+        // the upsample chain adds every level once
+        shader.setFloat("bloomIntensity", bloomIntensity / bloomLevels);
         // cout << "DEBUG::FRAME::DRAW: " << timerCounter << endl;
         // cout << "DEBUG::FRAME::DRAW: " << frameWidth << " " << frameHeight << endl;
     }
 
+    void createFrameBufferObject()
+    {
+        FBO = targetManager.createFramebuffer();
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        
+        createFrameTextureObject();
+
+        createFrameRenderObject();
+
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            cout << "ERROR::FRAME::INIT: Framebuffer is not complete!" << endl;
+        else
+            cout << "DEBUG::FRAME::INIT: Framebuffer is complete! (" << allocatedWidth << "x" << allocatedHeight << ")" << endl;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // RGBA so the deferred lighting pass can write it as an image
     void createFrameTextureObject()
     {
-        glGenTextures(1, &FBT);
-        glBindTexture(GL_TEXTURE_2D, FBT);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, frameWidth, frameHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        colorTarget = targetManager.createTexture(allocatedWidth, allocatedHeight, GL_RGBA8);
+        FBT = colorTarget.texture;
 
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, FBT, 0);
     }
 
+    // a texture rather than a renderbuffer, the temporal reprojection reads the depth
     void createFrameRenderObject()
     {
-        GLuint rbo;
-        glGenRenderbuffers(1, &rbo);
-        glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, frameWidth, frameHeight);  
-        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        depthTarget = targetManager.createTexture(allocatedWidth, allocatedHeight, GL_DEPTH24_STENCIL8);
+        depthTexture = depthTarget.texture;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+    }
+
+    void createGBufferObject()
+    {
+        gbuffer.albedo = targetManager.createTexture(allocatedWidth, allocatedHeight, GL_RGBA8);
+        gbuffer.normal = targetManager.createTexture(allocatedWidth, allocatedHeight, GL_RG16F);
+        gbuffer.material = targetManager.createTexture(allocatedWidth, allocatedHeight, GL_RGBA8);
+        gbuffer.irradiance = targetManager.createTexture(allocatedWidth, allocatedHeight, GL_RGBA16F);
+
+        gbufferFBO = targetManager.createFramebuffer();
+        glBindFramebuffer(GL_FRAMEBUFFER, gbufferFBO);
+        const RenderTarget targets[4] = {gbuffer.albedo, gbuffer.normal, gbuffer.material, gbuffer.irradiance};
+        const GLenum attachments[4] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3};
+        for (int i = 0; i < 4; ++i)
+            glFramebufferTexture2D(GL_FRAMEBUFFER, attachments[i], GL_TEXTURE_2D, targets[i].texture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        glDrawBuffers(4, attachments);
+
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            cout << "ERROR::FRAME::GBUFFER: Framebuffer is not complete!" << endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void deleteGBufferObject()
+    {
+        if (gbufferFBO == 0)
+            return;
+        targetManager.destroyFramebuffer(gbufferFBO);
+        targetManager.destroy(gbuffer.albedo);
+        targetManager.destroy(gbuffer.normal);
+        targetManager.destroy(gbuffer.material);
+        targetManager.destroy(gbuffer.irradiance);
+        gbufferFBO = 0;
+        gbuffer = GBuffer();
+    }
+
+    // with temporal reuse the filter result comes from the history, like a filter chain
+    int getShaderFilterMode()
+    {
+        return isTemporalActive() ? 7 : filterMode;
+    }
+
+    // the frame program with the current modes compiled in
+    Shader& getFrameVariant()
+    {
+        return frameVariants.get({
+            {"FILTER_MODE", getShaderFilterMode()},
+            {"COMPARE_BAR_ENABLE", compareBarEnbale},
+            {"OVERDRAW_ENABLE", overdrawEnable},
+            {"TEST_MODE", testMode}
+        });
+    }
+
+    // The compare bar only needs the filtered side left of it (and the bar itself), the
+    // magnifier only its bounding square. Both overlays are drawn by the frame shader.
+    vec4 getFilterRegion()
+    {
+        vec2 size = vec2(frameWidth, frameHeight);
+        if (overdrawEnable || isTemporalActive())
+            return vec4(0.0f, 0.0f, 1.0f, 1.0f);
+        if (filterMode == 3)
+        {
+            // the resize handle sits on the bottom of the circle
+            vec2 extent = vec2(magnifierRadius + 10.0f);
+            return clamp(vec4((magnifierCenter - extent) / size, (magnifierCenter + extent) / size), 0.0f, 1.0f);
+        }
+        if (compareBarEnbale && filterMode != 0)
+            return vec4(0.0f, 0.0f, glm::clamp((compareBarX + 7.0f) / size.x, 0.0f, 1.0f), 1.0f);
+        return vec4(0.0f, 0.0f, 1.0f, 1.0f);
+    }
+
+    void blitScene(GLuint targetFBO, int startX)
+    {
+        float scale = getRenderScale();
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targetFBO);
+        glBlitFramebuffer(startX * scale, 0, getRenderWidth(), getRenderHeight(), startX, 0, frameWidth, frameHeight,
+            GL_COLOR_BUFFER_BIT, scale < 1.0f ? GL_LINEAR : GL_NEAREST);
+        renderCounters.stateChanges += 2;
+    }
+
+    string getGraphKey(Shader& shader)
+    {
+        // margins and blur steps depend on the frame size and the render scale
+        string key = to_string(shader.program) + ":" + to_string(filterMode) + ":" + to_string(bloomLevels) + ":" + to_string(blurDivisor)
+            + ":" + to_string(frameWidth) + "x" + to_string(frameHeight) + ":" + to_string(allocatedWidth) + "x" + to_string(allocatedHeight)
+            + (getRenderScale() < 1.0f ? ":scaled" + to_string(getRenderScale()) : "") + (isTemporalActive() ? ":temporal" : "");
+        if (filterMode == 7)
+        {
+            for (auto& it: filterChain)
+                key += "," + to_string(it);
+        }
+        return key;
+    }
+
+    void buildGraph(Shader& shader)
+    {
+        graph.clear();
+
+        string chainColor = POST_SCENE;
+        if (filterMode == 7)
+        {
+            for (size_t i = 0; i < filterChain.size(); ++i)
+                chainColor = addStage(filterChain[i], chainColor, "#" + to_string(i));
+        }
+
+        // below full resolution the filter writes the render scale part of a target and a
+        // Catmull-Rom pass upscales it to the window
+        bool upscale = getRenderScale() < 1.0f;
+        PostProcessPass filterPass = PostProcessPass("Filter")
+            .withInput(POST_SCENE, 0)
+            .withOutput(upscale ? "filtered" : POST_FINAL, GL_RGBA8)
+            .withShader(&shader)
+            .withSetup([this](Shader& s) { setupShaderUniform(s); })
+            .withMargin(getFilterMargin(filterMode));
+        if (isTemporalActive())
+            filterPass.withInput(addTemporal(), 6);
+        else if (filterMode == 1 || filterMode == 2)
+        {
+            vector<string> blur = addBlur(POST_SCENE, filterMode == 1, "");
+            filterPass.withInput(blur[0], 3).withInput(blur[1], 5);
+        }
+        if (filterMode == 4)
+            filterPass.withInput(addBloom(POST_SCENE, ""), 7);
+        if (filterMode == 7)
+            filterPass.withInput(chainColor, 6);
+        graph.addPass(filterPass);
+        if (upscale)
+        {
+            graph.addPass(PostProcessPass("Upscale")
+                .withInput("filtered", 0)
+                .withOutput(POST_FINAL, GL_NONE)
+                .withShader(&upscaleShader)
+                .withMargin(2.0f / vec2(allocatedWidth, allocatedHeight)));
+        }
+
+        graph.compile();
+        cout << "DEBUG::FRAME::GRAPH: " << graph.getPassCount() << " passes, " << graph.getFusedCount() << " fused" << endl;
+    }
+
+    // Horizontal then vertical pass of the 9x9 box and DoG luminance blurs of input
+    // (frameBlur.fs.glsl), 9 + 13 taps per pass instead of 81 + 169. Below full
+    // resolution both passes shade 1 / blurDivisor^2 of the pixels and an upsample
+    // pass brings the results back to the frame size.
+    vector<string> addBlur(const string input, bool dogEnable, const string suffix, const string depthMask = "")
+    {
+        vec2 step = getBlurStep();
+        // the depth mask is per frame pixel
+        int divisor = depthMask.empty() ? blurDivisor : 1;
+        const string outputs[2] = {"box9", "dog"};
+        const GLenum formats[2] = {GL_RGBA16F, GL_RG32F};
+
+        float range = dogEnable ? 6.0f : 4.0f;
+        vec2 texel = 1.0f / vec2(allocatedWidth, allocatedHeight);
+        PostProcessPass horizontal = PostProcessPass("Blur H" + suffix)
+            .withShader(&blurShader)
+            .withMargin(vec2(range * step.x, 0.0f) + texel)
+            .withSetup([=](Shader& s) {
+                s.setBool("horizontal", true);
+                s.setBool("dogEnable", dogEnable);
+                s.setVec2("blurStep", step.x, 0.0f);
+            });
+        PostProcessPass vertical = PostProcessPass("Blur V" + suffix)
+            .withShader(&blurShader)
+            .withMargin(vec2(0.0f, range * step.y) + texel)
+            .withSetup([=](Shader& s) {
+                s.setBool("horizontal", false);
+                s.setBool("dogEnable", dogEnable);
+                s.setVec2("blurStep", 0.0f, step.y);
+            });
+
+        // the vertical taps of recomputed pixels reach into the tiles around them
+        if (!depthMask.empty())
+        {
+            horizontal.withDepthMask(depthMask, 0.5f);
+            vertical.withDepthMask(depthMask, 0.0f);
+        }
+
+        vector<string> result;
+        for (int i = 0; i < 2; ++i)
+        {
+            horizontal.withInput(input, i).withOutput(outputs[i] + "H" + suffix, formats[i], divisor);
+            vertical.withInput(outputs[i] + "H" + suffix, i).withOutput(outputs[i] + "V" + suffix, formats[i], divisor);
+            result.push_back(outputs[i] + "V" + suffix);
+        }
+        graph.addPass(horizontal);
+        graph.addPass(vertical);
+        if (divisor == 1)
+            return result;
+
+        vec2 lowSize = vec2(std::max(allocatedWidth / divisor, 1), std::max(allocatedHeight / divisor, 1));
+        PostProcessPass upsample = PostProcessPass("Blur Upsample" + suffix)
+            .withInput(result[0], 0)
+            .withInput(result[1], 1)
+            .withInput(input, 2)
+            .withInput("sceneDepth", 3)
+            .withShader(&upsampleShader)
+            .withMargin(2.0f / lowSize)
+            .withSetup([=, this](Shader& s) {
+                s.setVec2("lowSize", lowSize.x, lowSize.y);
+                s.setBool("dogEnable", dogEnable);
+                s.setVec2("projectionZ", projection[2][2], projection[3][2]);
+                s.setFloat("depthSigma", 0.05f);
+                s.setFloat("lumaSigma", 0.1f);
+            });
+        for (int i = 0; i < 2; ++i)
+        {
+            upsample.withOutput(outputs[i] + suffix, formats[i]);
+            result[i] = outputs[i] + suffix;
+        }
+        graph.addPass(upsample);
+        return result;
+    }
+
+    // Mask of the tiles to recompute as depth, the blurs and the filter function only
+    // shade the masked pixels and a resolve pass writes them together with the
+    // reprojected rest into the next history, which the final pass reads.
+    string addTemporal()
+    {
+        vec2 step = getBlurStep() * vec2(allocatedWidth, allocatedHeight);
+        int dilation = (int)ceil(6.0f * step.y / TEMPORAL_TILE_SIZE);
+        graph.addPass(PostProcessPass("Temporal Mask")
+            .withInput("temporalTiles", 0)
+            .withOutput("temporalMask", GL_DEPTH_COMPONENT32F)
+            .withShader(&temporal.maskShader)
+            .withSetup([dilation](Shader& s) { s.setInt("dilation", dilation); }));
+
+        vector<string> blur = addBlur(POST_SCENE, filterMode == 1, "", "temporalMask");
+        PostProcessPass filterPass = PostProcessPass(filterMode == 1 ? "Abstraction" : "Watercolor")
+            .withFunction(filterMode == 1 ? "imageAbstraction" : "waterColor")
+            .withInput(POST_SCENE, 0).withInput(blur[0], 3)
+            .withOutput("temporalFiltered", GL_RGBA8)
+            .withSetup([this](Shader& s) { setupShaderUniform(s); })
+            .withDepthMask("temporalMask", 0.0f);
+        if (filterMode == 1)
+            filterPass.withInput(blur[1], 5);
+        graph.addPass(filterPass);
+
+        graph.addPass(PostProcessPass("Temporal Resolve")
+            .withInput("temporalFiltered", 0)
+            .withInput("reprojected", 1)
+            .withInput("temporalTiles", 2)
+            .withInput(POST_SCENE, 3)
+            .withInput("sceneDepth", 4)
+            .withOutput("historyColor", GL_RGBA16F)
+            .withOutput("historyDepth", GL_R32F)
+            .withShader(&temporal.resolveShader)
+            .withSetup([this](Shader& s) { s.setVec2("projectionZ", projection[2][2], projection[3][2]); }));
+        return "historyColor";
+    }
+
+    // Bright-pass into half resolution, then bloomLevels - 1 more downsamples and the
+    // upsamples back to half resolution (frameBloom.fs.glsl). Every level has a quarter
+    // of the pixels of the one above, so the whole chain costs about as much as one
+    // full resolution pass, however many levels (i.e. how wide the bloom) there are.
+    string addBloom(const string input, const string suffix)
+    {
+        vector<string> levels;
+        for (int i = 1; i <= bloomLevels; ++i)
+        {
+            string source = i == 1 ? input : levels.back();
+            string output = "bloomDown" + to_string(i) + suffix;
+            int pass = i == 1 ? 0 : 1;
+            graph.addPass(PostProcessPass("Bloom Down " + to_string(i) + suffix)
+                .withInput(source, 0)
+                .withOutput(output, GL_RGBA16F, 1 << i)
+                .withShader(&bloomShader)
+                .withSetup([this, i, pass](Shader& s) { setupBloomUniform(s, pass, i - 1); })
+                .withMargin(getBloomMargin(i - 1)));
+            levels.push_back(output);
+        }
+
+        string result = levels.back();
+        for (int i = bloomLevels - 1; i >= 1; --i)
+        {
+            string output = "bloomUp" + to_string(i) + suffix;
+            graph.addPass(PostProcessPass("Bloom Up " + to_string(i) + suffix)
+                .withInput(result, 0)
+                .withInput(levels[i - 1], 1)
+                .withOutput(output, GL_RGBA16F, 1 << i)
+                .withShader(&bloomShader)
+                .withSetup([this, i](Shader& s) { setupBloomUniform(s, 2, i + 1); })
+                .withMargin(getBloomMargin(i + 1)));
+            result = output;
+        }
+        return result;
+    }
+
+    // half texel offsets (or a full one for the upsample tent) plus the bilinear footprint
+    vec2 getBloomMargin(int level)
+    {
+        return 1.5f / max(vec2(allocatedWidth >> level, allocatedHeight >> level), vec2(1.0f));
+    }
+
+    // the composite reads the half resolution bloom, a couple of frame texels cover filtering
+    vec2 getFilterMargin(int mode)
+    {
+        return filterMargins[mode] + 2.0f / vec2(allocatedWidth, allocatedHeight);
+    }
 
-        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rbo);
+    // level is the mip of the source texture, 0 being the full frame
+    void setupBloomUniform(Shader& shader, int pass, int level)
+    {
+        vec2 size = max(vec2(allocatedWidth >> level, allocatedHeight >> level), vec2(1.0f));
+        shader.setInt("bloomPass", pass);
+        shader.setVec2("halfTexel", 0.5f / size.x, 0.5f / size.y);
+        shader.setFloat("bloomThreshold", bloomThreshold);
+        shader.setFloat("bloomKnee", bloomKnee);
+    }
+
+    string addStage(int stage, const string input, const string suffix)
+    {
+        vector<string> blur;
+        PostProcessPass pass = PostProcessPass("");
+        switch (stage)
+        {
+            case STAGE_ABSTRACTION:
+                blur = addBlur(input, true, suffix);
+                pass = PostProcessPass("Abstraction" + suffix).withFunction("imageAbstraction")
+                    .withInput(input, 0).withInput(blur[0], 3).withInput(blur[1], 5);
+                break;
+            case STAGE_WATERCOLOR:
+                blur = addBlur(input, false, suffix);
+                pass = PostProcessPass("Watercolor" + suffix).withFunction("waterColor")
+                    .withInput(input, 0).withInput(blur[0], 3);
+                break;
+            case STAGE_BLOOM:
+                pass = PostProcessPass("Bloom" + suffix).withFunction("bloomEffect")
+                    .withInput(input, 0).withInput(addBloom(input, suffix), 7);
+                break;
+            case STAGE_PIXELIZATION:
+                pass = PostProcessPass("Pixelization" + suffix).withFunction("pixelization").withInput(input, 0);
+                break;
+            case STAGE_SINE_WAVE:
+                pass = PostProcessPass("Sine Wave" + suffix).withFunction("sineWave").withInput(input, 0);
+                break;
+            case STAGE_QUANTIZE:
+                pass = PostProcessPass("Quantize" + suffix).withPointwise("quantizeColor").withInput(input, 0);
+                break;
+        }
+        // every stage is one of the filter modes, quantize reads nothing but its own pixel
+        const int stageModes[] = {1, 2, 4, 5, 6, 0};
+        string output = "color" + suffix;
+        pass.withOutput(output, GL_RGBA8).withSetup([this](Shader& s) { setupShaderUniform(s); })
+            .withMargin(getFilterMargin(stageModes[stage]));
+        graph.addPass(pass);
+        return output;
+    }
+
+    // Tiles the filter support of a pixel reaches into: the blur taps and, for the
+    // watercolor, the noise offset of the color lookup.
+    int getTemporalDilation()
+    {
+        vec2 support = (6.0f * getBlurStep() + (filterMode == 2 ? 2.0f / 256.0f : 0.0f)) * vec2(allocatedWidth, allocatedHeight);
+        return (int)ceil(std::max(support.x, support.y) / TEMPORAL_TILE_SIZE);
+    }
+
+    // The blurs were tuned while textureSizeReciprocal was overwritten by the noise texture
+    // binding, so they step one noise texel per tap, not one frame pixel. In texcoords of
+    // the targets, of which only the bottom left uvScale part is rendered.
+    vec2 getBlurStep()
+    {
+        return vec2(1.0f / filterTextures[0].width, 1.0f / filterTextures[0].height) * getUVScale();
     }
 
     void createFrameVextexObject()
@@ -0,0 +1,88 @@
+#ifndef GLEXTENSION_HPP
+#define GLEXTENSION_HPP
+
+#include "common.h"
+
+// glad is generated for GL 4.2 without extensions, newer tokens and entry points
+// used by the renderer are declared here and loaded from the context at startup.
+
+// GL 4.6 / ARB_pipeline_statistics_query
+#ifndef GL_VERTICES_SUBMITTED
+#define GL_VERTICES_SUBMITTED             0x82EE
+#define GL_PRIMITIVES_SUBMITTED           0x82EF
+#define GL_VERTEX_SHADER_INVOCATIONS      0x82F0
+#define GL_FRAGMENT_SHADER_INVOCATIONS    0x82F4
+#define GL_COMPUTE_SHADER_INVOCATIONS     0x82F5
+#define GL_CLIPPING_INPUT_PRIMITIVES      0x82F6
+#define GL_CLIPPING_OUTPUT_PRIMITIVES     0x82F7
+#endif
+
+// GL 4.3 compute shaders, shader storage buffers and image copies
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER                 0x91B9
+#define GL_SHADER_STORAGE_BUFFER          0x90D2
+#define GL_SHADER_STORAGE_BARRIER_BIT     0x00002000
+#endif
+
+// KHR_parallel_shader_compile
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR          0x91B1
+#endif
+
+typedef void (APIENTRYP PFNGLDISPATCHCOMPUTEPROC)(GLuint numGroupsX, GLuint numGroupsY, GLuint numGroupsZ);
+PFNGLDISPATCHCOMPUTEPROC glDispatchCompute = NULL;
+
+typedef void (APIENTRYP PFNGLCOPYIMAGESUBDATAPROC)(GLuint srcName, GLenum srcTarget, GLint srcLevel, GLint srcX, GLint srcY, GLint srcZ,
+    GLuint dstName, GLenum dstTarget, GLint dstLevel, GLint dstX, GLint dstY, GLint dstZ, GLsizei srcWidth, GLsizei srcHeight, GLsizei srcDepth);
+PFNGLCOPYIMAGESUBDATAPROC glCopyImageSubData = NULL;
+
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glMaxShaderCompilerThreadsKHR = NULL;
+bool parallelShaderCompile = false;
+
+int glVersion = 0;
+
+bool hasExtension(const char* name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i)
+    {
+        if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool hasPipelineStatistics()
+{
+    return glVersion >= 46 || hasExtension("GL_ARB_pipeline_statistics_query");
+}
+
+void loadExtensions()
+{
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    glVersion = major * 10 + minor;
+
+    glDispatchCompute = (PFNGLDISPATCHCOMPUTEPROC)glfwGetProcAddress("glDispatchCompute");
+    if (glDispatchCompute == NULL)
+        cout << "ERROR::EXTENSION::LOAD: glDispatchCompute is not available" << endl;
+    glCopyImageSubData = (PFNGLCOPYIMAGESUBDATAPROC)glfwGetProcAddress("glCopyImageSubData");
+    if (glCopyImageSubData == NULL)
+        cout << "ERROR::EXTENSION::LOAD: glCopyImageSubData is not available" << endl;
+
+    // let the driver compile and link on its own threads, as many as it likes
+    if (hasExtension("GL_KHR_parallel_shader_compile"))
+        glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+    if (glMaxShaderCompilerThreadsKHR != NULL)
+    {
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        parallelShaderCompile = true;
+    }
+    cout << "DEBUG::EXTENSION::LOAD: parallel shader compile " << (parallelShaderCompile ? "enabled" : "not supported") << endl;
+}
+
+#endif
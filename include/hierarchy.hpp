@@ -0,0 +1,231 @@
+#ifndef HIERARCHY_HPP
+#define HIERARCHY_HPP
+
+#include "common.h"
+#include <vector>
+#include <random>
+#include <emmintrin.h>
+
+// The first three rows of an affine transform, the last one is always 0 0 0 1. 48 bytes
+// instead of 64, the update reads and writes little else.
+struct alignas(16) AffineRows
+{
+    vec4 rows[3];
+
+    AffineRows() {}
+
+    AffineRows(const mat4& matrix)
+    {
+        mat4 transposed = transpose(matrix);
+        for (int i = 0; i < 3; ++i)
+            rows[i] = transposed[i];
+    }
+
+    mat4 toMatrix() const
+    {
+        return transpose(mat4(rows[0], rows[1], rows[2], vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+    }
+};
+
+// Flattened transform hierarchy. Nodes are stored in topological order, every parent
+// before its children, with the parent index, local transform, world transform and dirty
+// flag of a node in separate arrays. An update is then one forward pass: a node is
+// recomputed when it or its parent is dirty, and marks itself dirty for its children.
+// Nothing before the first changed node is visited, and static nodes cost a flag test.
+class TransformHierarchy
+{
+public:
+    // parent is -1 for a root and must have been added before
+    int addNode(int parent, const mat4& local)
+    {
+        if (parent >= (int)parents.size())
+        {
+            cout << "ERROR::HIERARCHY::ADD: parent " << parent << " of node " << parents.size() << " is not added yet" << endl;
+            parent = -1;
+        }
+        parents.push_back(parent);
+        locals.push_back(AffineRows(local));
+        worlds.push_back(parent < 0 ? locals.back() : AffineRows(worlds[parent].toMatrix() * local));
+        dirty.push_back(0);
+        return parents.size() - 1;
+    }
+
+    void setLocal(int node, const mat4& local)
+    {
+        locals[node] = AffineRows(local);
+        dirty[node] = 1;
+        firstDirty = std::min(firstDirty, (size_t)node);
+    }
+
+    mat4 getLocal(int node) const
+    {
+        return locals[node].toMatrix();
+    }
+
+    // as of the last update
+    mat4 getWorld(int node) const
+    {
+        return worlds[node].toMatrix();
+    }
+
+    int getParent(int node) const
+    {
+        return parents[node];
+    }
+
+    size_t size() const
+    {
+        return parents.size();
+    }
+
+    // world matrices recomputed by the last update
+    size_t getUpdatedCount() const
+    {
+        return updatedCount;
+    }
+
+    void clear()
+    {
+        parents.clear();
+        locals.clear();
+        worlds.clear();
+        dirty.clear();
+        firstDirty = SIZE_MAX;
+        updatedCount = 0;
+    }
+
+    // vectorized = false uses scalar code, for the benchmark
+    void update(bool vectorized = true)
+    {
+        updatedCount = 0;
+        size_t count = parents.size();
+        if (firstDirty >= count)
+            return;
+        for (size_t i = firstDirty; i < count; ++i)
+        {
+            int parent = parents[i];
+            if (parent < 0)
+            {
+                if (!dirty[i])
+                    continue;
+                worlds[i] = locals[i];
+            }
+            else
+            {
+                if (!dirty[i] && !dirty[parent])
+                    continue;
+                dirty[i] = 1;
+                if (vectorized)
+                    multiply(worlds[parent], locals[i], worlds[i]);
+                else
+                    multiplyScalar(worlds[parent], locals[i], worlds[i]);
+            }
+            updatedCount++;
+        }
+        fill(dirty.begin() + firstDirty, dirty.end(), 0);
+        firstDirty = SIZE_MAX;
+    }
+
+    // Random hierarchy of nodeCount nodes, updated with all nodes and with a tenth of them
+    // changed, in SIMD and in scalar code. Prints the time of one update.
+    static void benchmark(int nodeCount, int iterations = 200)
+    {
+        TransformHierarchy hierarchy;
+        mt19937 random(1);
+        uniform_real_distribution<float> unit(0.0f, 1.0f);
+        auto randomLocal = [&]() {
+            mat4 local = rotate(mat4(1.0f), unit(random) * 6.2831853f, normalize(vec3(unit(random), unit(random), unit(random)) + 0.1f));
+            local[3] = vec4(unit(random), unit(random), unit(random), 1.0f);
+            return local;
+        };
+        // a few hundred roots, the parents of the others are recent nodes, like a scene
+        // of objects made of nested parts
+        for (int i = 0; i < nodeCount; ++i)
+        {
+            int parent = i % 256 == 0 ? -1 : i - 1 - (int)(unit(random) * std::min(i % 256, 16));
+            hierarchy.addNode(parent, randomLocal());
+        }
+        vector<int> roots, animated;
+        for (int i = 0; i < nodeCount; ++i)
+        {
+            if (hierarchy.getParent(i) < 0)
+                roots.push_back(i);
+            if (unit(random) < 0.1f)
+                animated.push_back(i);
+        }
+
+        cout << "BENCHMARK::HIERARCHY: " << nodeCount << " nodes, " << roots.size() << " roots, " << iterations << " updates" << endl;
+        const char* names[2] = {"all", "animated 10%"};
+        for (int test = 0; test < 2; ++test)
+        {
+            vector<int>& changed = test == 0 ? roots : animated;
+            float times[2];
+            size_t updated = 0;
+            for (int vectorized = 1; vectorized >= 0; --vectorized)
+            {
+                // the best of all iterations, other processes only add time
+                double best = 1e30;
+                for (int iteration = 0; iteration < iterations; ++iteration)
+                {
+                    for (auto& it: changed)
+                        hierarchy.markDirty(it);
+                    double start = glfwGetTime();
+                    hierarchy.update(vectorized);
+                    best = std::min(best, glfwGetTime() - start);
+                }
+                times[vectorized] = best * 1000.0;
+                updated = hierarchy.getUpdatedCount();
+            }
+            cout << "BENCHMARK::HIERARCHY: " << names[test] << ": " << updated << " world matrices, SIMD " << times[1]
+                 << " ms (" << times[1] * 1e6f / std::max(updated, (size_t)1) << " ns each), scalar " << times[0] << " ms" << endl;
+        }
+    }
+
+private:
+    vector<int> parents;
+    vector<AffineRows> locals;
+    vector<AffineRows> worlds;
+    vector<uint8_t> dirty;
+    size_t firstDirty = SIZE_MAX;
+    size_t updatedCount = 0;
+
+    void markDirty(int node)
+    {
+        dirty[node] = 1;
+        firstDirty = std::min(firstDirty, (size_t)node);
+    }
+
+    // result = a * b, every row of the result is a combination of the rows of b
+    // weighted by a row of a, plus the translation of a
+    static void multiply(const AffineRows& a, const AffineRows& b, AffineRows& result)
+    {
+        __m128 b0 = _mm_load_ps(&b.rows[0][0]);
+        __m128 b1 = _mm_load_ps(&b.rows[1][0]);
+        __m128 b2 = _mm_load_ps(&b.rows[2][0]);
+        // keeps only the last lane, the translation
+        const __m128 lastLane = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+        for (int i = 0; i < 3; ++i)
+        {
+            __m128 row = _mm_load_ps(&a.rows[i][0]);
+            __m128 sum = _mm_and_ps(row, lastLane);
+            sum = _mm_add_ps(sum, _mm_mul_ps(b0, _mm_shuffle_ps(row, row, _MM_SHUFFLE(0, 0, 0, 0))));
+            sum = _mm_add_ps(sum, _mm_mul_ps(b1, _mm_shuffle_ps(row, row, _MM_SHUFFLE(1, 1, 1, 1))));
+            sum = _mm_add_ps(sum, _mm_mul_ps(b2, _mm_shuffle_ps(row, row, _MM_SHUFFLE(2, 2, 2, 2))));
+            _mm_store_ps(&result.rows[i][0], sum);
+        }
+    }
+
+    static void multiplyScalar(const AffineRows& a, const AffineRows& b, AffineRows& result)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 4; ++j)
+            {
+                result.rows[i][j] = a.rows[i][0] * b.rows[0][j] + a.rows[i][1] * b.rows[1][j] + a.rows[i][2] * b.rows[2][j]
+                    + (j == 3 ? a.rows[i][3] : 0.0f);
+            }
+        }
+    }
+};
+
+#endif
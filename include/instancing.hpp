@@ -0,0 +1,182 @@
+#ifndef INSTANCING_HPP
+#define INSTANCING_HPP
+
+#include "common.h"
+#include "mesh.hpp"
+#include <map>
+
+// A mesh as imported, before it is uploaded.
+struct MeshData
+{
+    vector<Vertex> vertices;
+    vector<GLuint> indices;
+    vector<Texture> textures;
+    string name;
+    string material;
+};
+
+// Meshes with the same geometry up to a rigid transform: members[0] is stored, the
+// others become instances of it. transforms[i] moves the stored copy onto members[i].
+struct InstanceGroup
+{
+    vector<size_t> members;
+    vector<mat4> transforms;
+};
+
+struct InstancingStats
+{
+    size_t meshes = 0;
+    size_t uniqueMeshes = 0;
+    // groups with more than one member
+    size_t instancedMeshes = 0;
+    // vertex, position and index buffers of the duplicates, less their instance transforms
+    size_t savedBytes = 0;
+};
+
+// Import pass finding repeated meshes, e.g. the columns, arches and vases of Sponza,
+// which exporters deliver as separate meshes with their placement baked into the
+// vertices. Meshes are bucketed by a hash of what a rigid transform keeps: vertex count,
+// index buffer, texture coordinates and material. Within a bucket the transform between
+// two candidates is fitted from two far apart vertices and then verified on every
+// position and normal, so a hash collision only costs time.
+class GeometryInstancer
+{
+public:
+    static inline bool enabled = true;
+    // of the mesh radius
+    float tolerance = 1e-4f;
+
+    vector<InstanceGroup> group(const vector<MeshData>& meshes, InstancingStats& stats)
+    {
+        vector<InstanceGroup> groups;
+        map<uint64_t, vector<size_t>> buckets;
+        for (size_t i = 0; i < meshes.size(); ++i)
+        {
+            vector<size_t>& bucket = buckets[enabled ? hashGeometry(meshes[i]) : i];
+            bool found = false;
+            for (auto& index: bucket)
+            {
+                InstanceGroup& candidate = groups[index];
+                mat4 transform;
+                if (findRigidTransform(meshes[candidate.members[0]], meshes[i], transform))
+                {
+                    candidate.members.push_back(i);
+                    candidate.transforms.push_back(transform);
+                    found = true;
+                    break;
+                }
+            }
+            if (found)
+                continue;
+            bucket.push_back(groups.size());
+            groups.push_back({{i}, {mat4(1.0f)}});
+        }
+
+        stats.meshes += meshes.size();
+        stats.uniqueMeshes += groups.size();
+        for (auto& it: groups)
+        {
+            if (it.members.size() < 2)
+                continue;
+            stats.instancedMeshes++;
+            const MeshData& mesh = meshes[it.members[0]];
+            size_t meshBytes = mesh.vertices.size() * (sizeof(Vertex) + sizeof(vec3)) + mesh.indices.size() * sizeof(GLuint);
+            stats.savedBytes += (it.members.size() - 1) * (meshBytes - sizeof(mat4));
+        }
+        return groups;
+    }
+
+private:
+    static uint64_t hashValue(uint64_t hash, uint64_t value)
+    {
+        // FNV-1a over the 8 bytes of value
+        for (int i = 0; i < 8; ++i)
+        {
+            hash ^= (value >> (i * 8)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    uint64_t hashGeometry(const MeshData& mesh)
+    {
+        uint64_t hash = hashValue(14695981039346656037ull, mesh.vertices.size());
+        hash = hashValue(hash, std::hash<string>()(mesh.material));
+        for (auto& it: mesh.indices)
+            hash = hashValue(hash, it);
+        for (auto& it: mesh.vertices)
+        {
+            hash = hashValue(hash, (int64_t)round(it.texCoords.x * 1024.0f));
+            hash = hashValue(hash, (int64_t)round(it.texCoords.y * 1024.0f));
+        }
+        return hash;
+    }
+
+    static vec3 getCentroid(const MeshData& mesh)
+    {
+        vec3 sum = vec3(0.0f);
+        for (auto& it: mesh.vertices)
+            sum += it.position;
+        return sum / (float)std::max(mesh.vertices.size(), (size_t)1);
+    }
+
+    // orthonormal frame from two vertices around the centroid, identity when degenerate
+    static mat3 getFrame(const MeshData& mesh, vec3 centroid, size_t first, size_t second)
+    {
+        vec3 u = mesh.vertices[first].position - centroid;
+        vec3 w = cross(u, mesh.vertices[second].position - centroid);
+        if (length(u) < 1e-12f || length(w) < 1e-12f)
+            return mat3(1.0f);
+        u = normalize(u);
+        w = normalize(w);
+        return mat3(u, cross(w, u), w);
+    }
+
+    bool findRigidTransform(const MeshData& a, const MeshData& b, mat4& transform)
+    {
+        if (a.vertices.size() != b.vertices.size() || a.indices != b.indices || a.material != b.material || a.vertices.empty())
+            return false;
+        vec3 centroidA = getCentroid(a);
+        vec3 centroidB = getCentroid(b);
+        // the vertex furthest from the centroid, then the one spanning the largest triangle with it
+        size_t first = 0, second = 0;
+        float radius = 0.0f, area = 0.0f;
+        for (size_t i = 0; i < a.vertices.size(); ++i)
+        {
+            float distance = length(a.vertices[i].position - centroidA);
+            if (distance > radius)
+            {
+                radius = distance;
+                first = i;
+            }
+        }
+        for (size_t i = 0; i < a.vertices.size(); ++i)
+        {
+            float size = length(cross(a.vertices[first].position - centroidA, a.vertices[i].position - centroidA));
+            if (size > area)
+            {
+                area = size;
+                second = i;
+            }
+        }
+        mat3 rotation = getFrame(b, centroidB, first, second) * transpose(getFrame(a, centroidA, first, second));
+
+        float limit = std::max(radius * tolerance, 1e-6f);
+        for (size_t i = 0; i < a.vertices.size(); ++i)
+        {
+            const Vertex& va = a.vertices[i];
+            const Vertex& vb = b.vertices[i];
+            if (length(rotation * (va.position - centroidA) + centroidB - vb.position) > limit)
+                return false;
+            if (dot(rotation * va.normal, vb.normal) < 0.999f * length(va.normal) * length(vb.normal))
+                return false;
+            if (length(va.texCoords - vb.texCoords) > 1e-5f)
+                return false;
+        }
+        transform = mat4(rotation);
+        transform[3] = vec4(centroidB - rotation * centroidA, 1.0f);
+        return true;
+    }
+};
+
+#endif
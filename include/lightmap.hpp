@@ -0,0 +1,763 @@
+#ifndef LIGHTMAP_HPP
+#define LIGHTMAP_HPP
+
+#include "common.h"
+#include "model.hpp"
+#include "bakescene.hpp"
+#include "workerpool.hpp"
+#include <atomic>
+#include <fstream>
+#include <numeric>
+
+// after the mask (7) and the shadow cascades (6)
+#define LIGHTMAP_TEXTURE_UNIT 8
+#define LIGHTMAP_CHUNK 256
+
+struct LightmapStats
+{
+    size_t charts = 0;
+    size_t texels = 0;
+    size_t triangles = 0;
+    size_t bvhNodes = 0;
+    size_t rays = 0;
+    float density = 0.0f;
+    double unwrapTime = 0.0;
+    double buildTime = 0.0;
+    double traceTime = 0.0;
+    double denoiseTime = 0.0;
+    double bakeTime = 0.0;
+    bool loaded = false;
+
+    double getRaysPerSecond() const
+    {
+        return traceTime > 0.0 ? rays / traceTime : 0.0;
+    }
+};
+
+// Offline baker of the static lighting: sun, sky and diffuse interreflections.
+//  1. Unwrap: triangles of each mesh are grouped into charts of connected triangles
+//     facing the same axis, projected onto that axis plane and shelf packed, which gives
+//     the second UV set. Vertices on chart borders are split.
+//  2. Every static object gets a rectangle in one atlas, sized by its surface area.
+//  3. The texels covered by each triangle are path traced on all cores against a
+//     BVH4 of the scene: cosine sampled paths with next event estimation of the sun.
+//  4. A bilateral filter guided by position and normal removes most of the noise, the
+//     empty texels around charts are filled from their neighbours for bilinear lookups.
+// The atlas is written next to the scene file and loaded on the next start when the
+// settings did not change. Lighting values use the convention of the scene shader,
+// albedo * (ambient + sunColor * N.L), so a baked texel replaces exactly that term.
+class LightmapBaker
+{
+public:
+    int atlasSize = 2048;
+    int samples = 64;
+    int bounces = 2;
+    vec3 skyColor = vec3(0.12f, 0.14f, 0.18f);
+    LightmapStats stats;
+
+    // Bakes the static models, or loads the atlas of an earlier bake from cachePath.
+    void bake(vector<Model>& models, vec3 sunDirection, vec3 sunColor, const string cachePath, bool reuse = true)
+    {
+        double startTime = glfwGetTime();
+        stats = LightmapStats();
+        sun = normalize(sunDirection);
+        sunLight = sunColor;
+
+        unwrap(models);
+        stats.unwrapTime = glfwGetTime() - startTime;
+        vector<vec3> atlas;
+        if (reuse && loadCache(cachePath, atlas))
+        {
+            stats.loaded = true;
+            cout << "DEBUG::LIGHTMAP::LOAD: " << cachePath << endl;
+        }
+        else
+        {
+            scene.build(models, sun, sunLight, skyColor);
+            stats.triangles = scene.getTriangleCount();
+            stats.bvhNodes = scene.getNodeCount();
+            stats.buildTime = scene.buildTime;
+            rasterize();
+            atlas = trace();
+            denoise(atlas);
+            dilate(atlas);
+            saveCache(cachePath, atlas);
+        }
+        upload(atlas);
+        for (auto& it: instances)
+            models[it.model].lightmapRects[it.slot] = it.transform;
+        for (auto& it: models)
+        {
+            if (!it.isDynamic())
+                it.uploadLightmapRects();
+        }
+
+        stats.bakeTime = glfwGetTime() - startTime;
+        cout << "DEBUG::LIGHTMAP::BAKE: " << stats.charts << " charts, " << stats.texels << " texels, " << stats.triangles
+             << " triangles, " << stats.bvhNodes << " BVH4 nodes" << endl;
+        cout << "DEBUG::LIGHTMAP::BAKE: " << stats.bakeTime << " s (unwrap " << stats.unwrapTime << " s, BVH " << stats.buildTime
+             << " s, trace " << stats.traceTime << " s, denoise " << stats.denoiseTime << " s), "
+             << stats.getRaysPerSecond() / 1e6 << " Mrays/s" << endl;
+        version++;
+    }
+
+    void bind()
+    {
+        if (texture == 0)
+            return;
+        glActiveTexture(GL_TEXTURE0 + LIGHTMAP_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    bool isBaked()
+    {
+        return texture != 0;
+    }
+
+    // changes with every bake, the scene has to be drawn again
+    int getVersion()
+    {
+        return version;
+    }
+
+private:
+    struct Chart
+    {
+        vector<int> triangles;
+        int axis = 0;
+        vec2 boundsMin = vec2(1e30f);
+        vec2 boundsMax = vec2(-1e30f);
+        // position in the layout of the mesh
+        vec2 offset = vec2(0.0f);
+    };
+
+    // unique vertex and index buffers, possibly drawn by several meshes
+    struct Geometry
+    {
+        Mesh* source = NULL;
+        vector<Mesh*> users;
+        vector<Chart> charts;
+        // object space size of the packed charts
+        vec2 layoutSize = vec2(0.0f);
+        float area = 0.0f;
+        float maxScale = 0.0f;
+    };
+
+    // an instance of a mesh of a static model with its rectangle in the atlas
+    struct Instance
+    {
+        int model;
+        // index into the lightmapRects of the model
+        int slot;
+        int geometry;
+        mat4 world;
+        float scale;
+        ivec2 position;
+        ivec2 size;
+        vec4 transform;
+    };
+
+    struct Texel
+    {
+        vec3 position;
+        vec3 normal;
+        vec3 faceNormal;
+        float size;
+        int pixel;
+    };
+
+    vec3 sun = vec3(0.0f, 1.0f, 0.0f);
+    vec3 sunLight = vec3(1.0f);
+    GLuint texture = 0;
+    int version = 0;
+    bool unwrapped = false;
+
+    vector<Geometry> geometries;
+    vector<Instance> instances;
+    BakeScene scene;
+    vector<Texel> texels;
+    vector<int> texelIndices;
+    vector<char> texelValid;
+
+    static float getScale(const mat4& transform)
+    {
+        return cbrt(fabs(determinant(mat3(transform))));
+    }
+
+    // dominant axis of a normal, 0 to 5 for +x -x +y -y +z -z
+    static int getAxis(vec3 normal)
+    {
+        vec3 a = abs(normal);
+        int axis = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+        return axis * 2 + (normal[axis] < 0.0f ? 1 : 0);
+    }
+
+    static vec2 project(vec3 position, int axis)
+    {
+        switch (axis / 2)
+        {
+            case 0:
+                return vec2(position.z, position.y);
+            case 1:
+                return vec2(position.x, position.z);
+            default:
+                return vec2(position.x, position.y);
+        }
+    }
+
+    static int findRoot(vector<int>& parent, int i)
+    {
+        while (parent[i] != i)
+        {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    void unwrap(vector<Model>& models)
+    {
+        if (!unwrapped)
+        {
+            findGeometries(models);
+            for (auto& it: geometries)
+                createCharts(it);
+        }
+        for (auto& it: geometries)
+            stats.charts += it.charts.size();
+
+        // total surface, to spend about half of the atlas on it
+        float area = 0.0f;
+        for (auto& it: instances)
+            area += geometries[it.geometry].area * it.scale * it.scale;
+        float density = sqrt(0.5f * atlasSize * atlasSize / std::max(area, 1e-6f));
+        for (int attempt = 0; attempt < 32; ++attempt)
+        {
+            if (packAtlas(density))
+                break;
+            density *= 0.85f;
+        }
+        stats.density = density;
+
+        if (!unwrapped)
+        {
+            for (auto& it: geometries)
+                applyCharts(it);
+            unwrapped = true;
+        }
+        for (auto& it: instances)
+        {
+            vec2 size = geometries[it.geometry].layoutSize * density * it.scale;
+            it.transform = vec4(size / (float)atlasSize, vec2(it.position) / (float)atlasSize);
+        }
+        for (auto& it: models)
+        {
+            if (it.isDynamic())
+                it.lightmapRects.clear();
+            else
+                it.lightmapRects.assign(it.getInstanceCount(), vec4(0.0f));
+        }
+    }
+
+    void findGeometries(vector<Model>& models)
+    {
+        map<GLuint, int> keys;
+        geometries.clear();
+        instances.clear();
+        for (size_t i = 0; i < models.size(); ++i)
+        {
+            vector<Mesh>& meshes = models[i].getMeshes();
+            int slot = 0;
+            for (size_t j = 0; j < meshes.size(); ++j)
+            {
+                auto found = keys.find(meshes[j].getGeometryKey());
+                if (found == keys.end())
+                {
+                    found = keys.emplace(meshes[j].getGeometryKey(), geometries.size()).first;
+                    geometries.push_back(Geometry());
+                }
+                Geometry& geometry = geometries[found->second];
+                if (find(geometry.users.begin(), geometry.users.end(), &meshes[j]) == geometry.users.end())
+                    geometry.users.push_back(&meshes[j]);
+                if (!meshes[j].vertices.empty())
+                    geometry.source = &meshes[j];
+                // dynamic objects keep their real time lighting
+                if (models[i].isDynamic())
+                    continue;
+                for (auto& it: meshes[j].getInstanceTransforms())
+                {
+                    mat4 world = models[i].transform * it;
+                    float scale = getScale(world);
+                    geometry.maxScale = std::max(geometry.maxScale, scale);
+                    instances.push_back({(int)i, slot++, found->second, world, scale, ivec2(0), ivec2(0), vec4(0.0f)});
+                }
+            }
+        }
+    }
+
+    // connected triangles which face the same axis, joined by equal vertex positions
+    void createCharts(Geometry& geometry)
+    {
+        if (geometry.source == NULL)
+            return;
+        const vector<Vertex>& vertices = geometry.source->vertices;
+        const vector<GLuint>& indices = geometry.source->indices;
+        int triangleCount = indices.size() / 3;
+        vector<int> parent(triangleCount);
+        iota(parent.begin(), parent.end(), 0);
+        vector<int> axes(triangleCount);
+        map<pair<int, array<float, 3>>, int> corners;
+        for (int i = 0; i < triangleCount; ++i)
+        {
+            vec3 p0 = vertices[indices[i * 3]].position;
+            vec3 normal = cross(vertices[indices[i * 3 + 1]].position - p0, vertices[indices[i * 3 + 2]].position - p0);
+            geometry.area += length(normal) * 0.5f;
+            axes[i] = getAxis(normal);
+            for (int j = 0; j < 3; ++j)
+            {
+                vec3 p = vertices[indices[i * 3 + j]].position;
+                auto key = make_pair(axes[i], array<float, 3>{p.x, p.y, p.z});
+                auto found = corners.find(key);
+                if (found == corners.end())
+                    corners[key] = i;
+                else
+                    parent[findRoot(parent, i)] = findRoot(parent, found->second);
+            }
+        }
+
+        map<int, int> chartOfRoot;
+        for (int i = 0; i < triangleCount; ++i)
+        {
+            int root = findRoot(parent, i);
+            auto found = chartOfRoot.find(root);
+            if (found == chartOfRoot.end())
+            {
+                found = chartOfRoot.emplace(root, geometry.charts.size()).first;
+                geometry.charts.push_back(Chart());
+                geometry.charts.back().axis = axes[i];
+            }
+            Chart& chart = geometry.charts[found->second];
+            chart.triangles.push_back(i);
+            for (int j = 0; j < 3; ++j)
+            {
+                vec2 p = project(vertices[indices[i * 3 + j]].position, chart.axis);
+                chart.boundsMin = min(chart.boundsMin, p);
+                chart.boundsMax = max(chart.boundsMax, p);
+            }
+        }
+    }
+
+    // Shelf packing of the charts of every mesh with a border of 2 texels, then of the
+    // mesh rectangles of every object into the atlas. False when they do not fit.
+    bool packAtlas(float density)
+    {
+        for (auto& geometry: geometries)
+        {
+            if (geometry.charts.empty() || geometry.maxScale <= 0.0f)
+                continue;
+            float padding = 2.0f / (density * geometry.maxScale);
+            vector<int> order(geometry.charts.size());
+            iota(order.begin(), order.end(), 0);
+            float packedArea = 0.0f;
+            float widest = 0.0f;
+            for (auto& it: geometry.charts)
+            {
+                vec2 size = it.boundsMax - it.boundsMin + padding;
+                packedArea += size.x * size.y;
+                widest = std::max(widest, size.x);
+            }
+            sort(order.begin(), order.end(), [&](int a, int b) {
+                return geometry.charts[a].boundsMax.y - geometry.charts[a].boundsMin.y > geometry.charts[b].boundsMax.y - geometry.charts[b].boundsMin.y;
+            });
+            float rowWidth = std::max(sqrt(packedArea) * 1.1f, widest);
+            vec2 cursor = vec2(0.0f);
+            float rowHeight = 0.0f;
+            geometry.layoutSize = vec2(0.0f);
+            for (auto& index: order)
+            {
+                Chart& chart = geometry.charts[index];
+                vec2 size = chart.boundsMax - chart.boundsMin + padding;
+                if (cursor.x + size.x > rowWidth)
+                {
+                    cursor = vec2(0.0f, cursor.y + rowHeight);
+                    rowHeight = 0.0f;
+                }
+                chart.offset = cursor + padding * 0.5f;
+                cursor.x += size.x;
+                rowHeight = std::max(rowHeight, size.y);
+                geometry.layoutSize = max(geometry.layoutSize, vec2(cursor.x, cursor.y + rowHeight));
+            }
+        }
+
+        vector<int> order(instances.size());
+        iota(order.begin(), order.end(), 0);
+        for (auto& it: instances)
+            it.size = ivec2(ceil(geometries[it.geometry].layoutSize * density * it.scale)) + 1;
+        sort(order.begin(), order.end(), [&](int a, int b) {
+            return instances[a].size.y > instances[b].size.y;
+        });
+        ivec2 cursor = ivec2(0);
+        int rowHeight = 0;
+        for (auto& index: order)
+        {
+            Instance& instance = instances[index];
+            if (cursor.x + instance.size.x > atlasSize)
+            {
+                cursor = ivec2(0, cursor.y + rowHeight);
+                rowHeight = 0;
+            }
+            if (cursor.x + instance.size.x > atlasSize || cursor.y + instance.size.y > atlasSize)
+                return false;
+            instance.position = cursor;
+            cursor.x += instance.size.x;
+            rowHeight = std::max(rowHeight, instance.size.y);
+        }
+        return true;
+    }
+
+    // new vertices with the lightmap coordinates, one copy per chart a vertex is used in
+    void applyCharts(Geometry& geometry)
+    {
+        if (geometry.source == NULL || geometry.charts.empty())
+            return;
+        const vector<Vertex>& vertices = geometry.source->vertices;
+        const vector<GLuint>& indices = geometry.source->indices;
+        vector<Vertex> newVertices;
+        vector<GLuint> newIndices;
+        vec2 layoutSize = max(geometry.layoutSize, vec2(1e-6f));
+        for (auto& chart: geometry.charts)
+        {
+            map<GLuint, GLuint> remap;
+            for (auto& triangle: chart.triangles)
+            {
+                for (int j = 0; j < 3; ++j)
+                {
+                    GLuint index = indices[triangle * 3 + j];
+                    auto found = remap.find(index);
+                    if (found == remap.end())
+                    {
+                        Vertex vertex = vertices[index];
+                        vertex.lightmapCoords = (project(vertex.position, chart.axis) - chart.boundsMin + chart.offset) / layoutSize;
+                        found = remap.emplace(index, newVertices.size()).first;
+                        newVertices.push_back(vertex);
+                    }
+                    newIndices.push_back(found->second);
+                }
+            }
+        }
+        geometry.source->setLightmapGeometry(newVertices, newIndices);
+        for (auto& it: geometry.users)
+        {
+            if (it != geometry.source)
+                it->shareGeometry(*geometry.source);
+        }
+    }
+
+    // texel centers covered by the triangles of every instance, in atlas pixels
+    void rasterize()
+    {
+        texels.clear();
+        texelIndices.assign(atlasSize * atlasSize, -1);
+        for (auto& instance: instances)
+        {
+            Mesh* source = geometries[instance.geometry].source;
+            if (source == NULL)
+                continue;
+            mat3 normalMatrix = transpose(inverse(mat3(instance.world)));
+            float texelSize = 1.0f / std::max(stats.density * instance.scale, 1e-6f);
+            vec2 scale = vec2(instance.transform.x, instance.transform.y) * (float)atlasSize;
+            vec2 offset = vec2(instance.transform.z, instance.transform.w) * (float)atlasSize;
+            for (size_t i = 0; i + 2 < source->indices.size(); i += 3)
+            {
+                const Vertex* v[3];
+                vec2 p[3];
+                for (int j = 0; j < 3; ++j)
+                {
+                    v[j] = &source->vertices[source->indices[i + j]];
+                    p[j] = v[j]->lightmapCoords * scale + offset;
+                }
+                float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+                if (fabs(area) < 1e-12f)
+                    continue;
+                vec3 world[3];
+                for (int j = 0; j < 3; ++j)
+                    world[j] = vec3(instance.world * vec4(v[j]->position, 1.0f));
+                vec3 faceNormal = cross(world[1] - world[0], world[2] - world[0]);
+                faceNormal = length(faceNormal) > 0.0f ? normalize(faceNormal) : vec3(0.0f, 1.0f, 0.0f);
+                vec3 vertexNormal = normalMatrix * (v[0]->normal + v[1]->normal + v[2]->normal);
+                if (dot(faceNormal, vertexNormal) < 0.0f)
+                    faceNormal = -faceNormal;
+
+                ivec2 low = clamp(ivec2(floor(min(p[0], min(p[1], p[2])))), 0, atlasSize - 1);
+                ivec2 high = clamp(ivec2(ceil(max(p[0], max(p[1], p[2])))), 0, atlasSize - 1);
+                for (int y = low.y; y <= high.y; ++y)
+                {
+                    for (int x = low.x; x <= high.x; ++x)
+                    {
+                        int pixel = y * atlasSize + x;
+                        if (texelIndices[pixel] >= 0)
+                            continue;
+                        vec2 center = vec2(x + 0.5f, y + 0.5f);
+                        float w1 = ((center.x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (center.y - p[0].y)) / area;
+                        float w2 = ((p[1].x - p[0].x) * (center.y - p[0].y) - (center.x - p[0].x) * (p[1].y - p[0].y)) / area;
+                        float w0 = 1.0f - w1 - w2;
+                        if (w0 < -1e-4f || w1 < -1e-4f || w2 < -1e-4f)
+                            continue;
+                        Texel texel;
+                        texel.position = world[0] * w0 + world[1] * w1 + world[2] * w2;
+                        vec3 normal = normalMatrix * (v[0]->normal * w0 + v[1]->normal * w1 + v[2]->normal * w2);
+                        texel.normal = length(normal) > 0.0f ? normalize(normal) : faceNormal;
+                        texel.faceNormal = faceNormal;
+                        texel.size = texelSize;
+                        texel.pixel = pixel;
+                        texelIndices[pixel] = texels.size();
+                        texels.push_back(texel);
+                    }
+                }
+            }
+        }
+        stats.texels = texels.size();
+    }
+
+    // Lighting term of one texel. False when most first hits see back faces, the texel
+    // is then inside other geometry and gets the value of its neighbours.
+    bool traceTexel(const Texel& texel, uint32_t seed, vec3& result, size_t& rays)
+    {
+        BakeScene::Random random = {seed * 9781u + 1u};
+        vec3 indirect = vec3(0.0f);
+        int backfaces = 0;
+        for (int i = 0; i < samples; ++i)
+        {
+            Ray ray;
+            ray.origin = texel.position + texel.faceNormal * scene.getRayEpsilon();
+            ray.direction = BakeScene::sampleHemisphere(texel.normal, random);
+            if (dot(ray.direction, texel.faceNormal) <= 0.0f)
+                continue;
+            bool backface;
+            indirect += scene.traceRadiance(ray, bounces, random, rays, backface);
+            backfaces += backface;
+        }
+        result = scene.getDirect(texel.position, texel.normal, rays) + indirect / (float)samples;
+        return backfaces * 2 < samples;
+    }
+
+    vector<vec3> trace()
+    {
+        double startTime = glfwGetTime();
+        vector<vec3> atlas(atlasSize * atlasSize, vec3(0.0f));
+        texelValid.assign(atlasSize * atlasSize, 0);
+        WorkerPool workers;
+        vector<size_t> rays(workers.getThreadCount(), 0);
+        atomic<size_t> nextChunk(0);
+        size_t chunkCount = (texels.size() + LIGHTMAP_CHUNK - 1) / LIGHTMAP_CHUNK;
+        cout << "DEBUG::LIGHTMAP::TRACE: " << texels.size() << " texels, " << samples << " samples, " << bounces << " bounces on "
+             << workers.getThreadCount() << " threads" << endl;
+
+        workers.run([&](int part, int) {
+            size_t reported = 0;
+            for (size_t chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++)
+            {
+                size_t end = std::min((chunk + 1) * LIGHTMAP_CHUNK, texels.size());
+                for (size_t i = chunk * LIGHTMAP_CHUNK; i < end; ++i)
+                {
+                    vec3 result;
+                    bool valid = traceTexel(texels[i], i, result, rays[part]);
+                    atlas[texels[i].pixel] = result;
+                    texelValid[texels[i].pixel] = valid;
+                }
+                if (part == 0 && chunk * 10 / chunkCount > reported)
+                {
+                    reported = chunk * 10 / chunkCount;
+                    cout << "DEBUG::LIGHTMAP::TRACE: " << reported * 10 << "%" << endl;
+                }
+            }
+        });
+
+        for (auto& it: rays)
+            stats.rays += it;
+        stats.traceTime = glfwGetTime() - startTime;
+        return atlas;
+    }
+
+    // bilateral filter, weighted by distance, position and normal of the texels
+    void denoise(vector<vec3>& atlas)
+    {
+        double startTime = glfwGetTime();
+        const int radius = 3;
+        vector<vec3> filtered = atlas;
+        WorkerPool workers;
+        workers.run([&](int part, int partCount) {
+            for (size_t i = part; i < texels.size(); i += partCount)
+            {
+                const Texel& texel = texels[i];
+                if (!texelValid[texel.pixel])
+                    continue;
+                int x = texel.pixel % atlasSize;
+                int y = texel.pixel / atlasSize;
+                vec3 sum = vec3(0.0f);
+                float weightSum = 0.0f;
+                for (int dy = -radius; dy <= radius; ++dy)
+                {
+                    for (int dx = -radius; dx <= radius; ++dx)
+                    {
+                        int nx = x + dx, ny = y + dy;
+                        if (nx < 0 || ny < 0 || nx >= atlasSize || ny >= atlasSize)
+                            continue;
+                        int neighbour = ny * atlasSize + nx;
+                        if (texelIndices[neighbour] < 0 || !texelValid[neighbour])
+                            continue;
+                        const Texel& other = texels[texelIndices[neighbour]];
+                        vec3 offset = (other.position - texel.position) / (2.0f * texel.size);
+                        float weight = exp(-(dx * dx + dy * dy) / 4.5f - dot(offset, offset))
+                            * pow(std::max(dot(texel.normal, other.normal), 0.0f), 16.0f);
+                        sum += atlas[neighbour] * weight;
+                        weightSum += weight;
+                    }
+                }
+                if (weightSum > 0.0f)
+                    filtered[texel.pixel] = sum / weightSum;
+            }
+        });
+        atlas = filtered;
+        stats.denoiseTime = glfwGetTime() - startTime;
+    }
+
+    // grows the charts by a few texels, so bilinear lookups at their borders stay inside
+    void dilate(vector<char>& valid, vector<vec3>& atlas, int steps)
+    {
+        for (int step = 0; step < steps; ++step)
+        {
+            vector<char> nextValid = valid;
+            for (int y = 0; y < atlasSize; ++y)
+            {
+                for (int x = 0; x < atlasSize; ++x)
+                {
+                    int pixel = y * atlasSize + x;
+                    if (valid[pixel])
+                        continue;
+                    vec3 sum = vec3(0.0f);
+                    int count = 0;
+                    for (int dy = -1; dy <= 1; ++dy)
+                    {
+                        for (int dx = -1; dx <= 1; ++dx)
+                        {
+                            int nx = x + dx, ny = y + dy;
+                            if (nx < 0 || ny < 0 || nx >= atlasSize || ny >= atlasSize || !valid[ny * atlasSize + nx])
+                                continue;
+                            sum += atlas[ny * atlasSize + nx];
+                            count++;
+                        }
+                    }
+                    if (count == 0)
+                        continue;
+                    atlas[pixel] = sum / (float)count;
+                    nextValid[pixel] = 1;
+                }
+            }
+            valid = nextValid;
+        }
+    }
+
+    void dilate(vector<vec3>& atlas)
+    {
+        dilate(texelValid, atlas, 4);
+    }
+
+    void upload(const vector<vec3>& atlas)
+    {
+        if (texture != 0)
+            glDeleteTextures(1, &texture);
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, atlasSize, atlasSize);
+        vector<vec4> pixels(atlas.size());
+        for (size_t i = 0; i < atlas.size(); ++i)
+            pixels[i] = vec4(atlas[i], 1.0f);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, atlasSize, atlasSize, GL_RGBA, GL_FLOAT, pixels.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        renderCounters.uploadBytes += pixels.size() * sizeof(vec4);
+    }
+
+    // everything the atlas depends on besides the scene file itself
+    static uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+    {
+        // FNV-1a
+        const unsigned char* bytes = (const unsigned char*)data;
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // positions, indices and material of every static geometry and the world transform of
+    // every instance, a moved or edited object does not load the old atlas
+    uint64_t getSceneHash()
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (auto& it: geometries)
+        {
+            if (it.source == NULL)
+                continue;
+            for (auto& vertex: it.source->vertices)
+                hash = hashBytes(hash, &vertex.position, sizeof(vec3));
+            hash = hashBytes(hash, it.source->indices.data(), it.source->indices.size() * sizeof(GLuint));
+            hash = hashBytes(hash, it.source->material.data(), it.source->material.size());
+        }
+        for (auto& it: instances)
+        {
+            hash = hashBytes(hash, &it.geometry, sizeof(int));
+            hash = hashBytes(hash, &it.world[0][0], sizeof(mat4));
+        }
+        return hash;
+    }
+
+    vector<float> getCacheKey()
+    {
+        vector<float> key = {(float)atlasSize, (float)samples, (float)bounces, stats.density, (float)instances.size(), (float)stats.charts,
+            sun.x, sun.y, sun.z, sunLight.x, sunLight.y, sunLight.z, skyColor.x, skyColor.y, skyColor.z};
+        // in 16 bit parts, which floats hold exactly
+        uint64_t hash = getSceneHash();
+        for (int i = 0; i < 4; ++i)
+            key.push_back((float)((hash >> (i * 16)) & 0xffff));
+        return key;
+    }
+
+    bool loadCache(const string path, vector<vec3>& atlas)
+    {
+        ifstream file(path, ios::binary);
+        if (!file.is_open())
+            return false;
+        vector<float> key = getCacheKey();
+        vector<float> stored(key.size());
+        file.read((char*)stored.data(), stored.size() * sizeof(float));
+        if (!file || stored != key)
+        {
+            cout << "DEBUG::LIGHTMAP::LOAD: " << path << " was baked with other settings" << endl;
+            return false;
+        }
+        atlas.resize(atlasSize * atlasSize);
+        file.read((char*)atlas.data(), atlas.size() * sizeof(vec3));
+        return (bool)file;
+    }
+
+    void saveCache(const string path, const vector<vec3>& atlas)
+    {
+        ofstream file(path, ios::binary);
+        if (!file.is_open())
+        {
+            cout << "ERROR::LIGHTMAP::SAVE: Failed to write " << path << endl;
+            return;
+        }
+        vector<float> key = getCacheKey();
+        file.write((const char*)key.data(), key.size() * sizeof(float));
+        file.write((const char*)atlas.data(), atlas.size() * sizeof(vec3));
+    }
+};
+
+#endif
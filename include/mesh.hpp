@@ -7,6 +7,20 @@
 
 int checkTexture[14] = {0};
 
+// unit of the opacity mask of alpha-tested meshes, after the material textures
+#define MASK_TEXTURE_UNIT 7
+// mat4 per instance in the attributes 8 to 11
+#define INSTANCE_TRANSFORM_LOCATION 8
+
+// Which meshes of a model to draw. Alpha-tested (masked) meshes discard fragments, so
+// they are drawn apart from the opaque ones, which keep early depth testing.
+enum MeshPass
+{
+    MESH_ALL,
+    MESH_OPAQUE,
+    MESH_MASKED
+};
+
 struct Vertex
 {
     // position
@@ -23,6 +37,8 @@ struct Vertex
     int mBoneIDs[MAX_BONE_INFLUENCE];
     // weights from each bone
     float mWeights[MAX_BONE_INFLUENCE];
+    // second UV set, charts of the baked lightmap (lightmap.hpp)
+    vec2 lightmapCoords;
 };
 
 class Mesh
@@ -31,9 +47,12 @@ public:
     vector<Vertex>  vertices;
     vector<GLuint>  indices;
     vector<Texture> textures;
+    string name;
+    string material;
 
-    Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures)
-        : vertices(vertices), indices(indices), textures(textures)
+    // instances are transforms of the vertices in object space, see instancing.hpp
+    Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures, vector<mat4> instances = {mat4(1.0f)})
+        : vertices(vertices), indices(indices), textures(textures), instanceTransforms(instances)
     {
         setMesh();
     }
@@ -49,18 +68,148 @@ public:
         {
             textures[i].activeAndBind(shader, i);
         }
+        bindMask();
 
         glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+        glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0, instanceTransforms.size());
         glBindVertexArray(0);
+        renderCounters.drawCalls++;
+        renderCounters.stateChanges++;
 
         glActiveTexture(GL_TEXTURE0);
     }
 
+    // Depth only. Opaque meshes read just the position stream, masked ones also need
+    // their texcoords and mask for the alpha test.
+    void drawDepth()
+    {
+        bindMask();
+        glBindVertexArray(isMasked() ? VAO : depthVAO);
+        glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0, instanceTransforms.size());
+        glBindVertexArray(0);
+        renderCounters.drawCalls++;
+        renderCounters.stateChanges++;
+
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    bool isMasked() const
+    {
+        return maskIndex >= 0;
+    }
+
+    bool isInPass(MeshPass pass) const
+    {
+        return pass == MESH_ALL || (pass == MESH_MASKED) == isMasked();
+    }
+
+    // Shares the GPU buffers of this mesh but draws it with other textures
+    Mesh withTextures(vector<Texture> val) const
+    {
+        Mesh copy;
+        copy.textures = val;
+        copy.name = name;
+        copy.material = material;
+        copy.indexCount = indexCount;
+        copy.VAO = VAO;
+        copy.VBO = VBO;
+        copy.EBO = EBO;
+        copy.boundsMin = boundsMin;
+        copy.boundsMax = boundsMax;
+        copy.depthVAO = depthVAO;
+        copy.positionVBO = positionVBO;
+        copy.instanceVBO = instanceVBO;
+        copy.instanceTransforms = instanceTransforms;
+        copy.findMask();
+        return copy;
+    }
+
+    // meshes drawing the same buffers have the same key
+    GLuint getGeometryKey() const
+    {
+        return VAO;
+    }
+
+    // Replaces the buffers by the lightmap unwrapped geometry, where vertices on chart
+    // borders are split.
+    void setLightmapGeometry(const vector<Vertex>& newVertices, const vector<GLuint>& newIndices)
+    {
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteVertexArrays(1, &depthVAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        glDeleteBuffers(1, &positionVBO);
+        glDeleteBuffers(1, &instanceVBO);
+        vertices = newVertices;
+        indices = newIndices;
+        setMesh();
+    }
+
+    // after other, drawn with the same buffers, got new ones
+    void shareGeometry(const Mesh& other)
+    {
+        indexCount = other.indexCount;
+        VAO = other.VAO;
+        VBO = other.VBO;
+        EBO = other.EBO;
+        depthVAO = other.depthVAO;
+        positionVBO = other.positionVBO;
+        instanceVBO = other.instanceVBO;
+    }
+
+    // of every instance
+    size_t getTriangleCount() const
+    {
+        return indexCount / 3 * instanceTransforms.size();
+    }
+
+    size_t getInstanceCount() const
+    {
+        return instanceTransforms.size();
+    }
+
+    const vector<mat4>& getInstanceTransforms() const
+    {
+        return instanceTransforms;
+    }
+
+    // object space bounding box
+    vec3 boundsMin = vec3(0.0f);
+    vec3 boundsMax = vec3(0.0f);
+
 private:
     GLuint VAO, VBO, EBO;
+    // positions only, 12 instead of sizeof(Vertex) bytes per vertex for the depth prepass
+    GLuint depthVAO, positionVBO;
+    GLuint instanceVBO;
+    vector<mat4> instanceTransforms = {mat4(1.0f)};
+    GLsizei indexCount = 0;
+    int maskIndex = -1;
+
+    Mesh() {}
+
+    void findMask()
+    {
+        maskIndex = -1;
+        for (size_t i = 0; i < textures.size(); ++i)
+        {
+            if (textures[i].type == "textureOpacity")
+                maskIndex = i;
+        }
+    }
+
+    void bindMask()
+    {
+        if (!isMasked())
+            return;
+        glActiveTexture(GL_TEXTURE0 + MASK_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, textures[maskIndex].id);
+        renderCounters.stateChanges++;
+    }
+
     void setMesh()
     {
+        indexCount = indices.size();
         // cout << "222 ";
         glGenVertexArrays(1, &VAO);
         glBindVertexArray(VAO);
@@ -72,6 +221,7 @@ private:
         glGenBuffers(1, &EBO);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+        renderCounters.uploadBytes += vertices.size() * sizeof(Vertex) + indices.size() * sizeof(GLuint);
 
         glEnableVertexAttribArray(0); 
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 
@@ -101,8 +251,59 @@ private:
         glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex),
             (GLvoid*)offsetof(Vertex, mWeights));
 
+        glEnableVertexAttribArray(7);
+        glVertexAttribPointer(7, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+            (GLvoid*)offsetof(Vertex, lightmapCoords));
+
+        glGenBuffers(1, &instanceVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, instanceTransforms.size() * sizeof(mat4), instanceTransforms.data(), GL_STATIC_DRAW);
+        renderCounters.uploadBytes += instanceTransforms.size() * sizeof(mat4);
+        setInstanceAttributes();
+
+        setDepthMesh();
+        findMask();
         glBindVertexArray(0);
     }
+
+    void setDepthMesh()
+    {
+        vector<vec3> positions;
+        positions.reserve(vertices.size());
+        boundsMin = vertices.empty() ? vec3(0.0f) : vertices[0].position;
+        boundsMax = boundsMin;
+        for (auto& it: vertices)
+        {
+            positions.push_back(it.position);
+            boundsMin = min(boundsMin, it.position);
+            boundsMax = max(boundsMax, it.position);
+        }
+
+        glGenVertexArrays(1, &depthVAO);
+        glBindVertexArray(depthVAO);
+
+        glGenBuffers(1, &positionVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(vec3), positions.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        renderCounters.uploadBytes += positions.size() * sizeof(vec3);
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (GLvoid*)0);
+        setInstanceAttributes();
+    }
+
+    // one column of the transform per attribute, advancing once per instance
+    void setInstanceAttributes()
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        for (int i = 0; i < 4; ++i)
+        {
+            glEnableVertexAttribArray(INSTANCE_TRANSFORM_LOCATION + i);
+            glVertexAttribPointer(INSTANCE_TRANSFORM_LOCATION + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (GLvoid*)(i * sizeof(vec4)));
+            glVertexAttribDivisor(INSTANCE_TRANSFORM_LOCATION + i, 1);
+        }
+    }
 };
 
 #endif
\ No newline at end of file
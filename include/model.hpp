@@ -2,14 +2,20 @@
 #define MODEL_HPP
 
 #include "mesh.hpp"
+#include "drawcost.hpp"
+#include "instancing.hpp"
 
 #include "assimp/Importer.hpp"
 #include "assimp/scene.h"
 #include "assimp/postprocess.h"
 #include "texture.hpp"
+#include <memory>
 
 vector<Texture> loadedTextures;
 
+// shader storage binding of the lightmap rectangles of the drawn model
+#define LIGHTMAP_RECTS_BINDING 4
+
 struct ImageData
 {
     int width;
@@ -24,20 +30,147 @@ struct ImageData
 class Model 
 {
 public:
+    // world transform of this copy, meshes are shared between copies
+    mat4 transform = mat4(1.0f);
+    // degrees per second around the world Y axis, 0 for static geometry
+    float orbitSpeed = 0.0f;
+    // node in the scene hierarchy (hierarchy.hpp) the transform is taken from, -1 for none
+    int node = -1;
+    // Scale and offset from the lightmap coordinates of each mesh instance into the atlas,
+    // the instances of all meshes one after the other. Empty when not baked.
+    vector<vec4> lightmapRects;
+    static inline bool lightmapEnable = false;
+
     Model(const string path)
+        : meshes(make_shared<vector<Mesh>>())
     {
         loadModel(path);
     }
 
-    void draw(Shader& shader)
+    Model(vector<Mesh> generatedMeshes)
+        : meshes(make_shared<vector<Mesh>>(generatedMeshes))
+    {
+    }
+
+    Model withTransform(const mat4 &val) const
+    {
+        Model copy = *this;
+        copy.transform = val;
+        return copy;
+    }
+
+    // Moves around the world origin from the current transform, driven by the scene.
+    Model withOrbit(float speed) const
+    {
+        Model copy = *this;
+        copy.orbitSpeed = speed;
+        return copy;
+    }
+
+    bool isDynamic() const
+    {
+        return orbitSpeed != 0.0f;
+    }
+
+    void draw(Shader& shader, MeshPass pass = MESH_ALL)
+    {
+        // cout << "DEBUG::MODEL::C-MODEL-F-D: " << meshes->size() << endl;
+        shader.setMat4("um4m", transform);
+        bool lightmapped = lightmapEnable && lightmapBuffer != 0 && lightmapRects.size() == getInstanceCount();
+        shader.setBool("lightmapEnable", lightmapped);
+        if (lightmapped)
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHTMAP_RECTS_BINDING, lightmapBuffer);
+        GLint slot = 0;
+        for (GLuint i = 0; i < meshes->size(); i++)
+        {
+            GLint firstSlot = slot;
+            slot += (*meshes)[i].getInstanceCount();
+            if (!(*meshes)[i].isInPass(pass))
+                continue;
+            if (lightmapped)
+                shader.setInt("lightmapSlot", firstSlot);
+            drawCostProfiler.beginDraw((*meshes)[i]);
+            (*meshes)[i].draw(shader);
+            drawCostProfiler.endDraw();
+        }
+    }
+
+    void drawDepth(Shader& shader, MeshPass pass)
+    {
+        shader.setMat4("um4m", transform);
+        for (auto& it: *meshes)
+        {
+            if (it.isInPass(pass))
+                it.drawDepth();
+        }
+    }
+
+    vector<Mesh>& getMeshes()
+    {
+        return *meshes;
+    }
+
+    size_t getMeshCount()
     {
-        // cout << "DEBUG::MODEL::C-MODEL-F-D: " << meshes.size() << endl;
-        for (GLuint i = 0; i < meshes.size(); i++)
-            meshes[i].draw(shader);
+        return meshes->size();
+    }
+
+    // instances of all meshes, what is drawn without instancing
+    size_t getInstanceCount()
+    {
+        size_t count = 0;
+        for (auto& it: *meshes)
+            count += it.getInstanceCount();
+        return count;
+    }
+
+    const InstancingStats& getInstancingStats()
+    {
+        return instancingStats;
+    }
+
+    // after lightmapRects changed, every copy of a model has its own buffer
+    void uploadLightmapRects()
+    {
+        if (lightmapBuffer == 0)
+            glGenBuffers(1, &lightmapBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightmapBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, lightmapRects.size() * sizeof(vec4), lightmapRects.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        renderCounters.uploadBytes += lightmapRects.size() * sizeof(vec4);
+    }
+
+    // world space bounding box of every mesh
+    void getBounds(vec3& boundsMin, vec3& boundsMax)
+    {
+        for (auto& it: *meshes)
+        {
+            for (auto& instance: it.getInstanceTransforms())
+            {
+                for (int i = 0; i < 8; ++i)
+                {
+                    vec3 corner = vec3(i & 1 ? it.boundsMax.x : it.boundsMin.x, i & 2 ? it.boundsMax.y : it.boundsMin.y,
+                        i & 4 ? it.boundsMax.z : it.boundsMin.z);
+                    vec3 position = vec3(transform * instance * vec4(corner, 1.0f));
+                    boundsMin = min(boundsMin, position);
+                    boundsMax = max(boundsMax, position);
+                }
+            }
+        }
+    }
+
+    size_t getTriangleCount()
+    {
+        size_t count = 0;
+        for (auto& it: *meshes)
+            count += it.getTriangleCount();
+        return count;
     }
 private:
-    vector<Mesh> meshes;
+    shared_ptr<vector<Mesh>> meshes;
     string directory;
+    GLuint lightmapBuffer = 0;
+    InstancingStats instancingStats;
 
     void loadModel(const string path)
     {
@@ -52,31 +185,60 @@ private:
         }
         directory = path.substr(0, path.find_last_of('/'));
 
-        processNode(scene->mRootNode, scene);
+        vector<MeshData> imported;
+        processNode(scene->mRootNode, scene, mat4(1.0f), imported);
+
+        // repeated geometry is uploaded once and drawn instanced
+        GeometryInstancer instancer;
+        for (auto& group: instancer.group(imported, instancingStats))
+        {
+            MeshData& data = imported[group.members[0]];
+            Mesh result = Mesh(data.vertices, data.indices, data.textures, group.transforms);
+            result.name = data.name;
+            result.material = data.material;
+            meshes->push_back(result);
+        }
+        if (instancingStats.instancedMeshes > 0)
+            cout << "DEBUG::MODEL::INSTANCING: " << path << ": " << instancingStats.meshes << " meshes in " << instancingStats.uniqueMeshes
+                 << " draws, " << instancingStats.instancedMeshes << " instanced, " << instancingStats.savedBytes / 1024 << " KB saved" << endl;
     }
 
-    void processNode(aiNode* node, const aiScene* scene)
+    // node transforms are applied to the vertices, the instancing pass finds the copies again
+    void processNode(aiNode* node, const aiScene* scene, mat4 parentTransform, vector<MeshData>& imported)
     {
+        mat4 nodeTransform;
+        for (int row = 0; row < 4; ++row)
+        {
+            for (int column = 0; column < 4; ++column)
+                nodeTransform[column][row] = node->mTransformation[row][column];
+        }
+        nodeTransform = parentTransform * nodeTransform;
         for (GLuint i = 0; i < node->mNumMeshes; i++)
         {
-            meshes.push_back(processMesh(scene->mMeshes[node->mMeshes[i]], scene)); 
+            imported.push_back(processMesh(scene->mMeshes[node->mMeshes[i]], scene, nodeTransform));
         }
         for (GLuint i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, nodeTransform, imported);
         }
     }
 
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+    MeshData processMesh(aiMesh* mesh, const aiScene* scene, const mat4& nodeTransform)
     {
-        vector<Vertex> vertices  = processVertices(mesh);
-        vector<GLuint> indices   = processIndices(mesh);
-        vector<Texture> textures = processTextures(mesh, scene);
-        return Mesh(vertices, indices, textures);
+        MeshData result;
+        result.vertices = processVertices(mesh, nodeTransform);
+        result.indices  = processIndices(mesh);
+        result.textures = processTextures(mesh, scene);
+        result.name = mesh->mName.C_Str();
+        aiString materialName;
+        if (scene->mMaterials[mesh->mMaterialIndex]->Get(AI_MATKEY_NAME, materialName) == AI_SUCCESS)
+            result.material = materialName.C_Str();
+        return result;
     }
 
-    vector<Vertex> processVertices(aiMesh* mesh)
+    vector<Vertex> processVertices(aiMesh* mesh, const mat4& nodeTransform)
     {
+        mat3 normalMatrix = transpose(inverse(mat3(nodeTransform)));
         vector<Vertex> vertices;
         for (GLuint i = 0; i < mesh->mNumVertices; i++)
         {
@@ -97,6 +259,14 @@ private:
             {
                 vertex.texCoords = vec2(0.0f, 0.0f);
             }
+            vertex.lightmapCoords = vec2(0.0f, 0.0f);
+            if (nodeTransform != mat4(1.0f))
+            {
+                vertex.position = vec3(nodeTransform * vec4(vertex.position, 1.0f));
+                vertex.normal = normalMatrix * vertex.normal;
+                vertex.tangent = mat3(nodeTransform) * vertex.tangent;
+                vertex.bitangent = mat3(nodeTransform) * vertex.bitangent;
+            }
 
             vertices.push_back(vertex);
         }
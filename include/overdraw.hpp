@@ -0,0 +1,122 @@
+#ifndef OVERDRAW_HPP
+#define OVERDRAW_HPP
+
+#include "common.h"
+#include "shader.hpp"
+
+#define OVERDRAW_READBACK_LATENCY 3
+
+// Counts shaded fragments per pixel of the scene pass with an atomic image counter,
+// then reduces the counter image to sum / covered pixels / max with a compute shader.
+// The reduction result is read back a few frames later so the CPU does not stall.
+class OverdrawCounter
+{
+public:
+    GLuint texture;
+    Shader shader;
+
+    OverdrawCounter()
+        : shader("asset/vertex.vs.glsl", "asset/overdraw.fs.glsl"),
+          reduceShader("asset/overdrawReduce.cs.glsl")
+    {
+        createCounterObject();
+
+        glGenBuffers(OVERDRAW_READBACK_LATENCY, resultBuffers);
+        for (int i = 0; i < OVERDRAW_READBACK_LATENCY; ++i)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, resultBuffers[i]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(resultData), NULL, GL_DYNAMIC_READ);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // Clear the counters and bind them for the scene pass drawn with `shader`.
+    void begin()
+    {
+        GLuint zero[4] = {0};
+        glBindFramebuffer(GL_FRAMEBUFFER, clearFBO);
+        glClearBufferuiv(GL_COLOR, 0, zero);
+        glBindImageTexture(0, texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+    }
+
+    void end()
+    {
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+        GLuint resultBuffer = resultBuffers[frameIndex % OVERDRAW_READBACK_LATENCY];
+        GLuint readBuffer = resultBuffers[(frameIndex + 1) % OVERDRAW_READBACK_LATENCY];
+        if (frameIndex + 1 >= OVERDRAW_READBACK_LATENCY)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, readBuffer);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(resultData), resultData);
+        }
+
+        GLuint zero[3] = {0};
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, resultBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), zero);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, resultBuffer);
+
+        reduceShader.use();
+        glBindImageTexture(0, texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32UI);
+        glDispatchCompute((frameWidth + 15) / 16, (frameHeight + 15) / 16, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        frameIndex++;
+    }
+
+    void setFrameSize(int width, int height)
+    {
+        if (width == frameWidth && height == frameHeight)
+            return;
+        frameWidth = width;
+        frameHeight = height;
+        glDeleteFramebuffers(1, &clearFBO);
+        glDeleteTextures(1, &texture);
+        createCounterObject();
+    }
+
+    // average overdraw of the pixels covered by geometry
+    float getAverage()
+    {
+        return resultData[1] > 0 ? (float)resultData[0] / resultData[1] : 0.0f;
+    }
+
+    // average overdraw over the whole frame
+    float getScreenAverage()
+    {
+        return (float)resultData[0] / (frameWidth * frameHeight);
+    }
+
+    GLuint getMax()
+    {
+        return resultData[2];
+    }
+
+private:
+    Shader reduceShader;
+    GLuint clearFBO;
+    GLuint resultBuffers[OVERDRAW_READBACK_LATENCY];
+    GLuint resultData[3] = {0};
+    unsigned long frameIndex = 0;
+
+    int frameWidth = INIT_WIDTH;
+    int frameHeight = INIT_HEIGHT;
+
+    void createCounterObject()
+    {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32UI, frameWidth, frameHeight);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glGenFramebuffers(1, &clearFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, clearFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            cout << "ERROR::OVERDRAW::INIT: Framebuffer is not complete!" << endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+};
+
+#endif
@@ -0,0 +1,408 @@
+#ifndef POSTPROCESS_HPP
+#define POSTPROCESS_HPP
+
+#include "common.h"
+#include "shader.hpp"
+#include "rendertarget.hpp"
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+// resources provided from outside the graph
+#define POST_SCENE "scene"
+#define POST_FINAL "final"
+
+struct PostProcessOutput
+{
+    string name;
+    GLenum format;
+    int divisor; // the target is the frame size divided by this
+};
+
+// One full-screen pass. It either has its own fragment shader, or names a function of
+// filters.glsl (vec4 f(vec2 texcoord)) for which the graph generates the shader.
+// Point-wise passes only apply vec4 f(vec4 color) to their single input and are fused
+// into the pass producing that input when nothing else reads it.
+struct PostProcessPass
+{
+    string name;
+    vector<string> inputs;
+    vector<GLuint> inputUnits;
+    vector<PostProcessOutput> outputs;
+    Shader* shader = NULL;
+    string functionName;
+    vector<string> pointwise;
+    vector<function<void(Shader&)>> setup;
+    vec2 margin = vec2(0.0f); // how far from its own texcoord the pass reads its inputs, in UV
+    string depthMask;
+    float maskDepth = 0.0f;
+
+    PostProcessPass(const string name)
+        : name(name)
+    {
+    }
+
+    PostProcessPass& withInput(const string resource, GLuint unit)
+    {
+        inputs.push_back(resource);
+        inputUnits.push_back(unit);
+        return *this;
+    }
+
+    PostProcessPass& withOutput(const string resource, GLenum format, int divisor = 1)
+    {
+        outputs.push_back({resource, format, divisor});
+        return *this;
+    }
+
+    PostProcessPass& withShader(Shader* val)
+    {
+        shader = val;
+        return *this;
+    }
+
+    PostProcessPass& withFunction(const string val)
+    {
+        functionName = val;
+        return *this;
+    }
+
+    PostProcessPass& withPointwise(const string val)
+    {
+        pointwise.push_back(val);
+        return *this;
+    }
+
+    PostProcessPass& withSetup(function<void(Shader&)> val)
+    {
+        setup.push_back(val);
+        return *this;
+    }
+
+    PostProcessPass& withMargin(vec2 val)
+    {
+        margin = val;
+        return *this;
+    }
+
+    // Only shade the pixels whose value in the depth target resource is at most depth,
+    // the full screen quad is drawn at that depth and early depth testing drops the rest.
+    PostProcessPass& withDepthMask(const string resource, float depth)
+    {
+        depthMask = resource;
+        maskDepth = depth;
+        return *this;
+    }
+
+    bool isPointwise() const
+    {
+        return shader == NULL && functionName.empty() && !pointwise.empty();
+    }
+};
+
+class PostProcessGraph
+{
+public:
+    void clear()
+    {
+        passes.clear();
+        lastUse.clear();
+        externals.clear();
+        fusedPasses = 0;
+    }
+
+    void addPass(const PostProcessPass& pass)
+    {
+        passes.push_back(pass);
+    }
+
+    // A target owned outside the graph (e.g. history kept across frames), never pooled.
+    void setExternal(const string name, const RenderTarget& target)
+    {
+        externals[name] = target;
+    }
+
+    // Passes must be added in execution order.
+    void compile()
+    {
+        fuse();
+
+        lastUse.clear();
+        for (size_t i = 0; i < passes.size(); ++i)
+        {
+            for (auto& it: passes[i].outputs)
+                lastUse[it.name] = i;
+        }
+        for (size_t i = 0; i < passes.size(); ++i)
+        {
+            for (auto& it: passes[i].inputs)
+                lastUse[it] = std::max(lastUse[it], (int)i);
+            if (!passes[i].depthMask.empty())
+                lastUse[passes[i].depthMask] = std::max(lastUse[passes[i].depthMask], (int)i);
+        }
+    }
+
+    // Only region (x0, y0, x1, y1 in UV) of the final output is written. Every other pass
+    // is scissored to what its readers need, i.e. their regions grown by their margins.
+    // The scene and every intermediate target (of size targetSize) only use their
+    // bottom left uvScale part, the pass writing the final output (of size finalSize)
+    // scales back up.
+    void execute(RenderTargetPool& pool, GLuint sceneTexture, GLuint finalFBO, GLuint quadVAO, ivec2 targetSize,
+        ivec2 finalSize, vec4 region = vec4(0.0f, 0.0f, 1.0f, 1.0f), vec2 uvScale = vec2(1.0f))
+    {
+        int width = targetSize.x;
+        int height = targetSize.y;
+        vector<vec4> regions = getRegions(region, uvScale);
+        bool restricted = region != vec4(0.0f, 0.0f, 1.0f, 1.0f);
+        if (restricted)
+            glEnable(GL_SCISSOR_TEST);
+
+        map<string, RenderTarget> resources = externals;
+        glBindVertexArray(quadVAO);
+        for (size_t i = 0; i < passes.size(); ++i)
+        {
+            PostProcessPass& pass = passes[i];
+            if (regions[i].x >= regions[i].z || regions[i].y >= regions[i].w)
+            {
+                for (auto& it: pass.inputs)
+                    releaseIfDone(pool, resources, it, i);
+                releaseIfDone(pool, resources, pass.depthMask, i);
+                continue;
+            }
+            profiler.beginPass("Frame " + pass.name);
+
+            vector<RenderTarget> targets;
+            bool toFinal = false;
+            int targetWidth = width;
+            int targetHeight = height;
+            for (auto& it: pass.outputs)
+            {
+                if (it.name == POST_FINAL)
+                {
+                    toFinal = true;
+                    continue;
+                }
+                if (externals.count(it.name))
+                {
+                    targets.push_back(externals[it.name]);
+                    continue;
+                }
+                targetWidth = std::max(width / it.divisor, 1);
+                targetHeight = std::max(height / it.divisor, 1);
+                resources[it.name] = pool.acquire(targetWidth, targetHeight, it.format);
+                targets.push_back(resources[it.name]);
+            }
+            if (!pass.depthMask.empty())
+                targets.push_back(resources[pass.depthMask]);
+            glBindFramebuffer(GL_FRAMEBUFFER, toFinal ? finalFBO : pool.getFramebuffer(targets));
+            setDepthState(pass);
+            vec2 viewport = toFinal ? vec2(finalSize) : max(ceil(vec2(targetWidth, targetHeight) * uvScale), vec2(1.0f));
+            glViewport(0, 0, viewport.x, viewport.y);
+            if (restricted)
+            {
+                ivec2 start = ivec2(floor(vec2(regions[i]) * viewport));
+                ivec2 end = ivec2(ceil(vec2(regions[i].z, regions[i].w) * viewport));
+                glScissor(start.x, start.y, end.x - start.x, end.y - start.y);
+            }
+
+            Shader& shader = getShader(pass);
+            shader.use();
+            shader.setVec2("uvScale", uvScale.x, uvScale.y);
+            shader.setFloat("quadDepth", pass.depthMask.empty() ? 0.0f : pass.maskDepth * 2.0f - 1.0f);
+            for (auto& it: pass.setup)
+                it(shader);
+            for (size_t j = 0; j < pass.inputs.size(); ++j)
+            {
+                glActiveTexture(GL_TEXTURE0 + pass.inputUnits[j]);
+                glBindTexture(GL_TEXTURE_2D, pass.inputs[j] == POST_SCENE ? sceneTexture : resources[pass.inputs[j]].texture);
+            }
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+            renderCounters.drawCalls++;
+            renderCounters.stateChanges += pass.inputs.size() + 1;
+
+            // targets read for the last time (or never read) go back to the pool
+            for (auto& it: pass.inputs)
+                releaseIfDone(pool, resources, it, i);
+            for (auto& it: pass.outputs)
+                releaseIfDone(pool, resources, it.name, i);
+            releaseIfDone(pool, resources, pass.depthMask, i);
+            // back to the state the scene pass expects
+            glDisable(GL_DEPTH_TEST);
+            glDepthFunc(GL_LEQUAL);
+            glDepthMask(GL_TRUE);
+
+            profiler.endPass();
+        }
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+        if (restricted)
+            glDisable(GL_SCISSOR_TEST);
+    }
+
+    size_t getPassCount()
+    {
+        return passes.size();
+    }
+
+    int getFusedCount()
+    {
+        return fusedPasses;
+    }
+
+private:
+    vector<PostProcessPass> passes;
+    map<string, int> lastUse;
+    map<string, unique_ptr<Shader>> generatedShaders;
+    map<string, RenderTarget> externals;
+    int fusedPasses = 0;
+
+    int findProducer(const string resource)
+    {
+        for (size_t i = 0; i < passes.size(); ++i)
+        {
+            for (auto& it: passes[i].outputs)
+            {
+                if (it.name == resource)
+                    return i;
+            }
+        }
+        return -1;
+    }
+
+    int countConsumers(const string resource)
+    {
+        int count = 0;
+        for (auto& pass: passes)
+            count += std::count(pass.inputs.begin(), pass.inputs.end(), resource);
+        return count;
+    }
+
+    void fuse()
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (size_t i = 0; i < passes.size() && !changed; ++i)
+            {
+                PostProcessPass& pass = passes[i];
+                if (!pass.isPointwise() || pass.inputs.size() != 1)
+                    continue;
+                int producer = findProducer(pass.inputs[0]);
+                if (producer < 0)
+                    continue;
+                PostProcessPass& source = passes[producer];
+                if (source.shader != NULL || source.outputs.size() != 1 || countConsumers(pass.inputs[0]) != 1)
+                    continue;
+
+                source.name += "+" + pass.name;
+                source.pointwise.insert(source.pointwise.end(), pass.pointwise.begin(), pass.pointwise.end());
+                source.setup.insert(source.setup.end(), pass.setup.begin(), pass.setup.end());
+                source.outputs = pass.outputs;
+                source.margin = max(source.margin, pass.margin);
+                passes.erase(passes.begin() + i);
+                fusedPasses++;
+                changed = true;
+            }
+        }
+    }
+
+    Shader& getShader(const PostProcessPass& pass)
+    {
+        if (pass.shader != NULL)
+            return *pass.shader;
+
+        string source = generateSource(pass);
+        auto it = generatedShaders.find(source);
+        if (it == generatedShaders.end())
+        {
+            cout << "DEBUG::POSTPROCESS::SHADER: generating " << pass.name << endl;
+            string vertexSource = Shader::loadShaderSource("asset/frameVertex.vs.glsl");
+            it = generatedShaders.emplace(source, make_unique<Shader>(Shader::fromSource(vertexSource, source))).first;
+        }
+        return *it->second;
+    }
+
+    string generateSource(const PostProcessPass& pass)
+    {
+        string source = "#version 460\n\nin vec2 texCoords;\nout vec4 fragColor;\n\n#include \"filters.glsl\"\n\nvoid main()\n{\n";
+        if (pass.functionName.empty())
+            source += "    vec4 color = texture(texture0, texCoords);\n";
+        else
+            source += "    vec4 color = " + pass.functionName + "(texCoords);\n";
+        for (auto& it: pass.pointwise)
+            source += "    color = " + it + "(color);\n";
+        source += "    fragColor = color;\n}\n";
+        return source;
+    }
+
+    // Walks the passes backwards, a pass covers the union of what its readers read.
+    // Regions are relative to the used part of the targets, margins to the whole texture.
+    vector<vec4> getRegions(vec4 region, vec2 uvScale)
+    {
+        vector<vec4> regions(passes.size(), vec4(1.0f, 1.0f, 0.0f, 0.0f));
+        map<string, vec4> needed;
+        needed[POST_FINAL] = region;
+        for (int i = (int)passes.size() - 1; i >= 0; --i)
+        {
+            PostProcessPass& pass = passes[i];
+            for (auto& it: pass.outputs)
+            {
+                auto found = needed.find(it.name);
+                if (found == needed.end())
+                    continue;
+                regions[i] = vec4(min(vec2(regions[i]), vec2(found->second)),
+                    max(vec2(regions[i].z, regions[i].w), vec2(found->second.z, found->second.w)));
+            }
+            if (regions[i].x >= regions[i].z || regions[i].y >= regions[i].w)
+                continue;
+
+            vec2 margin = pass.margin / uvScale;
+            vec4 read = clamp(regions[i] + vec4(-margin, margin), 0.0f, 1.0f);
+            for (auto& it: pass.inputs)
+            {
+                auto found = needed.find(it);
+                if (found == needed.end())
+                    needed[it] = read;
+                else
+                    found->second = vec4(min(vec2(found->second), vec2(read)),
+                        max(vec2(found->second.z, found->second.w), vec2(read.z, read.w)));
+            }
+        }
+        return regions;
+    }
+
+    // passes writing depth write every pixel, masked passes test against the mask
+    void setDepthState(const PostProcessPass& pass)
+    {
+        bool writesDepth = false;
+        for (auto& it: pass.outputs)
+            writesDepth = writesDepth || isDepthFormat(it.format);
+        if (writesDepth)
+        {
+            glEnable(GL_DEPTH_TEST);
+            glDepthFunc(GL_ALWAYS);
+            glDepthMask(GL_TRUE);
+        }
+        else if (!pass.depthMask.empty())
+        {
+            glEnable(GL_DEPTH_TEST);
+            glDepthFunc(GL_GEQUAL);
+            glDepthMask(GL_FALSE);
+        }
+        else
+            glDisable(GL_DEPTH_TEST);
+    }
+
+    void releaseIfDone(RenderTargetPool& pool, map<string, RenderTarget>& resources, const string resource, int passIndex)
+    {
+        auto it = resources.find(resource);
+        if (it == resources.end() || lastUse[resource] != passIndex || externals.count(resource))
+            return;
+        pool.release(it->second);
+        resources.erase(it);
+    }
+};
+
+#endif
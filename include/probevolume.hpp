@@ -0,0 +1,414 @@
+#ifndef PROBEVOLUME_HPP
+#define PROBEVOLUME_HPP
+
+#include "common.h"
+#include "shader.hpp"
+#include "model.hpp"
+#include "bakescene.hpp"
+#include "workerpool.hpp"
+#include <atomic>
+#include <fstream>
+#include <numeric>
+
+// after the lightmap (8)
+#define PROBE_TEXTURE_UNIT 9
+// 9 RGB coefficients of L2 spherical harmonics in 7 RGBA texels
+#define PROBE_SH_COEFFICIENTS 27
+#define PROBE_SH_TEXELS 7
+
+struct ProbeStats
+{
+    ivec3 grid = ivec3(0);
+    size_t probes = 0;
+    // probes traced by the last bake, the others were kept
+    size_t baked = 0;
+    size_t invalid = 0;
+    size_t rays = 0;
+    double buildTime = 0.0;
+    double traceTime = 0.0;
+    double bakeTime = 0.0;
+    size_t gpuBytes = 0;
+    size_t cpuBytes = 0;
+
+    double getRaysPerSecond() const
+    {
+        return traceTime > 0.0 ? rays / traceTime : 0.0;
+    }
+};
+
+// Grid of irradiance probes over the static scene, for the objects the lightmap does
+// not cover. Every probe casts rays in all directions against the baked scene
+// (bakescene.hpp) on all cores and projects the radiance onto L2 spherical harmonics,
+// already convolved with the cosine lobe, so the shader gets the irradiance for a normal
+// from 9 coefficients. Probes which mostly see back faces are inside geometry and take
+// the mean of their neighbours. The coefficients are stored in one 3D texture, the 7
+// texels of a probe in 7 slabs along z, and sampled trilinearly.
+// Bakes are incremental: the bounds of every static object are kept with the result
+// (also in the cache file next to the scene), and only probes near an object which moved,
+// appeared or disappeared are traced again. Other changes of the settings bake all.
+class ProbeVolume
+{
+public:
+    bool enabled = false;
+    // probes along the longest side of the scene
+    int resolution = 24;
+    int samples = 256;
+    int bounces = 2;
+    vec3 skyColor = vec3(0.12f, 0.14f, 0.18f);
+    // in probe spacings around a changed object
+    float updateRadius = 2.0f;
+    ProbeStats stats;
+
+    void bake(vector<Model>& models, vec3 sunDirection, vec3 sunColor, const string cachePath, bool incremental = true)
+    {
+        double startTime = glfwGetTime();
+        vector<ModelRecord> newRecords = getRecords(models);
+        vec3 boundsMin = vec3(1e30f), boundsMax = vec3(-1e30f);
+        for (auto& it: newRecords)
+        {
+            if (it.triangles == 0)
+                continue;
+            boundsMin = min(boundsMin, it.boundsMin);
+            boundsMax = max(boundsMax, it.boundsMax);
+        }
+        if (boundsMin.x > boundsMax.x)
+        {
+            cout << "ERROR::PROBES::BAKE: No static objects" << endl;
+            return;
+        }
+        float extent = std::max(std::max(boundsMax.x - boundsMin.x, boundsMax.y - boundsMin.y), boundsMax.z - boundsMin.z);
+        spacing = extent / std::max(resolution - 1, 1);
+        origin = boundsMin;
+        grid = ivec3((boundsMax - boundsMin) / spacing + 0.999f) + 1;
+        size_t probeCount = (size_t)grid.x * grid.y * grid.z;
+        vector<float> newKey = {(float)grid.x, (float)grid.y, (float)grid.z, origin.x, origin.y, origin.z, spacing, (float)samples,
+            (float)bounces, sunDirection.x, sunDirection.y, sunDirection.z, sunColor.x, sunColor.y, sunColor.z,
+            skyColor.x, skyColor.y, skyColor.z};
+
+        if (key.empty())
+            loadCache(cachePath);
+        vector<size_t> dirty;
+        if (incremental && key == newKey && coefficients.size() == probeCount * PROBE_SH_COEFFICIENTS)
+            dirty = findChangedProbes(newRecords);
+        else
+        {
+            coefficients.assign(probeCount * PROBE_SH_COEFFICIENTS, 0.0f);
+            probeValid.assign(probeCount, 0);
+            dirty.resize(probeCount);
+            iota(dirty.begin(), dirty.end(), 0);
+        }
+        key = newKey;
+        records = newRecords;
+
+        stats = ProbeStats();
+        stats.grid = grid;
+        stats.probes = probeCount;
+        stats.baked = dirty.size();
+        if (!dirty.empty())
+        {
+            scene.build(models, sunDirection, sunColor, skyColor);
+            stats.buildTime = scene.buildTime;
+            trace(dirty);
+            fillInvalid();
+            saveCache(cachePath);
+        }
+        for (auto& it: probeValid)
+            stats.invalid += !it;
+        upload();
+
+        stats.cpuBytes = coefficients.size() * sizeof(float) + probeValid.size();
+        stats.bakeTime = glfwGetTime() - startTime;
+        cout << "DEBUG::PROBES::BAKE: " << grid.x << " x " << grid.y << " x " << grid.z << " probes, " << stats.baked << " baked, "
+             << stats.invalid << " inside geometry" << endl;
+        cout << "DEBUG::PROBES::BAKE: " << stats.bakeTime << " s (BVH " << stats.buildTime << " s, trace " << stats.traceTime << " s), "
+             << stats.getRaysPerSecond() / 1e6 << " Mrays/s, " << stats.gpuBytes / 1024 << " KB texture, " << stats.cpuBytes / 1024
+             << " KB on the CPU" << endl;
+        version++;
+    }
+
+    // positions in the scene shaders are in eye space
+    void setupShader(Shader& shader, const mat4& view)
+    {
+        bool probeEnable = enabled && texture != 0;
+        shader.setBool("probeEnable", probeEnable);
+        if (!probeEnable)
+            return;
+        shader.setMat4("probeInverseView", inverse(view));
+        shader.setVec3("probeOrigin", origin.x, origin.y, origin.z);
+        shader.setVec3("probeGrid", grid.x, grid.y, grid.z);
+        shader.setFloat("probeSpacing", spacing);
+        glActiveTexture(GL_TEXTURE0 + PROBE_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_3D, texture);
+        glActiveTexture(GL_TEXTURE0);
+        renderCounters.stateChanges++;
+    }
+
+    bool isBaked()
+    {
+        return texture != 0;
+    }
+
+    // changes with every bake, the scene has to be drawn again
+    int getVersion()
+    {
+        return version;
+    }
+
+private:
+    // world bounds of one object, no triangles for dynamic ones
+    struct ModelRecord
+    {
+        vec3 boundsMin;
+        vec3 boundsMax;
+        size_t triangles;
+
+        bool operator==(const ModelRecord& other) const = default;
+    };
+
+    BakeScene scene;
+    GLuint texture = 0;
+    int version = 0;
+    ivec3 grid = ivec3(0);
+    vec3 origin = vec3(0.0f);
+    float spacing = 1.0f;
+    vector<float> key;
+    vector<ModelRecord> records;
+    vector<float> coefficients;
+    vector<char> probeValid;
+
+    vector<ModelRecord> getRecords(vector<Model>& models)
+    {
+        vector<ModelRecord> result;
+        for (auto& it: models)
+        {
+            ModelRecord record = {vec3(1e30f), vec3(-1e30f), 0};
+            if (!it.isDynamic())
+            {
+                it.getBounds(record.boundsMin, record.boundsMax);
+                record.triangles = it.getTriangleCount();
+            }
+            result.push_back(record);
+        }
+        return result;
+    }
+
+    vec3 getPosition(size_t index)
+    {
+        ivec3 cell = ivec3(index % grid.x, index / grid.x % grid.y, index / grid.x / grid.y);
+        return origin + vec3(cell) * spacing;
+    }
+
+    // probes near the old and the new bounds of every object which changed
+    vector<size_t> findChangedProbes(const vector<ModelRecord>& newRecords)
+    {
+        vector<pair<vec3, vec3>> boxes;
+        for (size_t i = 0; i < std::max(records.size(), newRecords.size()); ++i)
+        {
+            bool hasOld = i < records.size() && records[i].triangles > 0;
+            bool hasNew = i < newRecords.size() && newRecords[i].triangles > 0;
+            if (hasOld && hasNew && records[i] == newRecords[i])
+                continue;
+            if (hasOld)
+                boxes.push_back({records[i].boundsMin, records[i].boundsMax});
+            if (hasNew)
+                boxes.push_back({newRecords[i].boundsMin, newRecords[i].boundsMax});
+        }
+        vector<size_t> dirty;
+        float margin = updateRadius * spacing;
+        for (size_t i = 0; i < probeValid.size(); ++i)
+        {
+            vec3 position = getPosition(i);
+            for (auto& it: boxes)
+            {
+                if (all(greaterThanEqual(position, it.first - margin)) && all(lessThanEqual(position, it.second + margin)))
+                {
+                    dirty.push_back(i);
+                    break;
+                }
+            }
+        }
+        return dirty;
+    }
+
+    // real L2 spherical harmonics basis
+    static void evaluateBasis(vec3 n, float basis[9])
+    {
+        basis[0] = 0.282095f;
+        basis[1] = 0.488603f * n.y;
+        basis[2] = 0.488603f * n.z;
+        basis[3] = 0.488603f * n.x;
+        basis[4] = 1.092548f * n.x * n.y;
+        basis[5] = 1.092548f * n.y * n.z;
+        basis[6] = 0.315392f * (3.0f * n.z * n.z - 1.0f);
+        basis[7] = 1.092548f * n.x * n.z;
+        basis[8] = 0.546274f * (n.x * n.x - n.y * n.y);
+    }
+
+    void trace(const vector<size_t>& dirty)
+    {
+        double startTime = glfwGetTime();
+        WorkerPool workers;
+        vector<size_t> rays(workers.getThreadCount(), 0);
+        atomic<size_t> next(0);
+        cout << "DEBUG::PROBES::TRACE: " << dirty.size() << " probes, " << samples << " rays, " << bounces << " bounces on "
+             << workers.getThreadCount() << " threads" << endl;
+
+        workers.run([&](int part, int) {
+            for (size_t i = next++; i < dirty.size(); i = next++)
+            {
+                size_t probe = dirty[i];
+                BakeScene::Random random = {(uint32_t)probe * 7919u + 3u};
+                float sh[PROBE_SH_COEFFICIENTS] = {};
+                float basis[9];
+                int backfaces = 0;
+                for (int j = 0; j < samples; ++j)
+                {
+                    Ray ray;
+                    ray.origin = getPosition(probe);
+                    ray.direction = BakeScene::sampleSphere(random);
+                    bool backface;
+                    vec3 radiance = scene.traceRadiance(ray, bounces, random, rays[part], backface);
+                    backfaces += backface;
+                    evaluateBasis(ray.direction, basis);
+                    for (int k = 0; k < 9; ++k)
+                    {
+                        for (int c = 0; c < 3; ++c)
+                            sh[k * 3 + c] += radiance[c] * basis[k];
+                    }
+                }
+                // Monte Carlo weight of a uniform sphere sample, then the cosine lobe
+                // divided by pi like the ambient term: 1, 2/3 and 1/4 per band
+                const float band[9] = {1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f};
+                float weight = 4.0f * M_PI / samples;
+                for (int k = 0; k < PROBE_SH_COEFFICIENTS; ++k)
+                    coefficients[probe * PROBE_SH_COEFFICIENTS + k] = sh[k] * weight * band[k / 3];
+                probeValid[probe] = backfaces * 4 < samples;
+            }
+        });
+
+        for (auto& it: rays)
+            stats.rays += it;
+        stats.traceTime = glfwGetTime() - startTime;
+    }
+
+    // probes inside geometry take the mean of their valid neighbours, repeatedly
+    void fillInvalid()
+    {
+        vector<char> filled = probeValid;
+        for (bool changed = true; changed;)
+        {
+            changed = false;
+            vector<char> nextFilled = filled;
+            for (size_t i = 0; i < filled.size(); ++i)
+            {
+                if (filled[i])
+                    continue;
+                ivec3 cell = ivec3(i % grid.x, i / grid.x % grid.y, i / grid.x / grid.y);
+                float sum[PROBE_SH_COEFFICIENTS] = {};
+                int count = 0;
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    for (int side = -1; side <= 1; side += 2)
+                    {
+                        ivec3 neighbour = cell;
+                        neighbour[axis] += side;
+                        if (neighbour[axis] < 0 || neighbour[axis] >= grid[axis])
+                            continue;
+                        size_t index = ((size_t)neighbour.z * grid.y + neighbour.y) * grid.x + neighbour.x;
+                        if (!filled[index])
+                            continue;
+                        for (int k = 0; k < PROBE_SH_COEFFICIENTS; ++k)
+                            sum[k] += coefficients[index * PROBE_SH_COEFFICIENTS + k];
+                        count++;
+                    }
+                }
+                if (count == 0)
+                    continue;
+                for (int k = 0; k < PROBE_SH_COEFFICIENTS; ++k)
+                    coefficients[i * PROBE_SH_COEFFICIENTS + k] = sum[k] / count;
+                nextFilled[i] = 1;
+                changed = true;
+            }
+            filled = nextFilled;
+        }
+    }
+
+    void upload()
+    {
+        if (texture != 0)
+            glDeleteTextures(1, &texture);
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_3D, texture);
+        glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA16F, grid.x, grid.y, grid.z * PROBE_SH_TEXELS);
+        // slab k holds the coefficients 4k to 4k + 3 of every probe
+        size_t probeCount = probeValid.size();
+        vector<vec4> texels(probeCount * PROBE_SH_TEXELS, vec4(0.0f));
+        for (size_t i = 0; i < probeCount; ++i)
+        {
+            for (int k = 0; k < PROBE_SH_COEFFICIENTS; ++k)
+                texels[(k / 4) * probeCount + i][k % 4] = coefficients[i * PROBE_SH_COEFFICIENTS + k];
+        }
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, grid.x, grid.y, grid.z * PROBE_SH_TEXELS, GL_RGBA, GL_FLOAT, texels.data());
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        stats.gpuBytes = texels.size() * 4 * sizeof(GLushort);
+        renderCounters.uploadBytes += texels.size() * sizeof(vec4);
+    }
+
+    template <typename T>
+    static void writeVector(ofstream& file, const vector<T>& data)
+    {
+        size_t size = data.size();
+        file.write((const char*)&size, sizeof(size));
+        file.write((const char*)data.data(), size * sizeof(T));
+    }
+
+    template <typename T>
+    static bool readVector(ifstream& file, vector<T>& data)
+    {
+        size_t size = 0;
+        file.read((char*)&size, sizeof(size));
+        if (!file || size > (1u << 28))
+            return false;
+        data.resize(size);
+        file.read((char*)data.data(), size * sizeof(T));
+        return (bool)file;
+    }
+
+    void loadCache(const string path)
+    {
+        ifstream file(path, ios::binary);
+        if (!file.is_open())
+            return;
+        if (readVector(file, key) && readVector(file, records) && readVector(file, coefficients) && readVector(file, probeValid)
+            && coefficients.size() == probeValid.size() * PROBE_SH_COEFFICIENTS)
+        {
+            cout << "DEBUG::PROBES::LOAD: " << path << endl;
+            return;
+        }
+        cout << "ERROR::PROBES::LOAD: " << path << " is damaged" << endl;
+        key.clear();
+        records.clear();
+        coefficients.clear();
+        probeValid.clear();
+    }
+
+    void saveCache(const string path)
+    {
+        ofstream file(path, ios::binary);
+        if (!file.is_open())
+        {
+            cout << "ERROR::PROBES::SAVE: Failed to write " << path << endl;
+            return;
+        }
+        writeVector(file, key);
+        writeVector(file, records);
+        writeVector(file, coefficients);
+        writeVector(file, probeValid);
+    }
+};
+
+#endif
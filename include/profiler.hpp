@@ -0,0 +1,337 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include "common.h"
+#include "glextension.hpp"
+#include <deque>
+#include <map>
+#include <vector>
+
+// CPU side submission counters, incremented wherever the renderer talks to GL
+struct RenderCounters
+{
+    unsigned long drawCalls = 0;
+    unsigned long stateChanges = 0;
+    unsigned long uniformUploads = 0;
+    unsigned long uploadBytes = 0;
+
+    RenderCounters operator-(const RenderCounters& other) const
+    {
+        RenderCounters result;
+        result.drawCalls = drawCalls - other.drawCalls;
+        result.stateChanges = stateChanges - other.stateChanges;
+        result.uniformUploads = uniformUploads - other.uniformUploads;
+        result.uploadBytes = uploadBytes - other.uploadBytes;
+        return result;
+    }
+};
+
+RenderCounters renderCounters;
+
+enum PipelineStatistic
+{
+    STAT_VERTICES_SUBMITTED,
+    STAT_PRIMITIVES_SUBMITTED,
+    STAT_VERTEX_INVOCATIONS,
+    STAT_CLIPPING_INPUT,
+    STAT_CLIPPING_OUTPUT,
+    STAT_FRAGMENT_INVOCATIONS,
+    STAT_COMPUTE_INVOCATIONS,
+    STAT_COUNT
+};
+
+const GLenum pipelineStatisticTargets[] = {
+    GL_VERTICES_SUBMITTED,
+    GL_PRIMITIVES_SUBMITTED,
+    GL_VERTEX_SHADER_INVOCATIONS,
+    GL_CLIPPING_INPUT_PRIMITIVES,
+    GL_CLIPPING_OUTPUT_PRIMITIVES,
+    GL_FRAGMENT_SHADER_INVOCATIONS,
+    GL_COMPUTE_SHADER_INVOCATIONS
+};
+
+const char* pipelineStatisticNames[] = {
+    "Vertices submitted",
+    "Primitives submitted",
+    "Vertex invocations",
+    "Clipping input",
+    "Clipping output",
+    "Fragment invocations",
+    "Compute invocations"
+};
+
+struct PassStatistics
+{
+    float gpuTime = 0.0f;
+    float cpuTime = 0.0f;
+    double pipeline[STAT_COUNT] = {0};
+    double drawCalls = 0;
+    double stateChanges = 0;
+    double uniformUploads = 0;
+    double uploadBytes = 0;
+
+    void accumulate(const PassStatistics& other, float weight)
+    {
+        gpuTime += (other.gpuTime - gpuTime) * weight;
+        cpuTime += (other.cpuTime - cpuTime) * weight;
+        for (int i = 0; i < STAT_COUNT; ++i)
+            pipeline[i] += (other.pipeline[i] - pipeline[i]) * weight;
+        drawCalls += (other.drawCalls - drawCalls) * weight;
+        stateChanges += (other.stateChanges - stateChanges) * weight;
+        uniformUploads += (other.uniformUploads - uniformUploads) * weight;
+        uploadBytes += (other.uploadBytes - uploadBytes) * weight;
+    }
+
+    void add(const PassStatistics& other, float weight)
+    {
+        gpuTime += other.gpuTime * weight;
+        cpuTime += other.cpuTime * weight;
+        for (int i = 0; i < STAT_COUNT; ++i)
+            pipeline[i] += other.pipeline[i] * weight;
+        drawCalls += other.drawCalls * weight;
+        stateChanges += other.stateChanges * weight;
+        uniformUploads += other.uniformUploads * weight;
+        uploadBytes += other.uploadBytes * weight;
+    }
+};
+
+// Results are read back PROFILER_LATENCY frames after they were issued so the
+// CPU never waits for the GPU.
+#define PROFILER_LATENCY 3
+#define PROFILER_EVENTS 16
+
+// Named passes measured with timestamp queries, so passes may nest (e.g. one
+// entry per bloom level inside the frame pass). Pipeline statistics queries
+// cannot nest and are only issued for outermost passes.
+class Profiler
+{
+public:
+    bool enabled = true;
+
+    void beginPass(const string name)
+    {
+        if (!enabled)
+            return;
+        if (!initialized)
+            initialize();
+
+        Pass& pass = getPass(name);
+        QuerySet& set = pass.sets[frameIndex % PROFILER_LATENCY];
+        collect(pass, set);
+
+        set.pipelineEnabled = statisticsSupported && activePasses.empty();
+        glQueryCounter(set.start, GL_TIMESTAMP);
+        if (set.pipelineEnabled)
+        {
+            for (int i = 0; i < STAT_COUNT; ++i)
+                glBeginQuery(pipelineStatisticTargets[i], set.pipeline[i]);
+        }
+        set.cpuStart = glfwGetTime();
+        set.countersStart = renderCounters;
+        activePasses.push_back(name);
+    }
+
+    // closes what beginPass opened even when the profiler was disabled in between,
+    // e.g. from the menu inside the "Menu" pass
+    void endPass()
+    {
+        if (activePasses.empty())
+            return;
+
+        Pass& pass = getPass(activePasses.back());
+        QuerySet& set = pass.sets[frameIndex % PROFILER_LATENCY];
+        activePasses.pop_back();
+
+        if (set.pipelineEnabled)
+        {
+            for (int i = 0; i < STAT_COUNT; ++i)
+                glEndQuery(pipelineStatisticTargets[i]);
+        }
+        glQueryCounter(set.end, GL_TIMESTAMP);
+        set.cpuTime = (glfwGetTime() - set.cpuStart) * 1000.0f;
+        set.counters = renderCounters - set.countersStart;
+        set.pending = true;
+    }
+
+    void endFrame()
+    {
+        frameIndex++;
+    }
+
+    // Decisions taken from the measurements (e.g. the render scale), kept for display.
+    void logEvent(const string text)
+    {
+        string event = "frame " + to_string(frameIndex) + ": " + text;
+        cout << "DEBUG::PROFILER::EVENT: " << event << endl;
+        events.push_back(event);
+        if (events.size() > PROFILER_EVENTS)
+            events.pop_front();
+    }
+
+    const deque<string>& getEvents()
+    {
+        return events;
+    }
+
+    // Drop the accumulated totals, e.g. after the benchmark warmup.
+    void reset()
+    {
+        for (auto& it: passes)
+        {
+            it.second.total = PassStatistics();
+            it.second.samples = 0;
+        }
+    }
+
+    const vector<string>& getPassNames()
+    {
+        return passOrder;
+    }
+
+    // exponential moving average, for live display
+    const PassStatistics& getSmoothed(const string name)
+    {
+        return getPass(name).smoothed;
+    }
+
+    // mean since the last reset, for benchmark output
+    PassStatistics getAverage(const string name)
+    {
+        Pass& pass = getPass(name);
+        PassStatistics average;
+        if (pass.samples > 0)
+            average.add(pass.total, 1.0f / pass.samples);
+        return average;
+    }
+
+    bool isStatisticsSupported()
+    {
+        return statisticsSupported;
+    }
+
+    // Rough classification of what limits a pass, from its CPU/GPU time and shader invocations.
+    string getBoundHint(const PassStatistics& stats)
+    {
+        if (stats.cpuTime > stats.gpuTime)
+            return "submit-bound";
+        if (!statisticsSupported)
+            return "unknown";
+        if (stats.pipeline[STAT_FRAGMENT_INVOCATIONS] > 4.0 * stats.pipeline[STAT_VERTEX_INVOCATIONS])
+            return "fragment-bound";
+        return "vertex-bound";
+    }
+
+    void report()
+    {
+        for (auto& name: passOrder)
+        {
+            PassStatistics stats = getAverage(name);
+            cout << "BENCHMARK::PASS::" << name << ": gpu: " << stats.gpuTime << " ms cpu: " << stats.cpuTime
+                 << " ms draws: " << stats.drawCalls << " state changes: " << stats.stateChanges
+                 << " uniforms: " << stats.uniformUploads << " upload bytes: " << stats.uploadBytes
+                 << " (" << getBoundHint(stats) << ")" << endl;
+            if (!statisticsSupported)
+                continue;
+            cout << "BENCHMARK::PASS::" << name << ":";
+            for (int i = 0; i < STAT_COUNT; ++i)
+                cout << " " << pipelineStatisticNames[i] << ": " << (unsigned long)stats.pipeline[i];
+            cout << endl;
+        }
+    }
+
+private:
+    struct QuerySet
+    {
+        GLuint start;
+        GLuint end;
+        GLuint pipeline[STAT_COUNT];
+        bool pipelineEnabled = false;
+        bool pending = false;
+        double cpuStart = 0.0;
+        float cpuTime = 0.0f;
+        RenderCounters countersStart;
+        RenderCounters counters;
+    };
+
+    struct Pass
+    {
+        QuerySet sets[PROFILER_LATENCY];
+        PassStatistics smoothed;
+        PassStatistics total;
+        int samples = 0;
+    };
+
+    map<string, Pass> passes;
+    vector<string> passOrder;
+    vector<string> activePasses;
+    deque<string> events;
+    unsigned long frameIndex = 0;
+    bool initialized = false;
+    bool statisticsSupported = false;
+
+    void initialize()
+    {
+        statisticsSupported = hasPipelineStatistics();
+        cout << "DEBUG::PROFILER::INIT: pipeline statistics " << (statisticsSupported ? "supported" : "not supported") << endl;
+        initialized = true;
+    }
+
+    Pass& getPass(const string name)
+    {
+        auto it = passes.find(name);
+        if (it != passes.end())
+            return it->second;
+
+        Pass& pass = passes[name];
+        for (auto& set: pass.sets)
+        {
+            glGenQueries(1, &set.start);
+            glGenQueries(1, &set.end);
+            glGenQueries(STAT_COUNT, set.pipeline);
+        }
+        passOrder.push_back(name);
+        return pass;
+    }
+
+    // Read back the results issued PROFILER_LATENCY frames ago, a sample is dropped
+    // rather than stalling when the GPU is still behind.
+    void collect(Pass& pass, QuerySet& set)
+    {
+        if (!set.pending)
+            return;
+        set.pending = false;
+
+        GLint available = 0;
+        glGetQueryObjectiv(set.end, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+
+        PassStatistics stats;
+        GLuint64 start, end;
+        glGetQueryObjectui64v(set.start, GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(set.end, GL_QUERY_RESULT, &end);
+        stats.gpuTime = (end - start) / 1000000.0f;
+        stats.cpuTime = set.cpuTime;
+        if (set.pipelineEnabled)
+        {
+            for (int i = 0; i < STAT_COUNT; ++i)
+            {
+                GLuint64 value = 0;
+                glGetQueryObjectui64v(set.pipeline[i], GL_QUERY_RESULT, &value);
+                stats.pipeline[i] = value;
+            }
+        }
+        stats.drawCalls = set.counters.drawCalls;
+        stats.stateChanges = set.counters.stateChanges;
+        stats.uniformUploads = set.counters.uniformUploads;
+        stats.uploadBytes = set.counters.uploadBytes;
+
+        pass.smoothed.accumulate(stats, pass.samples == 0 ? 1.0f : 0.1f);
+        pass.total.add(stats, 1.0f);
+        pass.samples++;
+    }
+};
+
+Profiler profiler;
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef REDRAW_HPP
+#define REDRAW_HPP
+
+#include "common.h"
+
+// Everything the image in the scene FBO depends on.
+struct SceneState
+{
+    mat4 view = mat4(0.0f);
+    mat4 projection = mat4(0.0f);
+    int outputMode = 0;
+    bool depthPrepass = false;
+    bool deferred = false;
+    // 0 without lighting
+    int lights = 0;
+    float ambient = 0.0f;
+    bool shadows = false;
+    float sunAzimuth = 0.0f;
+    float sunElevation = 0.0f;
+    // bake of the lightmap in use, 0 without
+    int lightmap = 0;
+    int probes = 0;
+    bool ssao = false;
+    float ssaoRadius = 0.0f;
+    float ssaoIntensity = 0.0f;
+    // of the dynamic objects
+    float animationTime = 0.0f;
+    int width = 0;
+    int height = 0;
+    size_t models = 0;
+
+    bool operator==(const SceneState& other) const = default;
+};
+
+// Decides every loop iteration what has to be rendered again:
+// the scene only when its state changed, the frame filter when the scene or a filter
+// parameter changed, and nothing at all (the loop then sleeps in glfwWaitEventsTimeout)
+// when there was no input either.
+class RedrawTracker
+{
+public:
+    bool enabled = true;
+    // ImGui needs a few frames after input to settle hover and click states
+    int settleFrames = 3;
+    double idleTimeout = 0.5;
+
+    // called from the input callbacks
+    void markInput()
+    {
+        inputFrames = settleFrames;
+    }
+
+    // the scene FBO was recreated or overwritten
+    void invalidate()
+    {
+        lastScene = SceneState();
+    }
+
+    bool isSceneChanged(const SceneState& state)
+    {
+        if (enabled && state == lastScene)
+            return false;
+        lastScene = state;
+        return true;
+    }
+
+    // input since the last call, or still settling from earlier input
+    bool hasInput(GLFWwindow* window)
+    {
+        double x, y;
+        glfwGetCursorPos(window, &x, &y);
+        if (x != cursorX || y != cursorY)
+            markInput();
+        cursorX = x;
+        cursorY = y;
+
+        if (!enabled || inputFrames > 0)
+        {
+            inputFrames = std::max(inputFrames - 1, 0);
+            return true;
+        }
+        return false;
+    }
+
+    void waitEvents(bool idle)
+    {
+        if (idle && enabled)
+        {
+            glfwWaitEventsTimeout(idleTimeout);
+            skippedFrames++;
+        }
+        else
+            glfwPollEvents();
+    }
+
+    unsigned long getSkippedFrames()
+    {
+        return skippedFrames;
+    }
+
+private:
+    SceneState lastScene;
+    int inputFrames = 0;
+    double cursorX = -1.0;
+    double cursorY = -1.0;
+    unsigned long skippedFrames = 0;
+};
+
+#endif
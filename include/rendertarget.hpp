@@ -0,0 +1,266 @@
+#ifndef RENDERTARGET_HPP
+#define RENDERTARGET_HPP
+
+#include "common.h"
+#include <deque>
+#include <map>
+#include <vector>
+
+bool isDepthFormat(GLenum format)
+{
+    return format == GL_DEPTH_COMPONENT32F || format == GL_DEPTH_COMPONENT24 || format == GL_DEPTH24_STENCIL8;
+}
+
+struct RenderTarget
+{
+    GLuint texture = 0;
+    int width = 0;
+    int height = 0;
+    GLenum format = GL_RGBA8;
+};
+
+// bytes per pixel, padded the way drivers store them
+size_t getFormatSize(GLenum format)
+{
+    switch (format)
+    {
+        case GL_R8:
+        case GL_R8UI:
+            return 1;
+        case GL_RG8:
+            return 2;
+        case GL_RG16F:
+        case GL_R32F:
+            return 4;
+        case GL_RGBA16F:
+        case GL_RG32F:
+            return 8;
+        case GL_RGBA32F:
+            return 16;
+        default:
+            return 4;
+    }
+}
+
+// Owns the memory of every render target. Replaced textures and framebuffers are not
+// deleted right away but after a fence shows the frames that may still use them have
+// finished on the GPU. While the window is being resized, smaller frames reuse the
+// current allocation (their bottom left part) and larger ones get some slack, the
+// exact size is only allocated once no resize came in for resizeDebounce seconds.
+class RenderTargetManager
+{
+public:
+    double resizeDebounce = 0.15;
+    float growSlack = 1.25f;
+
+    RenderTarget createTexture(int width, int height, GLenum format)
+    {
+        RenderTarget target;
+        target.width = width;
+        target.height = height;
+        target.format = format;
+        glGenTextures(1, &target.texture);
+        glBindTexture(GL_TEXTURE_2D, target.texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        memory += getTargetSize(target);
+        return target;
+    }
+
+    GLuint createFramebuffer()
+    {
+        GLuint FBO;
+        glGenFramebuffers(1, &FBO);
+        return FBO;
+    }
+
+    void destroy(const RenderTarget& target)
+    {
+        pending.targets.push_back(target);
+    }
+
+    void destroyFramebuffer(GLuint FBO)
+    {
+        pending.framebuffers.push_back(FBO);
+    }
+
+    // After the commands of a frame were submitted: fence what was destroyed during it
+    // and delete what earlier fences have retired.
+    void endFrame()
+    {
+        if (!pending.targets.empty() || !pending.framebuffers.empty())
+        {
+            pending.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            retired.push_back(pending);
+            pending = RetiredObjects();
+        }
+        while (!retired.empty())
+        {
+            GLenum status = glClientWaitSync(retired.front().fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                break;
+            deleteObjects(retired.front());
+            retired.pop_front();
+        }
+    }
+
+    void markResize()
+    {
+        lastResize = glfwGetTime();
+    }
+
+    bool isResizeSettled()
+    {
+        return glfwGetTime() - lastResize > resizeDebounce;
+    }
+
+    // the size to allocate for frames of size requested, when current is allocated
+    ivec2 getAllocation(ivec2 current, ivec2 requested)
+    {
+        if (isResizeSettled())
+            return requested;
+        if (requested.x <= current.x && requested.y <= current.y)
+            return current;
+        return max(current, ivec2(ceil(vec2(requested) * growSlack)));
+    }
+
+    // live targets, including those waiting for their fence
+    size_t getMemory()
+    {
+        return memory;
+    }
+
+    size_t getRetiringMemory()
+    {
+        size_t size = 0;
+        for (auto& it: retired)
+            for (auto& target: it.targets)
+                size += getTargetSize(target);
+        for (auto& it: pending.targets)
+            size += getTargetSize(it);
+        return size;
+    }
+
+private:
+    struct RetiredObjects
+    {
+        GLsync fence = 0;
+        vector<RenderTarget> targets;
+        vector<GLuint> framebuffers;
+    };
+
+    RetiredObjects pending;
+    deque<RetiredObjects> retired;
+    size_t memory = 0;
+    double lastResize = -1.0;
+
+    size_t getTargetSize(const RenderTarget& target)
+    {
+        return (size_t)target.width * target.height * getFormatSize(target.format);
+    }
+
+    void deleteObjects(RetiredObjects& objects)
+    {
+        for (auto& it: objects.framebuffers)
+            glDeleteFramebuffers(1, &it);
+        for (auto& it: objects.targets)
+        {
+            glDeleteTextures(1, &it.texture);
+            memory -= getTargetSize(it);
+        }
+        glDeleteSync(objects.fence);
+    }
+};
+
+RenderTargetManager targetManager;
+
+// Transient textures keyed by size and format. A released target is handed to the
+// next pass asking for the same key, so passes whose lifetimes do not overlap share
+// memory. Framebuffers are cached per attachment list.
+class RenderTargetPool
+{
+public:
+    RenderTarget acquire(int width, int height, GLenum format)
+    {
+        for (size_t i = 0; i < freeTargets.size(); ++i)
+        {
+            RenderTarget target = freeTargets[i];
+            if (target.width == width && target.height == height && target.format == format)
+            {
+                freeTargets.erase(freeTargets.begin() + i);
+                return target;
+            }
+        }
+
+        // passes only write their region, a tap past the edge must not wrap into the
+        // unwritten texels of the other side
+        RenderTarget target = targetManager.createTexture(width, height, format);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        allTargets.push_back(target);
+        return target;
+    }
+
+    void release(const RenderTarget& target)
+    {
+        freeTargets.push_back(target);
+    }
+
+    GLuint getFramebuffer(const vector<RenderTarget>& targets)
+    {
+        vector<GLuint> key;
+        for (auto& it: targets)
+            key.push_back(it.texture);
+        auto found = framebuffers.find(key);
+        if (found != framebuffers.end())
+            return found->second;
+
+        GLuint FBO = targetManager.createFramebuffer();
+        vector<GLenum> attachments;
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        for (auto& it: targets)
+        {
+            if (isDepthFormat(it.format))
+            {
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, it.texture, 0);
+                continue;
+            }
+            attachments.push_back(GL_COLOR_ATTACHMENT0 + attachments.size());
+            glFramebufferTexture2D(GL_FRAMEBUFFER, attachments.back(), GL_TEXTURE_2D, it.texture, 0);
+        }
+        if (attachments.empty())
+            glDrawBuffer(GL_NONE);
+        else
+            glDrawBuffers(attachments.size(), attachments.data());
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            cout << "ERROR::RENDERTARGET::FRAMEBUFFER: Framebuffer is not complete!" << endl;
+
+        framebuffers[key] = FBO;
+        return FBO;
+    }
+
+    // Delete every target, e.g. when the frame size changes.
+    void clear()
+    {
+        for (auto& it: framebuffers)
+            targetManager.destroyFramebuffer(it.second);
+        for (auto& it: allTargets)
+            targetManager.destroy(it);
+        framebuffers.clear();
+        allTargets.clear();
+        freeTargets.clear();
+    }
+
+    size_t getTargetCount()
+    {
+        return allTargets.size();
+    }
+
+private:
+    vector<RenderTarget> allTargets;
+    vector<RenderTarget> freeTargets;
+    map<vector<GLuint>, GLuint> framebuffers;
+};
+
+#endif
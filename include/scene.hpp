@@ -0,0 +1,324 @@
+#ifndef SCENE_HPP
+#define SCENE_HPP
+
+#include "common.h"
+#include "model.hpp"
+#include "hierarchy.hpp"
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <set>
+#include <random>
+
+struct SceneStats
+{
+    size_t objects = 0;
+    size_t meshes = 0;
+    size_t triangles = 0;
+    size_t materials = 0;
+    // draw calls saved by instancing repeated meshes, and the memory of the copies
+    size_t collapsedDraws = 0;
+    size_t instancedMeshes = 0;
+    size_t savedBytes = 0;
+    float loadTime = 0.0f;
+};
+
+// Scene description file, one command per line, '#' starts a comment:
+//   model  <path> [x y z] [scale]
+//   grid   <path> <countX> <countZ> <spacing> [scale]
+//   walk   <path> <count> <step> <seed> [scale]
+//   sphere <count> <segments> <materials> <spacing> <seed>
+//   orbit  <degrees per second>
+// Source models are loaded once and shared by all of their copies. orbit makes the
+// objects of the command before it dynamic, circling the origin around the Y axis.
+// Every object is a node of the scene hierarchy, the objects of an orbit are children of
+// a pivot node at the origin, so animating them only rotates the pivot.
+class SceneLoader
+{
+public:
+    SceneStats stats;
+    TransformHierarchy hierarchy;
+
+    vector<Model> load(const string path)
+    {
+        vector<Model> models;
+        orbits.clear();
+        float startTime = glfwGetTime();
+
+        ifstream file(path);
+        if (!file.is_open())
+        {
+            cout << "ERROR::SCENE::LOAD: Failed to open scene file " << path << endl;
+            return models;
+        }
+
+        string line;
+        int lineNumber = 0;
+        // first object of the last command
+        size_t commandStart = 0;
+        while (getline(file, line))
+        {
+            lineNumber++;
+            line = line.substr(0, line.find('#'));
+            istringstream input(line);
+            string command;
+            if (!(input >> command))
+                continue;
+
+            bool valid = false;
+            size_t previousCount = models.size();
+            if (command == "orbit")
+                valid = parseOrbit(input, models, commandStart);
+            else if (command == "model")
+                valid = parseModel(input, models);
+            else if (command == "grid")
+                valid = parseGrid(input, models);
+            else if (command == "walk")
+                valid = parseWalk(input, models);
+            else if (command == "sphere")
+                valid = parseSphere(input, models);
+
+            if (!valid)
+                cout << "ERROR::SCENE::LOAD: " << path << ":" << lineNumber << ": invalid command: " << line << endl;
+            else if (command != "orbit")
+                commandStart = previousCount;
+        }
+
+        buildHierarchy(models);
+        stats.objects = models.size();
+        for (auto& it: models)
+        {
+            stats.meshes += it.getMeshCount();
+            stats.triangles += it.getTriangleCount();
+            stats.collapsedDraws += it.getInstanceCount() - it.getMeshCount();
+        }
+        // memory is saved once per source model, the materials are the distinct names of its
+        // meshes, the generated ones are counted by their command
+        for (auto& it: sourceModels)
+        {
+            stats.instancedMeshes += it.second.getInstancingStats().instancedMeshes;
+            stats.savedBytes += it.second.getInstancingStats().savedBytes;
+            set<string> materialNames;
+            for (auto& mesh: it.second.getMeshes())
+                materialNames.insert(mesh.material);
+            stats.materials += materialNames.size();
+        }
+        stats.loadTime = glfwGetTime() - startTime;
+
+        cout << "DEBUG::SCENE::LOAD: " << path << ": " << stats.objects << " objects, " << stats.meshes << " meshes, "
+             << stats.triangles << " triangles, " << stats.materials << " materials in " << stats.loadTime << "s" << endl;
+        if (stats.instancedMeshes > 0)
+            cout << "DEBUG::SCENE::INSTANCING: " << stats.instancedMeshes << " instanced meshes, " << stats.collapsedDraws
+                 << " draw calls collapsed, " << stats.savedBytes / (1024 * 1024.0f) << " MB saved" << endl;
+        return models;
+    }
+
+    // turns the pivots of the orbits to time and updates the transforms of their objects
+    void animate(vector<Model>& models, float time)
+    {
+        for (auto& it: orbits)
+            hierarchy.setLocal(it.pivot, rotate(mat4(1.0f), deg2rad(it.speed * time), vec3(0.0f, 1.0f, 0.0f)));
+        hierarchy.update();
+        for (auto& it: models)
+        {
+            if (it.isDynamic() && it.node >= 0)
+                it.transform = hierarchy.getWorld(it.node);
+        }
+    }
+
+private:
+    // objects [first, last) of the scene circling the origin
+    struct Orbit
+    {
+        float speed;
+        size_t first;
+        size_t last;
+        int pivot;
+    };
+
+    map<string, Model> sourceModels;
+    vector<Orbit> orbits;
+
+    // pivots come before their objects, the hierarchy is in topological order
+    void buildHierarchy(vector<Model>& models)
+    {
+        hierarchy.clear();
+        for (auto& orbit: orbits)
+        {
+            orbit.pivot = hierarchy.addNode(-1, mat4(1.0f));
+            for (size_t i = orbit.first; i < orbit.last; ++i)
+                models[i].node = hierarchy.addNode(orbit.pivot, models[i].transform);
+        }
+        for (auto& it: models)
+        {
+            if (it.node < 0)
+                it.node = hierarchy.addNode(-1, it.transform);
+        }
+    }
+
+    Model& getSourceModel(const string path)
+    {
+        auto it = sourceModels.find(path);
+        if (it == sourceModels.end())
+            it = sourceModels.emplace(path, Model(path)).first;
+        return it->second;
+    }
+
+    bool parseOrbit(istringstream& input, vector<Model>& models, size_t commandStart)
+    {
+        float speed;
+        if (!(input >> speed) || commandStart >= models.size())
+            return false;
+        for (size_t i = commandStart; i < models.size(); ++i)
+            models[i] = models[i].withOrbit(speed);
+        // a second orbit after the same command replaces the first
+        if (!orbits.empty() && orbits.back().first == commandStart)
+            orbits.back().speed = speed;
+        else
+            orbits.push_back({speed, commandStart, models.size(), -1});
+        return true;
+    }
+
+    bool parseModel(istringstream& input, vector<Model>& models)
+    {
+        string path;
+        vec3 position = vec3(0.0f);
+        float scale = 1.0f;
+        if (!(input >> path))
+            return false;
+        input >> position.x >> position.y >> position.z >> scale;
+
+        models.push_back(getSourceModel(path).withTransform(placement(position, 0.0f, scale)));
+        return true;
+    }
+
+    bool parseGrid(istringstream& input, vector<Model>& models)
+    {
+        string path;
+        int countX, countZ;
+        float spacing;
+        float scale = 1.0f;
+        if (!(input >> path >> countX >> countZ >> spacing))
+            return false;
+        input >> scale;
+
+        Model& source = getSourceModel(path);
+        vec3 origin = -vec3(countX - 1, 0.0f, countZ - 1) * spacing / 2.0f;
+        for (int i = 0; i < countX; ++i)
+        {
+            for (int j = 0; j < countZ; ++j)
+            {
+                vec3 position = origin + vec3(i, 0.0f, j) * spacing;
+                models.push_back(source.withTransform(placement(position, 0.0f, scale)));
+            }
+        }
+        return true;
+    }
+
+    bool parseWalk(istringstream& input, vector<Model>& models)
+    {
+        string path;
+        int count;
+        float step;
+        unsigned int seed;
+        float scale = 1.0f;
+        if (!(input >> path >> count >> step >> seed))
+            return false;
+        input >> scale;
+
+        Model& source = getSourceModel(path);
+        mt19937 random(seed);
+        uniform_real_distribution<float> angle(0.0f, 360.0f);
+        vec3 position = vec3(0.0f);
+        for (int i = 0; i < count; ++i)
+        {
+            models.push_back(source.withTransform(placement(position, angle(random), scale)));
+            float direction = deg2rad(angle(random));
+            position += vec3(cos(direction), 0.0f, sin(direction)) * step;
+        }
+        return true;
+    }
+
+    bool parseSphere(istringstream& input, vector<Model>& models)
+    {
+        int count, segments, materials;
+        float spacing;
+        unsigned int seed;
+        if (!(input >> count >> segments >> materials >> spacing >> seed) || count <= 0 || segments < 3 || materials <= 0)
+            return false;
+
+        mt19937 random(seed);
+        uniform_real_distribution<float> unit(0.0f, 1.0f);
+        vector<Texture> palette;
+        for (int i = 0; i < materials; ++i)
+        {
+            palette.push_back(Texture(vec4(unit(random), unit(random), unit(random), 1.0f), "textureDiffuse"));
+        }
+
+        // one draw call and one texture bind per sphere, geometry is shared by all of them
+        Mesh sphere = Mesh(generateSphereVertices(segments), generateSphereIndices(segments), {});
+        sphere.name = "sphere" + to_string(segments);
+        vector<Model> variants;
+        for (int i = 0; i < materials && i < count; ++i)
+        {
+            Mesh variant = sphere.withTextures({palette[i]});
+            variant.material = "generated" + to_string(i);
+            variants.push_back(Model({variant}));
+        }
+        stats.materials += variants.size();
+
+        int side = (int)ceil(sqrt((float)count));
+        vec3 origin = -vec3(side - 1, 0.0f, side - 1) * spacing / 2.0f;
+        for (int i = 0; i < count; ++i)
+        {
+            vec3 position = origin + vec3(i % side, 1.0f, i / side) * spacing;
+            models.push_back(variants[i % variants.size()].withTransform(placement(position, 0.0f, spacing * 0.4f)));
+        }
+        return true;
+    }
+
+    mat4 placement(vec3 position, float yaw, float scale)
+    {
+        mat4 transform = translate(mat4(1.0f), position);
+        transform = rotate(transform, deg2rad(yaw), vec3(0.0f, 1.0f, 0.0f));
+        return glm::scale(transform, vec3(scale));
+    }
+
+    vector<Vertex> generateSphereVertices(int segments)
+    {
+        vector<Vertex> vertices;
+        for (int i = 0; i <= segments; ++i)
+        {
+            float phi = M_PI * (float)i / segments;
+            for (int j = 0; j <= segments; ++j)
+            {
+                float theta = 2.0f * M_PI * (float)j / segments;
+                Vertex vertex = {};
+                vertex.normal = vec3(sin(phi) * cos(theta), cos(phi), sin(phi) * sin(theta));
+                vertex.position = vertex.normal;
+                vertex.texCoords = vec2((float)j / segments, (float)i / segments);
+                vertex.tangent = vec3(-sin(theta), 0.0f, cos(theta));
+                vertex.bitangent = cross(vertex.normal, vertex.tangent);
+                vertices.push_back(vertex);
+            }
+        }
+        return vertices;
+    }
+
+    vector<GLuint> generateSphereIndices(int segments)
+    {
+        vector<GLuint> indices;
+        for (int i = 0; i < segments; ++i)
+        {
+            for (int j = 0; j < segments; ++j)
+            {
+                GLuint first = i * (segments + 1) + j;
+                GLuint second = first + segments + 1;
+                indices.insert(indices.end(), {first, second, first + 1, second, second + 1, first + 1});
+            }
+        }
+        return indices;
+    }
+};
+
+#endif
@@ -2,97 +2,326 @@
 #define SHADER_HPP
 
 #include "common.h"
+#include "profiler.hpp"
+#include "glextension.hpp"
+#include <filesystem>
+#include <vector>
 
+#define SHADER_CACHE_DIRECTORY "shader_cache"
+
+// Programs are linked without waiting for the result, the link status is only checked
+// when the program is first used. With KHR_parallel_shader_compile the driver compiles
+// every program created at startup concurrently in the meantime. Linked programs are
+// stored with glGetProgramBinary and loaded from there on the next run.
 class Shader
 {
 public:
     GLuint program;
+    static inline bool cacheEnable = true;
+
     Shader(const char* vertexPath, const char* fragmentPath)
     {
-        glViewport(INIT_VIEWPORT_X, INIT_VIEWPORT_Y, INIT_WIDTH, INIT_HEIGHT);
-        glClearColor(0.0f, 0.3f, 0.0f, 1.00f);
-        // glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-        glEnable(GL_DEPTH_TEST);
-        glDepthFunc(GL_LEQUAL);
+        string vertexSource = loadShaderSource(vertexPath);
+        string fragmentSource = loadShaderSource(fragmentPath);
+        createProgram(vertexSource, fragmentSource);
+    }
 
-        // Create Shader Program
-        program = glCreateProgram();
+    Shader(const char* computePath)
+    {
+        createProgram({{GL_COMPUTE_SHADER, loadShaderSource(computePath)}});
+    }
 
-        // Create customize shader by tell openGL specify shader type
-        char **vertexShaderSource = loadShaderSource(vertexPath);
-        GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, vertexShaderSource, NULL);
-        freeShaderSource(vertexShaderSource);
-        glCompileShader(vertexShader);
-        shaderLog(vertexShader);
-
-        char **fragmentShaderSource = loadShaderSource(fragmentPath);
-        GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, fragmentShaderSource, NULL);
-        freeShaderSource(fragmentShaderSource);
-        glCompileShader(fragmentShader);
-        shaderLog(fragmentShader);
-
-        glAttachShader(program, vertexShader);
-        glAttachShader(program, fragmentShader);
-        glLinkProgram(program);
+    // Program from GLSL generated at runtime, includes are resolved from the asset directory
+    static Shader fromSource(const string vertexSource, const string fragmentSource)
+    {
+        Shader shader;
+        shader.createProgram(resolveIncludes(vertexSource, "asset"), resolveIncludes(fragmentSource, "asset"));
+        return shader;
+    }
 
-        // Tell OpenGL to use this shader program now
-        glUseProgram(program);
+    // Program whose sources get the given "#define" lines right after their #version line
+    static Shader withDefines(const char* vertexPath, const char* fragmentPath, const string defines)
+    {
+        Shader shader;
+        shader.createProgram(insertDefines(loadShaderSource(vertexPath), defines), insertDefines(loadShaderSource(fragmentPath), defines));
+        return shader;
+    }
+
+    static Shader computeWithDefines(const char* computePath, const string defines)
+    {
+        Shader shader;
+        shader.createProgram({{GL_COMPUTE_SHADER, insertDefines(loadShaderSource(computePath), defines)}});
+        return shader;
     }
+
     // activate the shader
     // ------------------------------------------------------------------------
     void use() 
     { 
+        finishLink();
         glUseProgram(program); 
+        renderCounters.stateChanges++;
+    }
+
+    // false while the driver is still compiling in the background
+    bool isReady()
+    {
+        if (pendingShaders.empty() || !parallelShaderCompile)
+            return true;
+        GLint completed = GL_FALSE;
+        glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &completed);
+        return completed == GL_TRUE;
     }
     // utility uniform functions
     // ------------------------------------------------------------------------
     void setInt(const GLchar* name, int value)
     { 
         glUniform1i(glGetUniformLocation(program, name), value); 
+        countUniform(sizeof(GLint));
     }
 
     void setBool(const GLchar* name, bool value)
     { 
         glUniform1i(glGetUniformLocation(program, name), value); 
+        countUniform(sizeof(GLint));
     }
 
     void setFloat(const GLchar* name, float value)
     { 
         glUniform1f(glGetUniformLocation(program, name), value); 
+        countUniform(sizeof(GLfloat));
     }
 
     void setVec2(const GLchar* name, float x, float y)
     { 
         glUniform2f(glGetUniformLocation(program, name), x, y); 
+        countUniform(2 * sizeof(GLfloat));
+    }
+
+    void setVec3(const GLchar* name, float x, float y, float z)
+    { 
+        glUniform3f(glGetUniformLocation(program, name), x, y, z); 
+        countUniform(3 * sizeof(GLfloat));
+    }
+
+    void setVec4(const GLchar* name, const vec4 &value)
+    { 
+        glUniform4fv(glGetUniformLocation(program, name), 1, &value[0]); 
+        countUniform(4 * sizeof(GLfloat));
     }
 
     void setMat4(const GLchar* name, const mat4 &mat)
     {
         glUniformMatrix4fv(glGetUniformLocation(program, name), 1, GL_FALSE, &mat[0][0]);
+        countUniform(sizeof(mat4));
     }
 
-private:
-    char** loadShaderSource(const char* file)
+    static string loadShaderSource(const char* file)
     {
         FILE* fp = fopen(file, "rb");
+        if (fp == NULL)
+        {
+            cout << "ERROR::SHADER::LOAD: Failed to open " << file << endl;
+            return "";
+        }
         fseek(fp, 0, SEEK_END);
         long sz = ftell(fp);
         fseek(fp, 0, SEEK_SET);
-        char *src = new char[sz + 1];
-        fread(src, sizeof(char), sz, fp);
-        src[sz] = '\0';
-        char **srcp = new char*[1];
-        srcp[0] = src;
-        return srcp;
+        string src(sz, '\0');
+        fread(&src[0], sizeof(char), sz, fp);
+        fclose(fp);
+
+        string path = file;
+        return resolveIncludes(src, path.substr(0, path.find_last_of('/')));
+    }
+
+    // Replace '#include "file"' lines by the content of the file, GLSL has no include of its own
+    static string resolveIncludes(const string source, const string directory)
+    {
+        string result;
+        size_t lineStart = 0;
+        while (lineStart < source.size())
+        {
+            size_t lineEnd = source.find('\n', lineStart);
+            if (lineEnd == string::npos)
+                lineEnd = source.size();
+            string line = source.substr(lineStart, lineEnd - lineStart);
+
+            size_t open = line.find('"');
+            size_t close = line.rfind('"');
+            if (line.rfind("#include", 0) == 0 && open != string::npos && close > open)
+                result += loadShaderSource((directory + "/" + line.substr(open + 1, close - open - 1)).c_str());
+            else
+                result += line;
+            result += '\n';
+            lineStart = lineEnd + 1;
+        }
+        return result;
+    }
+
+    static string insertDefines(const string source, const string defines)
+    {
+        if (source.rfind("#version", 0) != 0)
+            return defines + source;
+        size_t lineEnd = source.find('\n');
+        if (lineEnd == string::npos)
+            return source + "\n" + defines;
+        return source.substr(0, lineEnd + 1) + defines + source.substr(lineEnd + 1);
+    }
+
+private:
+    void countUniform(unsigned long bytes)
+    {
+        renderCounters.uniformUploads++;
+        renderCounters.uploadBytes += bytes;
+    }
+
+    // shaders of a link which has not been checked yet
+    vector<GLuint> pendingShaders;
+    string cacheKey;
+
+    Shader() {}
+
+    void createProgram(const string vertexSource, const string fragmentSource)
+    {
+        createProgram({{GL_VERTEX_SHADER, vertexSource}, {GL_FRAGMENT_SHADER, fragmentSource}});
+    }
+
+    void createProgram(const vector<pair<GLenum, string>>& stages)
+    {
+        // Create Shader Program
+        program = glCreateProgram();
+
+        cacheKey = getCacheKey(stages);
+        if (cacheEnable && loadBinary())
+            return;
+
+        // Create customize shader by tell openGL specify shader type
+        for (auto& it: stages)
+        {
+            GLuint shader = compileShader(it.first, it.second);
+            glAttachShader(program, shader);
+            pendingShaders.push_back(shader);
+        }
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(program);
+    }
+
+    GLuint compileShader(GLenum type, const string source)
+    {
+        const char* sourcePointer = source.c_str();
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &sourcePointer, NULL);
+        glCompileShader(shader);
+        return shader;
+    }
+
+    void finishLink()
+    {
+        if (pendingShaders.empty())
+            return;
+        for (auto& it: pendingShaders)
+        {
+            shaderLog(it);
+            glDetachShader(program, it);
+            glDeleteShader(it);
+        }
+        pendingShaders.clear();
+
+        GLint isLinked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+        if (isLinked == GL_FALSE)
+        {
+            GLint maxLength = 0;
+            glGetProgramiv(program, GL_INFO_LOG_LENGTH, &maxLength);
+            string errorLog(maxLength, '\0');
+            glGetProgramInfoLog(program, maxLength, &maxLength, &errorLog[0]);
+            cout << "ERROR::SHADER::LINK: " << errorLog << endl;
+            return;
+        }
+        if (cacheEnable)
+            saveBinary();
+    }
+
+    // FNV-1a over the sources (defines included) and the driver, a new driver
+    // version usually cannot load binaries of the old one
+    static string getCacheKey(const vector<pair<GLenum, string>>& stages)
+    {
+        string text;
+        for (auto& it: stages)
+            text += to_string(it.first) + it.second;
+        text += (const char*)glGetString(GL_VENDOR);
+        text += (const char*)glGetString(GL_RENDERER);
+        text += (const char*)glGetString(GL_VERSION);
+
+        unsigned long long hash = 14695981039346656037ULL;
+        for (unsigned char c: text)
+        {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+        char name[17];
+        snprintf(name, sizeof(name), "%016llx", hash);
+        return name;
+    }
+
+    string getCachePath()
+    {
+        return string(SHADER_CACHE_DIRECTORY) + "/" + cacheKey + ".bin";
+    }
+
+    bool loadBinary()
+    {
+        FILE* fp = fopen(getCachePath().c_str(), "rb");
+        if (fp == NULL)
+            return false;
+        fseek(fp, 0, SEEK_END);
+        long sz = ftell(fp) - (long)sizeof(GLenum);
+        fseek(fp, 0, SEEK_SET);
+        GLenum format = 0;
+        vector<char> binary(sz > 0 ? sz : 0);
+        bool complete = sz > 0 && fread(&format, sizeof(GLenum), 1, fp) == 1 && fread(binary.data(), 1, sz, fp) == (size_t)sz;
+        fclose(fp);
+        if (!complete)
+            return false;
+
+        glProgramBinary(program, format, binary.data(), sz);
+        GLint isLinked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+        if (isLinked == GL_FALSE)
+        {
+            // rejected by the driver, compile from source into a fresh program
+            cout << "DEBUG::SHADER::CACHE: " << cacheKey << " rejected, compiling" << endl;
+            glDeleteProgram(program);
+            program = glCreateProgram();
+            return false;
+        }
+        cout << "DEBUG::SHADER::CACHE: " << cacheKey << " loaded" << endl;
+        return true;
     }
 
-    void freeShaderSource(char** srcp)
+    void saveBinary()
     {
-        delete srcp[0];
-        delete srcp;
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        GLenum format = 0;
+        vector<char> binary(length);
+        glGetProgramBinary(program, length, &length, &format, binary.data());
+
+        filesystem::create_directories(SHADER_CACHE_DIRECTORY);
+        FILE* fp = fopen(getCachePath().c_str(), "wb");
+        if (fp == NULL)
+        {
+            cout << "ERROR::SHADER::CACHE: Failed to write " << getCachePath() << endl;
+            return;
+        }
+        fwrite(&format, sizeof(GLenum), 1, fp);
+        fwrite(binary.data(), 1, length, fp);
+        fclose(fp);
     }
+
 };
 
 #endif
@@ -0,0 +1,45 @@
+#ifndef SHADERVARIANTS_HPP
+#define SHADERVARIANTS_HPP
+
+#include "common.h"
+#include "shader.hpp"
+#include <map>
+#include <memory>
+
+// Permutations of one program. Every combination of defines is compiled on first use
+// and kept, so switching back to a combination costs nothing.
+class ShaderVariants
+{
+public:
+    ShaderVariants(const string vertexPath, const string fragmentPath)
+        : vertexPath(vertexPath), fragmentPath(fragmentPath)
+    {
+    }
+
+    Shader& get(const map<string, int>& defines)
+    {
+        string key;
+        for (auto& it: defines)
+            key += "#define " + it.first + " " + to_string(it.second) + "\n";
+
+        auto found = variants.find(key);
+        if (found == variants.end())
+        {
+            cout << "DEBUG::SHADERVARIANTS::COMPILE: " << fragmentPath << " variant " << variants.size() << endl;
+            found = variants.emplace(key, make_unique<Shader>(Shader::withDefines(vertexPath.c_str(), fragmentPath.c_str(), key))).first;
+        }
+        return *found->second;
+    }
+
+    size_t getVariantCount()
+    {
+        return variants.size();
+    }
+
+private:
+    string vertexPath;
+    string fragmentPath;
+    map<string, unique_ptr<Shader>> variants;
+};
+
+#endif
@@ -0,0 +1,278 @@
+#ifndef SHADOWS_HPP
+#define SHADOWS_HPP
+
+#include "common.h"
+#include "shader.hpp"
+#include "camera.hpp"
+#include "model.hpp"
+#include "profiler.hpp"
+
+// same as asset/shadows.glsl
+#define SHADOW_CASCADES 4
+#define SHADOW_MAP_SIZE 2048
+
+// Directional sun light with cascaded shadow maps. Each cascade is fitted with a
+// bounding sphere to its slice of the camera frustum, so its size never changes, and
+// its center is snapped to whole shadow texels in light space. A cascade then only
+// moves in texel steps, and its static geometry is drawn again only when it moved or
+// the sun turned. The static depth is kept in a cache array; with dynamic objects in
+// the scene every cascade is copied from the cache and only those are drawn on top.
+class CascadedShadows
+{
+public:
+    bool enabled = false;
+    bool cacheEnable = true;
+    float sunAzimuth = 30.0f;
+    float sunElevation = 60.0f;
+    vec3 sunColor = vec3(1.0f, 0.95f, 0.85f);
+    // shadows end here or at the far plane
+    float shadowDistance = 3000.0f;
+    // blend of logarithmic (1) and uniform (0) cascade splits
+    float splitLambda = 0.8f;
+
+    // Fits the cascades to the camera and draws the ones that changed, with the shaders
+    // of the depth prepass.
+    void update(Camera& camera, vector<Model>& models, Shader& depthShader, Shader& maskedDepthShader)
+    {
+        if (!initialized)
+            initialize();
+        profiler.beginPass("Shadow");
+        view = camera.getView();
+        fitCascades(camera);
+
+        bool dynamic = false;
+        for (auto& it: models)
+            dynamic |= it.isDynamic();
+        if (models.size() != modelCount)
+            invalidate();
+        modelCount = models.size();
+
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+        glEnable(GL_DEPTH_TEST);
+        // casters between the sun and the cascade are flattened onto its near plane
+        glEnable(GL_DEPTH_CLAMP);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.0f, 4.0f);
+
+        renderedCascades = 0;
+        for (int i = 0; i < SHADOW_CASCADES; ++i)
+        {
+            if (!cacheEnable)
+            {
+                drawCascade(shadowFBOs[i], i, models, DRAW_ALL, depthShader, maskedDepthShader);
+                cachedMatrices[i] = mat4(0.0f);
+                continue;
+            }
+            if (lightMatrices[i] != cachedMatrices[i])
+            {
+                drawCascade(cacheFBOs[i], i, models, DRAW_STATIC, depthShader, maskedDepthShader);
+                cachedMatrices[i] = lightMatrices[i];
+            }
+            if (dynamic)
+            {
+                glCopyImageSubData(cacheArray, GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, shadowArray, GL_TEXTURE_2D_ARRAY, 0, 0, 0, i,
+                    SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1);
+                drawCascade(shadowFBOs[i], i, models, DRAW_DYNAMIC, depthShader, maskedDepthShader, false);
+            }
+        }
+        sampledArray = cacheEnable && !dynamic ? cacheArray : shadowArray;
+
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glDisable(GL_DEPTH_CLAMP);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        profiler.endPass();
+        if (profiler.enabled)
+            passTime[cacheEnable] = profiler.getSmoothed("Shadow").gpuTime;
+    }
+
+    // the sun moved or the geometry changed, every cascade is drawn again
+    void invalidate()
+    {
+        for (int i = 0; i < SHADOW_CASCADES; ++i)
+            cachedMatrices[i] = mat4(0.0f);
+    }
+
+    // after shader.use()
+    void setupShader(Shader& shader)
+    {
+        shader.setBool("sunEnable", enabled && initialized);
+        if (!enabled || !initialized)
+            return;
+        vec3 direction = mat3(view) * getSunDirection();
+        shader.setVec3("sunDirection", direction.x, direction.y, direction.z);
+        shader.setVec3("sunColor", sunColor.x, sunColor.y, sunColor.z);
+        // eye space to the [0, 1] texture space of every cascade
+        mat4 bias = translate(mat4(1.0f), vec3(0.5f)) * glm::scale(mat4(1.0f), vec3(0.5f));
+        mat4 inverseView = inverse(view);
+        for (int i = 0; i < SHADOW_CASCADES; ++i)
+        {
+            string name = "shadowMatrices[" + to_string(i) + "]";
+            shader.setMat4(name.c_str(), bias * lightMatrices[i] * inverseView);
+        }
+        glUniform4fv(glGetUniformLocation(shader.program, "cascadeSplits"), 1, &splits[1]);
+        glUniform4fv(glGetUniformLocation(shader.program, "cascadeTexels"), 1, texelSizes);
+
+        glActiveTexture(GL_TEXTURE0 + SHADOW_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, sampledArray);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // towards the sun, world space
+    vec3 getSunDirection()
+    {
+        float azimuth = deg2rad(sunAzimuth);
+        float elevation = deg2rad(sunElevation);
+        return vec3(cos(elevation) * cos(azimuth), sin(elevation), cos(elevation) * sin(azimuth));
+    }
+
+    // cascades whose depth was drawn again in the last update
+    int getRenderedCascades()
+    {
+        return renderedCascades;
+    }
+
+    // smoothed GPU time of the shadow pass, with and without the cache
+    float getPassTime(bool cached)
+    {
+        return passTime[cached];
+    }
+
+    float getSplit(int cascade)
+    {
+        return splits[cascade + 1];
+    }
+
+private:
+    static const int SHADOW_TEXTURE_UNIT = 6;
+    enum DrawSet
+    {
+        DRAW_ALL,
+        DRAW_STATIC,
+        DRAW_DYNAMIC
+    };
+
+    bool initialized = false;
+    GLuint cacheArray = 0;
+    GLuint shadowArray = 0;
+    GLuint sampledArray = 0;
+    GLuint cacheFBOs[SHADOW_CASCADES];
+    GLuint shadowFBOs[SHADOW_CASCADES];
+
+    mat4 view = mat4(1.0f);
+    mat4 lightMatrices[SHADOW_CASCADES];
+    mat4 cachedMatrices[SHADOW_CASCADES];
+    float splits[SHADOW_CASCADES + 1];
+    float texelSizes[SHADOW_CASCADES];
+    size_t modelCount = 0;
+    int renderedCascades = 0;
+    float passTime[2] = {0.0f, 0.0f};
+
+    GLuint createArray()
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, SHADOW_CASCADES);
+        // hardware 2x2 PCF
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        return texture;
+    }
+
+    void createFramebuffers(GLuint texture, GLuint* FBOs)
+    {
+        glGenFramebuffers(SHADOW_CASCADES, FBOs);
+        for (int i = 0; i < SHADOW_CASCADES; ++i)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, FBOs[i]);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, i);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+            if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                cout << "ERROR::SHADOWS::INIT: Framebuffer is not complete!" << endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void initialize()
+    {
+        cacheArray = createArray();
+        shadowArray = createArray();
+        createFramebuffers(cacheArray, cacheFBOs);
+        createFramebuffers(shadowArray, shadowFBOs);
+        invalidate();
+        initialized = true;
+        cout << "DEBUG::SHADOWS::INIT: " << SHADOW_CASCADES << " cascades of " << SHADOW_MAP_SIZE << "x" << SHADOW_MAP_SIZE << endl;
+    }
+
+    void fitCascades(Camera& camera)
+    {
+        float near = camera.near;
+        float far = std::min(camera.far, shadowDistance);
+        for (int i = 0; i <= SHADOW_CASCADES; ++i)
+        {
+            float fraction = (float)i / SHADOW_CASCADES;
+            float logarithmic = near * pow(far / near, fraction);
+            float uniform = near + (far - near) * fraction;
+            splits[i] = splitLambda * logarithmic + (1.0f - splitLambda) * uniform;
+        }
+
+        mat4 inverseView = inverse(view);
+        mat4 lightRotation = lookAt(vec3(0.0f), -getSunDirection(), abs(getSunDirection().y) > 0.99f ? vec3(1.0f, 0.0f, 0.0f) : vec3(0.0f, 1.0f, 0.0f));
+        float tanY = tan(deg2rad(camera.fieldOfView) / 2.0f);
+        float tanX = tanY * camera.aspect;
+        for (int i = 0; i < SHADOW_CASCADES; ++i)
+        {
+            // the sphere through the corners of the slice, its center on the view axis
+            float sliceNear = splits[i];
+            float sliceFar = splits[i + 1];
+            float cornerNear = (tanX * tanX + tanY * tanY) * sliceNear * sliceNear;
+            float cornerFar = (tanX * tanX + tanY * tanY) * sliceFar * sliceFar;
+            float center = glm::clamp((sliceFar * sliceFar + cornerFar - sliceNear * sliceNear - cornerNear) / (2.0f * (sliceFar - sliceNear)),
+                sliceNear, sliceFar);
+            float radius = sqrt(std::max((center - sliceNear) * (center - sliceNear) + cornerNear,
+                (sliceFar - center) * (sliceFar - center) + cornerFar));
+            // depends on the projection only, so it stays the same while the camera moves
+            float texel = 2.0f * radius / SHADOW_MAP_SIZE;
+            texelSizes[i] = texel;
+
+            vec3 lightCenter = vec3(lightRotation * inverseView * vec4(0.0f, 0.0f, -center, 1.0f));
+            lightCenter = floor(lightCenter / texel) * texel;
+            mat4 lightView = translate(mat4(1.0f), -lightCenter) * lightRotation;
+            lightMatrices[i] = ortho(-radius, radius, -radius, radius, -radius, radius) * lightView;
+        }
+    }
+
+    void drawCascade(GLuint FBO, int cascade, vector<Model>& models, DrawSet set, Shader& depthShader, Shader& maskedDepthShader,
+        bool clear = true)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        if (clear)
+            glClear(GL_DEPTH_BUFFER_BIT);
+        renderCounters.stateChanges++;
+        Shader* shaders[2] = {&depthShader, &maskedDepthShader};
+        const MeshPass passes[2] = {MESH_OPAQUE, MESH_MASKED};
+        for (int i = 0; i < 2; ++i)
+        {
+            shaders[i]->use();
+            shaders[i]->setMat4("um4p", mat4(1.0f));
+            shaders[i]->setMat4("um4mv", lightMatrices[cascade]);
+            for (auto& it: models)
+            {
+                if ((set == DRAW_STATIC && it.isDynamic()) || (set == DRAW_DYNAMIC && !it.isDynamic()))
+                    continue;
+                it.drawDepth(*shaders[i], passes[i]);
+            }
+        }
+        if (set != DRAW_DYNAMIC)
+            renderedCascades++;
+    }
+};
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef SSAO_HPP
+#define SSAO_HPP
+
+#include "common.h"
+#include "shader.hpp"
+#include "frame.hpp"
+
+#define SSAO_GROUP_SIZE 8
+#define SSAO_COMPOSITE_GROUP_SIZE 16
+#define SSAO_TEXTURE_UNIT 10
+
+// Screen space ambient occlusion from the depth texture of the frame, between the depth
+// of the scene and its lighting, so it only darkens the ambient term and not the direct
+// light. The occlusion is computed at half resolution with 8 samples per pixel and a 4x4
+// interleaved rotation pattern, then a separable blur weighted by depth removes the
+// pattern without bleeding over edges, and a full resolution pass upsamples it by depth
+// as well: into a texture the forward scene shader samples, or into the ambient slot of
+// the G-buffer material for the deferred lighting. All passes are compute shaders.
+class AmbientOcclusion
+{
+public:
+    float sharpness = 8.0f;
+
+    AmbientOcclusion()
+        : occlusionShader("asset/ssao.cs.glsl"),
+          blurShader("asset/ssaoBlur.cs.glsl"),
+          compositeShader("asset/ssaoComposite.cs.glsl"),
+          materialCompositeShader(Shader::computeWithDefines("asset/ssaoComposite.cs.glsl", "#define MATERIAL_OUTPUT\n"))
+    {
+    }
+
+    // After the depth of the scene was drawn into frame with projection, before it is lit.
+    // radius is in world units. deferred writes into the G-buffer instead of the texture.
+    void apply(Frame& frame, const mat4& projection, float radius, float intensity, bool deferred)
+    {
+        vec2 renderSize = vec2(frame.getRenderWidth(), frame.getRenderHeight());
+        ivec2 halfSize = (ivec2(renderSize) + 1) / 2;
+        allocate(halfSize, ivec2(renderSize));
+
+        occlusionShader.use();
+        occlusionShader.setVec2("projectionScale", 1.0f / projection[0][0], 1.0f / projection[1][1]);
+        occlusionShader.setVec2("projectionZ", projection[2][2], projection[3][2]);
+        occlusionShader.setVec2("renderSize", renderSize.x, renderSize.y);
+        occlusionShader.setFloat("projectedScale", projection[1][1] * 0.5f * renderSize.y);
+        occlusionShader.setFloat("radius", radius);
+        occlusionShader.setFloat("intensity", intensity);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, frame.getDepthTarget().texture);
+        glBindImageTexture(0, occlusion.texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16F);
+        dispatch(halfSize, SSAO_GROUP_SIZE);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+        blurShader.use();
+        blurShader.setVec2("size", halfSize.x, halfSize.y);
+        blurShader.setFloat("sharpness", sharpness);
+        const RenderTarget sources[2] = {occlusion, blurred};
+        for (int i = 0; i < 2; ++i)
+        {
+            blurShader.setVec2("direction", i == 0, i == 1);
+            glBindTexture(GL_TEXTURE_2D, sources[i].texture);
+            glBindImageTexture(0, sources[1 - i].texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16F);
+            dispatch(halfSize, SSAO_GROUP_SIZE);
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        }
+
+        Shader& composite = deferred ? materialCompositeShader : compositeShader;
+        composite.use();
+        composite.setVec2("projectionZ", projection[2][2], projection[3][2]);
+        composite.setVec2("renderSize", renderSize.x, renderSize.y);
+        glBindTexture(GL_TEXTURE_2D, occlusion.texture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, frame.getDepthTarget().texture);
+        glActiveTexture(GL_TEXTURE0);
+        if (deferred)
+            glBindImageTexture(0, frame.getGBuffer().material.texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA8);
+        else
+            glBindImageTexture(0, result.texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R8);
+        dispatch(ivec2(renderSize), SSAO_COMPOSITE_GROUP_SIZE);
+        // read by the lighting, as a texture in both paths
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        renderCounters.drawCalls += 4;
+        renderCounters.stateChanges += 12;
+    }
+
+    // for the forward scene shader, which has to be in use
+    static void setupShader(Shader& shader, bool enabled)
+    {
+        shader.setBool("ssaoEnable", enabled);
+    }
+
+    // the result of apply() for the forward scene shader
+    void bind()
+    {
+        glActiveTexture(GL_TEXTURE0 + SSAO_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, result.texture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+private:
+    Shader occlusionShader;
+    Shader blurShader;
+    Shader compositeShader;
+    Shader materialCompositeShader;
+    RenderTarget occlusion;
+    RenderTarget blurred;
+    RenderTarget result;
+    ivec2 allocatedSize = ivec2(0);
+    ivec2 allocatedResultSize = ivec2(0);
+
+    // grows with the render size, smaller frames use the bottom left part
+    void allocate(ivec2 size, ivec2 fullSize)
+    {
+        if (size.x > allocatedSize.x || size.y > allocatedSize.y)
+        {
+            if (occlusion.texture != 0)
+            {
+                targetManager.destroy(occlusion);
+                targetManager.destroy(blurred);
+            }
+            allocatedSize = max(size, allocatedSize);
+            occlusion = targetManager.createTexture(allocatedSize.x, allocatedSize.y, GL_RG16F);
+            blurred = targetManager.createTexture(allocatedSize.x, allocatedSize.y, GL_RG16F);
+        }
+        if (fullSize.x > allocatedResultSize.x || fullSize.y > allocatedResultSize.y)
+        {
+            if (result.texture != 0)
+                targetManager.destroy(result);
+            allocatedResultSize = max(fullSize, allocatedResultSize);
+            result = targetManager.createTexture(allocatedResultSize.x, allocatedResultSize.y, GL_R8);
+        }
+    }
+
+    void dispatch(ivec2 size, int groupSize)
+    {
+        glDispatchCompute((size.x + groupSize - 1) / groupSize, (size.y + groupSize - 1) / groupSize, 1);
+    }
+};
+
+#endif
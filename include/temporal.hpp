@@ -0,0 +1,201 @@
+#ifndef TEMPORAL_HPP
+#define TEMPORAL_HPP
+
+#include "common.h"
+#include "shader.hpp"
+#include "rendertarget.hpp"
+
+#define TEMPORAL_TILE_SIZE 16
+#define TEMPORAL_READBACK_LATENCY 3
+
+// Keeps the filtered frame of the last draw and reprojects it into the current one with
+// the scene depth and both view projections. A compute pass marks the 16x16 tiles which
+// have any pixel without usable history (off screen, disoccluded, or its scene color
+// changed), plus a rotating 1 / subsetCount of all tiles. A second one dilates the
+// changed tiles by the filter support, and only the resulting tiles are filtered again.
+// The number of recomputed pixels is read back a few frames later.
+class TemporalReuse
+{
+public:
+    Shader maskShader;
+    Shader resolveShader;
+
+    int subsetCount = 8;
+    // relative linear depth difference and luminance difference still accepted
+    float depthThreshold = 0.02f;
+    float lumaThreshold = 0.05f;
+
+    TemporalReuse()
+        : maskShader("asset/frameVertex.vs.glsl", "asset/temporalMask.fs.glsl"),
+          resolveShader("asset/frameVertex.vs.glsl", "asset/temporalResolve.fs.glsl"),
+          classifyShader("asset/temporalClassify.cs.glsl"),
+          dilateShader("asset/temporalDilate.cs.glsl")
+    {
+        createHistoryObject();
+
+        glGenBuffers(TEMPORAL_READBACK_LATENCY, resultBuffers);
+        for (int i = 0; i < TEMPORAL_READBACK_LATENCY; ++i)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, resultBuffers[i]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), NULL, GL_DYNAMIC_READ);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    void setFrameSize(int width, int height)
+    {
+        if (width == frameWidth && height == frameHeight)
+            return;
+        frameWidth = width;
+        frameHeight = height;
+        deleteHistoryObject();
+        createHistoryObject();
+    }
+
+    // the history no longer matches what the filters would produce
+    void invalidate()
+    {
+        historyValid = false;
+    }
+
+    // Reprojects the history into this frame and builds the tile mask, before the filters run.
+    // dilation is the number of tiles the filter support of a pixel reaches into.
+    void classify(GLuint sceneTexture, GLuint depthTexture, const mat4& view, const mat4& projection, int dilation)
+    {
+        mat4 viewProjection = projection * view;
+        GLuint resultBuffer = resultBuffers[frameIndex % TEMPORAL_READBACK_LATENCY];
+        GLuint readBuffer = resultBuffers[(frameIndex + 1) % TEMPORAL_READBACK_LATENCY];
+        if (frameIndex + 1 >= TEMPORAL_READBACK_LATENCY)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, readBuffer);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &recomputedPixels);
+        }
+        GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, resultBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), &zero);
+
+        classifyShader.use();
+        classifyShader.setMat4("currentToPrevious", previousViewProjection * inverse(viewProjection));
+        classifyShader.setVec2("projectionZ", projection[2][2], projection[3][2]);
+        classifyShader.setBool("historyValid", historyValid);
+        classifyShader.setInt("refreshSubset", frameIndex % subsetCount);
+        classifyShader.setInt("subsetCount", subsetCount);
+        classifyShader.setFloat("depthThreshold", depthThreshold);
+        classifyShader.setFloat("lumaThreshold", lumaThreshold);
+
+        const GLuint textures[4] = {sceneTexture, depthTexture, historyColor[current].texture, historyDepth[current].texture};
+        for (int i = 0; i < 4; ++i)
+        {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+        }
+        glBindImageTexture(0, reprojected.texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        glBindImageTexture(1, changedTiles.texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R8UI);
+        glDispatchCompute(tileMask.width, tileMask.height, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+        dilateShader.use();
+        dilateShader.setInt("dilation", dilation);
+        dilateShader.setVec2("frameSize", frameWidth, frameHeight);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, changedTiles.texture);
+        glBindImageTexture(1, tileMask.texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R8UI);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, resultBuffer);
+        glDispatchCompute((tileMask.width + 7) / 8, (tileMask.height + 7) / 8, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        previousViewProjection = viewProjection;
+    }
+
+    // after the filters wrote the next history
+    void swap()
+    {
+        current = 1 - current;
+        historyValid = true;
+        frameIndex++;
+    }
+
+    RenderTarget getReprojected()
+    {
+        return reprojected;
+    }
+
+    RenderTarget getTileMask()
+    {
+        return tileMask;
+    }
+
+    RenderTarget getNextColor()
+    {
+        return historyColor[1 - current];
+    }
+
+    RenderTarget getNextDepth()
+    {
+        return historyDepth[1 - current];
+    }
+
+    // of the frame classified TEMPORAL_READBACK_LATENCY - 1 frames ago
+    float getRecomputedFraction()
+    {
+        return (float)recomputedPixels / (frameWidth * frameHeight);
+    }
+
+private:
+    Shader classifyShader;
+    Shader dilateShader;
+    RenderTarget historyColor[2];
+    RenderTarget historyDepth[2];
+    RenderTarget reprojected;
+    RenderTarget changedTiles;
+    RenderTarget tileMask;
+    int current = 0;
+    bool historyValid = false;
+    mat4 previousViewProjection = mat4(1.0f);
+
+    GLuint resultBuffers[TEMPORAL_READBACK_LATENCY];
+    GLuint recomputedPixels = 0;
+    unsigned long frameIndex = 0;
+
+    int frameWidth = INIT_WIDTH;
+    int frameHeight = INIT_HEIGHT;
+
+    RenderTarget createTarget(int width, int height, GLenum format, GLenum filter)
+    {
+        RenderTarget target = targetManager.createTexture(width, height, format);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return target;
+    }
+
+    void createHistoryObject()
+    {
+        for (int i = 0; i < 2; ++i)
+        {
+            historyColor[i] = createTarget(frameWidth, frameHeight, GL_RGBA16F, GL_LINEAR);
+            historyDepth[i] = createTarget(frameWidth, frameHeight, GL_R32F, GL_NEAREST);
+        }
+        reprojected = createTarget(frameWidth, frameHeight, GL_RGBA16F, GL_NEAREST);
+        int tilesX = (frameWidth + TEMPORAL_TILE_SIZE - 1) / TEMPORAL_TILE_SIZE;
+        int tilesY = (frameHeight + TEMPORAL_TILE_SIZE - 1) / TEMPORAL_TILE_SIZE;
+        changedTiles = createTarget(tilesX, tilesY, GL_R8UI, GL_NEAREST);
+        tileMask = createTarget(tilesX, tilesY, GL_R8UI, GL_NEAREST);
+        historyValid = false;
+    }
+
+    void deleteHistoryObject()
+    {
+        for (int i = 0; i < 2; ++i)
+        {
+            targetManager.destroy(historyColor[i]);
+            targetManager.destroy(historyDepth[i]);
+        }
+        targetManager.destroy(reprojected);
+        targetManager.destroy(changedTiles);
+        targetManager.destroy(tileMask);
+    }
+};
+
+#endif
@@ -21,6 +21,16 @@ public:
         path = filepath;
 	}
 
+    // Solid color texture, used by generated materials which have no image on disk
+    Texture(const vec4 &color, string typeName)
+    {
+        id = createColorTexture(color);
+        width = 1;
+        height = 1;
+        type = typeName;
+        path = "";
+    }
+
 	GLuint loadTexture(const string &path, int &width, int &height)
     {
         int colorChannel;
@@ -73,6 +83,20 @@ public:
         return textureID;
     }
 
+    GLuint createColorTexture(const vec4 &color)
+    {
+        vec4 clamped = glm::clamp(color, 0.0f, 1.0f) * 255.0f;
+        GLubyte pixel[4] = {(GLubyte)clamped.r, (GLubyte)clamped.g, (GLubyte)clamped.b, (GLubyte)clamped.a};
+
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        return textureID;
+    }
+
     int comparePath(const char* filepath)
 	{
 		return strcmp(path.data(), filepath);
@@ -82,6 +106,7 @@ public:
 	{
         glActiveTexture(GL_TEXTURE0 + unit);
         glBindTexture(GL_TEXTURE_2D, id);
+        renderCounters.stateChanges++;
         shader.setVec2("textureSizeReciprocal", 1.0f / width, 1.0f / height);
 	}
 	
@@ -0,0 +1,90 @@
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include "common.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent threads for work done every frame, so no thread is created per frame.
+// run() splits a job into getThreadCount() parts, the calling thread does the first
+// one and waits for the workers to finish the rest.
+class WorkerPool
+{
+public:
+    WorkerPool(int workers = std::max((int)thread::hardware_concurrency() - 1, 0))
+    {
+        for (int i = 0; i < workers; ++i)
+            threads.emplace_back([this, i]() { workerLoop(i + 1); });
+    }
+
+    ~WorkerPool()
+    {
+        {
+            lock_guard<mutex> lock(jobMutex);
+            stopping = true;
+        }
+        jobStart.notify_all();
+        for (auto& it: threads)
+            it.join();
+    }
+
+    // job(part, partCount) for every part, returns when all are done
+    void run(const function<void(int, int)>& job)
+    {
+        {
+            lock_guard<mutex> lock(jobMutex);
+            currentJob = &job;
+            remaining = threads.size();
+            generation++;
+        }
+        jobStart.notify_all();
+        job(0, getThreadCount());
+
+        unique_lock<mutex> lock(jobMutex);
+        jobDone.wait(lock, [this]() { return remaining == 0; });
+        currentJob = NULL;
+    }
+
+    int getThreadCount()
+    {
+        return threads.size() + 1;
+    }
+
+private:
+    vector<thread> threads;
+    mutex jobMutex;
+    condition_variable jobStart;
+    condition_variable jobDone;
+    const function<void(int, int)>* currentJob = NULL;
+    size_t remaining = 0;
+    unsigned long generation = 0;
+    bool stopping = false;
+
+    void workerLoop(int part)
+    {
+        unsigned long seen = 0;
+        while (true)
+        {
+            const function<void(int, int)>* job;
+            {
+                unique_lock<mutex> lock(jobMutex);
+                jobStart.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+                job = currentJob;
+            }
+            (*job)(part, getThreadCount());
+            {
+                lock_guard<mutex> lock(jobMutex);
+                remaining--;
+            }
+            jobDone.notify_one();
+        }
+    }
+};
+
+#endif
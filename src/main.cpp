@@ -3,6 +3,19 @@
 #include "../include/shader.hpp"
 #include "../include/model.hpp"
 #include "../include/frame.hpp"
+#include "../include/scene.hpp"
+#include "../include/benchmark.hpp"
+#include "../include/overdraw.hpp"
+#include "../include/filtersweep.hpp"
+#include "../include/dynamicresolution.hpp"
+#include "../include/depthprepass.hpp"
+#include "../include/redraw.hpp"
+#include "../include/clusteredlights.hpp"
+#include "../include/deferred.hpp"
+#include "../include/shadows.hpp"
+#include "../include/lightmap.hpp"
+#include "../include/probevolume.hpp"
+#include "../include/ssao.hpp"
 #include <vector>
 
 mat4 view(1.0f);                    // V of MVP, viewing matrix
@@ -32,6 +45,29 @@ int frameHeight = INIT_HEIGHT;
 int outputMode = 0;
 int filterMode = 0;
 int testMode = 0;
+vector<int> filterChain;
+bool shaderVariantEnable = true;
+bool temporalEnable = false;
+int blurDivisor = 1;
+bool depthPrepassEnable = false;
+int lightCount = 256;
+bool deferredEnable = false;
+CascadedShadows shadows;
+LightmapBaker lightmapBaker;
+bool lightmapRequested = false;
+ProbeVolume probeVolume;
+bool ssaoEnable = false;
+float ssaoRadius = 40.0f;
+float ssaoIntensity = 1.0f;
+int windowWidth = INIT_WIDTH;
+int windowHeight = INIT_HEIGHT;
+ClusteredLights clusteredLights;
+DynamicResolution dynamicResolution;
+RedrawTracker redrawTracker;
+
+int bloomLevels = 5;
+float bloomThreshold = 0.7f;
+float bloomIntensity = 0.6f;
 
 bool compareBarEnable = false;
 float compareBarX = INIT_WIDTH / 2.0f;
@@ -46,6 +82,20 @@ vec2 magnifierMoveOffset = vec2(0.0f);
 bool needUpdateFBO = false;
 
 vector<Model> models;
+bool sceneDynamic = false;
+float animationTime = 0.0f;
+string scenePath = "asset/scenes/sponza.scene";
+SceneLoader sceneLoader;
+int benchmarkFrames = 0;
+int hierarchyBenchmarkNodes = 0;
+bool filterSweepRequested = false;
+bool filterSweepExit = false;
+
+const char* outputTypes[] = {
+    "Diffuse Texture",
+    "Normal Vector",
+    "Overdraw"
+};
 
 const char* filterTypes[] = {
     "Default",
@@ -54,7 +104,17 @@ const char* filterTypes[] = {
     "Magnifier", 
     "Bloom Effect", 
     "Pixelization", 
-    "Sine Wave"
+    "Sine Wave",
+    "Filter Chain"
+};
+
+const char* chainStageTypes[] = {
+    "Image Abstraction",
+    "Watercolor",
+    "Bloom Effect",
+    "Pixelization",
+    "Sine Wave",
+    "Quantize"
 };
 
 void initialization(GLFWwindow *window)
@@ -69,7 +129,9 @@ void initialization(GLFWwindow *window)
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init("#version 410 core");
 
-    models.push_back(Model("asset/sponza/sponza.obj"));
+    models = sceneLoader.load(scenePath);
+    for (auto& it: models)
+        sceneDynamic |= it.isDynamic();
 
     timerLast = glfwGetTime();
     mouseLast = vec2(0.0f, 0.0f);   
@@ -81,6 +143,16 @@ void timerUpdate()
     timerCurrent = glfwGetTime();
 }
 
+// dynamic objects move with the timer, like the camera
+void animateScene()
+{
+    if (!sceneDynamic)
+        return;
+    if (timerEnabled)
+        animationTime += timerCurrent - timerLast;
+    sceneLoader.animate(models, animationTime);
+}
+
 void processCameraMove(Camera& camera)
 {
     float timeDifferent = 0.0f;
@@ -152,26 +224,46 @@ void processMagnifierMove(GLFWwindow *window)
         magnifierCenter = vec2(x, frameHeight - y) + magnifierMoveOffset;
 }
 
-void updateFrameVariable(Frame& frame)
+// the overdraw view always counts forward fragments
+bool isDeferredActive()
+{
+    return deferredEnable && outputMode != 2;
+}
+
+void updateFrameVariable(Frame& frame, OverdrawCounter& overdraw)
 {
     frame.setTestMode(testMode);
     frame.setFilterMode(filterMode);
+    frame.setFilterChain(filterChain);
+    frame.setSpecializeEnable(shaderVariantEnable);
+    frame.setTemporalEnable(temporalEnable);
+    frame.setBlurDivisor(blurDivisor);
+    frame.setDeferredEnable(isDeferredActive());
+    frame.setBloomLevels(bloomLevels);
+    frame.setBloomThreshold(bloomThreshold);
+    frame.setBloomIntensity(bloomIntensity);
     frame.setFrameSize(frameWidth, frameHeight);
+    // the scene and post passes scale with the resolution, the menu does not
+    dynamicResolution.update(profiler.getSmoothed("Scene").gpuTime + profiler.getSmoothed("Frame").gpuTime);
+    frame.setRenderScale(dynamicResolution.getScale());
     frame.setCompareBarEnable(compareBarEnable);
     frame.setCompareBarX(compareBarX);
     frame.setMagnifierCeanter(magnifierCenter);
     frame.setMagnifierRadius(magnifierRadius);
+    frame.setOverdrawEnable(outputMode == 2);
+    overdraw.setFrameSize(frameWidth, frameHeight);
+    frame.setOverdrawTexture(overdraw.texture);
     if (needUpdateFBO)
     {
+        // updated again every frame until the resize settled, the last one gets the exact size
+        needUpdateFBO = !targetManager.isResizeSettled();
         frame.updateFrameBufferObject();
-        needUpdateFBO = false;
+        redrawTracker.invalidate();
     }
 }
 
-void display(Shader& shader, Camera& camera)
+void display(Shader& shader, Camera& camera, MeshPass meshPass = MESH_ALL, bool depthOnly = false)
 {
-    if (timerEnabled) timerCounter += 1.0f;
-
     shader.use();
 
     projection = camera.getPerspective();
@@ -179,45 +271,235 @@ void display(Shader& shader, Camera& camera)
     shader.setMat4("um4p", projection);
     shader.setMat4("um4mv", view);
     shader.setInt("outputMode", outputMode);
-    
+    if (!depthOnly)
+    {
+        clusteredLights.setupShader(shader);
+        shadows.setupShader(shader);
+        probeVolume.setupShader(shader, view);
+    }
+
 
     for (auto& it : models)
     {
-        it.draw(shader);
+        if (depthOnly)
+            it.drawDepth(shader, meshPass);
+        else
+            it.draw(shader, meshPass);
     }
 }
 
-void windowUpdate(Shader& frameShader, Shader& shader, Camera& camera, Frame& frame)
+// Opaque meshes before the alpha-tested ones, whose discard would otherwise turn off
+// early depth testing for everything drawn with the same program. With the prepass all
+// depth is laid down first and the color pass only shades the visible fragments. The
+// ambient occlusion of the forward path is computed from that depth before the color
+// pass, so it always draws the prepass.
+void displayScene(Shader& shader, Shader& maskedShader, DepthPrepass& depthPrepass, Camera& camera,
+    AmbientOcclusion* ambientOcclusion = NULL, Frame* frame = NULL)
 {
-    updateFrameVariable(frame);
+    for (Shader* it: {&shader, &maskedShader})
+    {
+        it->use();
+        AmbientOcclusion::setupShader(*it, ambientOcclusion != NULL);
+    }
+    if (!depthPrepassEnable && ambientOcclusion == NULL)
+    {
+        display(shader, camera, MESH_OPAQUE);
+        display(maskedShader, camera, MESH_MASKED);
+        return;
+    }
 
-    // Update to Frame buffer
-    glBindFramebuffer(GL_FRAMEBUFFER, frame.FBO);
+    profiler.beginPass("Scene Depth");
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    display(depthPrepass.depthShader, camera, MESH_OPAQUE, true);
+    display(depthPrepass.maskedDepthShader, camera, MESH_MASKED, true);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    profiler.endPass();
+    if (ambientOcclusion != NULL)
+    {
+        profiler.beginPass("SSAO");
+        ambientOcclusion->apply(*frame, camera.getPerspective(), ssaoRadius, ssaoIntensity, false);
+        ambientOcclusion->bind();
+        profiler.endPass();
+    }
+
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+    display(shader, camera);
+    glDepthFunc(GL_LEQUAL);
+    glDepthMask(GL_TRUE);
+}
+
+SceneState getSceneState(Camera& camera, Frame& frame)
+{
+    SceneState state;
+    state.view = camera.getView();
+    state.projection = camera.getPerspective();
+    state.outputMode = outputMode;
+    state.depthPrepass = depthPrepassEnable;
+    state.deferred = isDeferredActive();
+    state.lights = clusteredLights.enabled ? lightCount : 0;
+    state.ambient = clusteredLights.ambient;
+    state.shadows = shadows.enabled;
+    state.sunAzimuth = shadows.sunAzimuth;
+    state.sunElevation = shadows.sunElevation;
+    state.lightmap = Model::lightmapEnable ? lightmapBaker.getVersion() : 0;
+    state.probes = probeVolume.enabled ? probeVolume.getVersion() : 0;
+    state.ssao = ssaoEnable;
+    state.ssaoRadius = ssaoEnable ? ssaoRadius : 0.0f;
+    state.ssaoIntensity = ssaoEnable ? ssaoIntensity : 0.0f;
+    state.animationTime = animationTime;
+    state.width = frame.getRenderWidth();
+    state.height = frame.getRenderHeight();
+    state.models = models.size();
+    return state;
+}
+
+// The lightmap is baked for the current sun of the shadows, static objects only.
+// Without reuse the cached atlas of the scene is ignored and baked again.
+void bakeLightmap(bool reuse)
+{
+    lightmapBaker.bake(models, shadows.getSunDirection(), shadows.sunColor, scenePath + ".lightmap", reuse);
+    Model::lightmapEnable = lightmapBaker.isBaked();
+}
+
+// Probes light what the lightmap does not, so they see the same sun. Incremental
+// bakes only trace the probes around static objects which changed since the last one.
+void bakeProbes(bool incremental)
+{
+    probeVolume.bake(models, shadows.getSunDirection(), shadows.sunColor, scenePath + ".probes", incremental);
+    probeVolume.enabled = probeVolume.isBaked();
+}
+
+// Lights are placed at random inside the bounds of the loaded models. The deferred
+// path culls them per tile itself and only needs the light buffer.
+void updateLights(Camera& camera, Frame& frame)
+{
+    if (!clusteredLights.enabled || outputMode != 0)
+        return;
+    if (clusteredLights.lightCount != lightCount)
+    {
+        vec3 boundsMin = vec3(1e30f);
+        vec3 boundsMax = vec3(-1e30f);
+        for (auto& it: models)
+            it.getBounds(boundsMin, boundsMax);
+        clusteredLights.generate(lightCount, boundsMin, boundsMax);
+    }
+    if (isDeferredActive())
+        clusteredLights.uploadLights();
+    else
+        clusteredLights.update(camera.getView(), camera.getPerspective(), camera.near, camera.far,
+            frame.getRenderWidth(), frame.getRenderHeight());
+    clusteredLights.bind();
+}
+
+void drawScene(Shader& shader, DepthPrepass& depthPrepass, DeferredShading& deferred, AmbientOcclusion& ambientOcclusion, Camera& camera,
+    Frame& frame, OverdrawCounter& overdraw)
+{
+    if (timerEnabled) timerCounter += 1.0f;
+    // SSAO of the forward path draws the prepass as well
+    bool forwardOcclusion = ssaoEnable && outputMode == 0 && !isDeferredActive();
+
+    profiler.beginPass("Scene");
+    drawCostProfiler.beginFrame();
+    frame.setCamera(camera.getView(), camera.getPerspective());
+    updateLights(camera, frame);
+    if (shadows.enabled && outputMode == 0)
+        shadows.update(camera, models, depthPrepass.depthShader, depthPrepass.maskedDepthShader);
+    if (Model::lightmapEnable)
+        lightmapBaker.bind();
+    glBindFramebuffer(GL_FRAMEBUFFER, isDeferredActive() ? frame.gbufferFBO : frame.FBO);
+    renderCounters.stateChanges++;
     glClearColor(0.0f, 0.25f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // We're not using stencil buffer now
     glEnable(GL_DEPTH_TEST);
-    display(shader, camera);
+    glViewport(0, 0, frame.getRenderWidth(), frame.getRenderHeight());
+    if (outputMode == 2)
+    {
+        overdraw.begin();
+        glBindFramebuffer(GL_FRAMEBUFFER, frame.FBO);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        display(overdraw.shader, camera);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        overdraw.end();
+    }
+    else if (isDeferredActive())
+    {
+        displayScene(deferred.gbufferShader, deferred.maskedGBufferShader, depthPrepass, camera);
+        if (ssaoEnable && outputMode == 0)
+        {
+            profiler.beginPass("SSAO");
+            ambientOcclusion.apply(frame, camera.getPerspective(), ssaoRadius, ssaoIntensity, true);
+            profiler.endPass();
+        }
+        profiler.beginPass("Scene Lighting");
+        deferred.shade(frame, clusteredLights, shadows, probeVolume, camera.getView(), camera.getPerspective(), outputMode, vec3(0.0f, 0.25f, 0.0f));
+        profiler.endPass();
+    }
+    else
+    {
+        displayScene(shader, depthPrepass.maskedShader, depthPrepass, camera, forwardOcclusion ? &ambientOcclusion : NULL, &frame);
+    }
+    drawCostProfiler.endFrame();
+    profiler.endPass();
+    if (outputMode != 2)
+        depthPrepass.update(profiler.getSmoothed("Scene"), depthPrepassEnable || forwardOcclusion);
+}
+
+// The scene FBO is kept as it is when sceneChanged is false, only the filter runs again.
+void windowUpdate(Shader& frameShader, Shader& shader, DepthPrepass& depthPrepass, DeferredShading& deferred, AmbientOcclusion& ambientOcclusion,
+    Camera& camera, Frame& frame, OverdrawCounter& overdraw, bool sceneChanged)
+{
+    // Update to Frame buffer
+    if (sceneChanged)
+    {
+        drawScene(shader, depthPrepass, deferred, ambientOcclusion, camera, frame, overdraw);
+    }
 
     // Update to window
+    profiler.beginPass("Frame");
     glBindFramebuffer(GL_FRAMEBUFFER, 0); // back to default
+    renderCounters.stateChanges++;
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
     glClear(GL_COLOR_BUFFER_BIT);
     glDisable(GL_DEPTH_TEST);
     frame.draw(frameShader);
+    profiler.endPass();
+}
+
+
+void runFilterSweep(Shader& frameShader, Shader& shader, DepthPrepass& depthPrepass, Camera& camera, Frame& frame)
+{
+    FilterSweep sweep;
+    frame.setCamera(camera.getView(), camera.getPerspective());
+    updateLights(camera, frame);
+    sweep.run(frame, frameShader, 7, filterTypes, [&]() { displayScene(shader, depthPrepass.maskedShader, depthPrepass, camera); });
+
+    // back to the window size on the next frame
+    glViewport(0, 0, frameWidth, frameHeight);
+    needUpdateFBO = true;
+    filterSweepRequested = false;
 }
 
 void reshapeResponse(GLFWwindow *window, int width, int height)
 {
+    redrawTracker.markInput();
 	glViewport(0, 0, width, height);
     compareBarX = compareBarX / frameWidth * width;
     magnifierCenter = magnifierCenter / vec2(frameWidth, frameHeight) * vec2(width, height);
     frameWidth = guiMenuWidth = width;
     frameHeight = height;
+    targetManager.markResize();
     needUpdateFBO = true;
 }
 
+void refreshResponse(GLFWwindow *)
+{
+    redrawTracker.markInput();
+}
+
 void keyboardResponse(GLFWwindow *window, int key, int scancode, int action, int mods)
 {
+    redrawTracker.markInput();
     switch (key) {
         case GLFW_KEY_ESCAPE:
             glfwSetWindowShouldClose(window, true);
@@ -250,6 +532,7 @@ void keyboardResponse(GLFWwindow *window, int key, int scancode, int action, int
 
 void mouseResponse(GLFWwindow *window, int button, int action, int mods)
 {
+    redrawTracker.markInput();
     double x, y;
     glfwGetCursorPos(window, &x, &y);
     if (button == GLFW_MOUSE_BUTTON_LEFT)
@@ -301,7 +584,329 @@ void mouseResponse(GLFWwindow *window, int button, int action, int mods)
     }
 }
 
-void guiMenu()
+void guiProfiler()
+{
+    if (!profiler.enabled)
+    {
+        ImGui::TextDisabled("＞　Disabled");
+        if (ImGui::MenuItem("　　Enable"))
+            profiler.enabled = true;
+        return;
+    }
+    if (ImGui::MenuItem("　　Disable"))
+        profiler.enabled = false;
+    ImGui::TextDisabled("＞　Enabled");
+    if (ImGui::MenuItem("　　Run filter sweep"))
+        filterSweepRequested = true;
+    ImGui::Text("　Idle iterations (nothing rendered):　%lu　", redrawTracker.getSkippedFrames());
+    ImGui::Text("　Render targets:　%.1f MB (%.1f MB retiring)　", targetManager.getMemory() / 1048576.0f,
+        targetManager.getRetiringMemory() / 1048576.0f);
+
+    for (auto& name: profiler.getPassNames())
+    {
+        const PassStatistics& stats = profiler.getSmoothed(name);
+        ImGui::Separator();
+        ImGui::Text("　%s:　GPU %.3f ms　CPU %.3f ms　(%s)　", name.c_str(), stats.gpuTime, stats.cpuTime, profiler.getBoundHint(stats).c_str());
+        ImGui::Text("　　　Draw calls %.0f　State changes %.0f　", stats.drawCalls, stats.stateChanges);
+        ImGui::Text("　　　Uniform uploads %.0f　Bytes uploaded %.0f　", stats.uniformUploads, stats.uploadBytes);
+        if (!profiler.isStatisticsSupported())
+            continue;
+        for (int i = 0; i < STAT_COUNT; ++i)
+            ImGui::Text("　　　%s %.0f　", pipelineStatisticNames[i], stats.pipeline[i]);
+    }
+    if (!profiler.isStatisticsSupported())
+        ImGui::TextDisabled("　Pipeline statistics queries are not supported　");
+
+    if (profiler.getEvents().empty())
+        return;
+    ImGui::Separator();
+    for (auto& it: profiler.getEvents())
+        ImGui::TextDisabled("　%s　", it.c_str());
+}
+
+void guiDrawCost()
+{
+    if (!drawCostProfiler.enabled)
+    {
+        ImGui::TextDisabled("＞　Disabled");
+        if (ImGui::MenuItem("　　Enable"))
+            drawCostProfiler.enabled = true;
+        return;
+    }
+    if (ImGui::MenuItem("　　Disable"))
+        drawCostProfiler.enabled = false;
+    ImGui::TextDisabled("＞　Enabled");
+    if (ImGui::MenuItem("　　Export CSV"))
+        drawCostProfiler.exportCSV("draw_cost.csv");
+
+    vector<DrawCost> table = drawCostProfiler.getTable();
+    ImGui::Separator();
+    if (ImGui::BeginTable("DrawCostTable", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY, ImVec2(0.0f, 400.0f)))
+    {
+        ImGui::TableSetupColumn("Mesh");
+        ImGui::TableSetupColumn("Material");
+        ImGui::TableSetupColumn("Triangles");
+        ImGui::TableSetupColumn("Instances");
+        ImGui::TableSetupColumn("GPU us");
+        ImGui::TableHeadersRow();
+        for (auto& it: table)
+        {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%s", it.name.c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text("%s", it.material.c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text("%zu", it.triangles);
+            ImGui::TableNextColumn();
+            ImGui::Text("%d", it.instances);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", it.gpuTime);
+        }
+        ImGui::EndTable();
+    }
+}
+
+void guiFilterChain(Frame& frame)
+{
+    for (int i = 0; i < 6; ++i)
+    {
+        if (ImGui::MenuItem(("　　Add " + string(chainStageTypes[i])).c_str()))
+        {
+            filterChain.push_back(i);
+            filterMode = 7;
+        }
+    }
+    if (ImGui::MenuItem("　　Clear"))
+        filterChain.clear();
+
+    ImGui::Separator();
+    string chain = "Scene";
+    for (auto& it: filterChain)
+        chain += " > " + string(chainStageTypes[it]);
+    ImGui::Text("　%s　", chain.c_str());
+    if (filterMode == 7)
+    {
+        ImGui::Text("　Passes:　%zu (%d fused)　", frame.getGraphPassCount(), frame.getFusedPassCount());
+        ImGui::Text("　Pooled targets:　%zu　", frame.getTargetCount());
+    }
+    else
+        ImGui::TextDisabled("　Select \"Filter Chain\" in FrameFilter to apply　");
+}
+
+void guiBloom()
+{
+    ImGui::SliderInt("　Levels", &bloomLevels, 1, 8);
+    ImGui::SliderFloat("　Threshold", &bloomThreshold, 0.0f, 1.0f);
+    ImGui::SliderFloat("　Intensity", &bloomIntensity, 0.0f, 2.0f);
+    ImGui::TextDisabled("　Per level GPU time: Profiler, \"Frame Bloom Down/Up n\"　");
+}
+
+void guiResolution(Frame& frame)
+{
+    if (!dynamicResolution.enabled)
+    {
+        ImGui::TextDisabled("＞　Fixed");
+        if (ImGui::MenuItem("　　Dynamic"))
+            dynamicResolution.enabled = true;
+    }
+    else
+    {
+        if (ImGui::MenuItem("　　Fixed"))
+            dynamicResolution.enabled = false;
+        ImGui::TextDisabled("＞　Dynamic");
+    }
+    ImGui::SliderFloat("　Budget (ms)", &dynamicResolution.targetTime, 4.0f, 50.0f);
+    ImGui::SliderFloat("　Min scale", &dynamicResolution.minScale, 0.25f, 1.0f);
+    ImGui::Separator();
+    const char* divisorNames[] = {"Full", "Half", "Quarter"};
+    for (int i = 0; i < 3; ++i)
+    {
+        string item = string(divisorNames[i]) + " resolution blurs";
+        if (blurDivisor == 1 << i)
+            ImGui::TextDisabled(("＞　" + item).c_str());
+        else if (ImGui::MenuItem(("　　" + item).c_str()))
+            blurDivisor = 1 << i;
+    }
+    ImGui::Separator();
+    ImGui::Text("　Render scale:　%.0f%%　(%d x %d)　", frame.getRenderScale() * 100.0f, frame.getRenderWidth(), frame.getRenderHeight());
+    if (!profiler.enabled)
+        ImGui::TextDisabled("　Needs the profiler for GPU times　");
+}
+
+void guiLighting()
+{
+    const char* pathNames[] = {"Forward (clustered)", "Deferred (tiled)"};
+    for (int i = 0; i < 2; ++i)
+    {
+        if (deferredEnable == (i == 1))
+            ImGui::TextDisabled(("＞　" + string(pathNames[i])).c_str());
+        else if (ImGui::MenuItem(("　　" + string(pathNames[i])).c_str()))
+            deferredEnable = i == 1;
+    }
+    if (profiler.enabled)
+        ImGui::Text("　Scene:　%.3f ms GPU　", profiler.getSmoothed("Scene").gpuTime);
+    ImGui::Separator();
+    if (!clusteredLights.enabled)
+    {
+        ImGui::TextDisabled("＞　Disabled");
+        if (ImGui::MenuItem("　　Enable"))
+            clusteredLights.enabled = true;
+        return;
+    }
+    if (ImGui::MenuItem("　　Disable"))
+        clusteredLights.enabled = false;
+    ImGui::TextDisabled("＞　Enabled");
+    ImGui::SliderInt("　Lights", &lightCount, 1, 4096);
+    ImGui::SliderFloat("　Ambient", &clusteredLights.ambient, 0.0f, 1.0f);
+    ImGui::Separator();
+    ImGui::Text("　Clusters:　%d x %d x %d　", CLUSTER_X, CLUSTER_Y, CLUSTER_Z);
+    if (deferredEnable)
+    {
+        ImGui::TextDisabled("　Lights are culled per 16x16 tile on the GPU　");
+        return;
+    }
+    ImGui::Text("　Binning:　%.3f ms on %d threads　", clusteredLights.getBinTime(), clusteredLights.getThreadCount());
+    ImGui::Text("　Lights per cluster:　%.1f average, %zu max　", clusteredLights.getAverageClusterLights(),
+        clusteredLights.getMaxClusterLights());
+    if (outputMode != 0)
+        ImGui::TextDisabled("　Applies to the diffuse texture output only　");
+}
+
+void guiLightmap()
+{
+    if (!lightmapBaker.isBaked())
+    {
+        ImGui::TextDisabled("＞　Not baked");
+        if (ImGui::MenuItem("　　Bake"))
+            bakeLightmap(true);
+        ImGui::SliderInt("　Samples", &lightmapBaker.samples, 8, 1024);
+        ImGui::SliderInt("　Bounces", &lightmapBaker.bounces, 0, 4);
+        return;
+    }
+    if (Model::lightmapEnable)
+    {
+        if (ImGui::MenuItem("　　Disable"))
+            Model::lightmapEnable = false;
+        ImGui::TextDisabled("＞　Enabled");
+    }
+    else
+    {
+        ImGui::TextDisabled("＞　Disabled");
+        if (ImGui::MenuItem("　　Enable"))
+            Model::lightmapEnable = true;
+    }
+    if (ImGui::MenuItem("　　Bake again for the current sun"))
+        bakeLightmap(false);
+    ImGui::SliderInt("　Samples", &lightmapBaker.samples, 8, 1024);
+    ImGui::SliderInt("　Bounces", &lightmapBaker.bounces, 0, 4);
+    ImGui::Separator();
+    const LightmapStats& stats = lightmapBaker.stats;
+    ImGui::Text("　Atlas:　%d x %d, %zu charts, %zu texels　", lightmapBaker.atlasSize, lightmapBaker.atlasSize, stats.charts, stats.texels);
+    if (stats.loaded)
+        ImGui::Text("　Loaded from the cache in %.2f s　", stats.bakeTime);
+    else
+    {
+        ImGui::Text("　Bake:　%.2f s, trace %.2f s　", stats.bakeTime, stats.traceTime);
+        ImGui::Text("　Rays:　%.1f M, %.2f Mrays/s　", stats.rays / 1e6, stats.getRaysPerSecond() / 1e6);
+    }
+    if (outputMode != 0)
+        ImGui::TextDisabled("　Applies to the diffuse texture output only　");
+}
+
+void guiProbes()
+{
+    if (!probeVolume.isBaked())
+    {
+        ImGui::TextDisabled("＞　Not baked");
+        if (ImGui::MenuItem("　　Bake"))
+            bakeProbes(true);
+        ImGui::SliderInt("　Resolution", &probeVolume.resolution, 4, 64);
+        ImGui::SliderInt("　Rays", &probeVolume.samples, 16, 2048);
+        return;
+    }
+    if (probeVolume.enabled)
+    {
+        if (ImGui::MenuItem("　　Disable"))
+            probeVolume.enabled = false;
+        ImGui::TextDisabled("＞　Enabled");
+    }
+    else
+    {
+        ImGui::TextDisabled("＞　Disabled");
+        if (ImGui::MenuItem("　　Enable"))
+            probeVolume.enabled = true;
+    }
+    if (ImGui::MenuItem("　　Bake changed probes"))
+        bakeProbes(true);
+    if (ImGui::MenuItem("　　Bake all for the current sun"))
+        bakeProbes(false);
+    ImGui::SliderInt("　Resolution", &probeVolume.resolution, 4, 64);
+    ImGui::SliderInt("　Rays", &probeVolume.samples, 16, 2048);
+    ImGui::Separator();
+    const ProbeStats& stats = probeVolume.stats;
+    ImGui::Text("　Grid:　%d x %d x %d, %zu inside geometry　", stats.grid.x, stats.grid.y, stats.grid.z, stats.invalid);
+    ImGui::Text("　Last bake:　%zu of %zu probes in %.2f s　", stats.baked, stats.probes, stats.bakeTime);
+    if (stats.baked > 0)
+        ImGui::Text("　Rays:　%.1f M, %.2f Mrays/s　", stats.rays / 1e6, stats.getRaysPerSecond() / 1e6);
+    ImGui::Text("　Memory:　%zu KB texture, %zu KB CPU　", stats.gpuBytes / 1024, stats.cpuBytes / 1024);
+    if (outputMode != 0)
+        ImGui::TextDisabled("　Applies to the diffuse texture output only　");
+}
+
+void guiAmbientOcclusion()
+{
+    if (!ssaoEnable)
+    {
+        ImGui::TextDisabled("＞　Disabled");
+        if (ImGui::MenuItem("　　Enable"))
+            ssaoEnable = true;
+        return;
+    }
+    if (ImGui::MenuItem("　　Disable"))
+        ssaoEnable = false;
+    ImGui::TextDisabled("＞　Enabled");
+    ImGui::SliderFloat("　Radius", &ssaoRadius, 5.0f, 200.0f);
+    ImGui::SliderFloat("　Intensity", &ssaoIntensity, 0.0f, 4.0f);
+    ImGui::Separator();
+    ImGui::Text("　Half resolution, 8 samples, 4x4 pattern　");
+    if (profiler.enabled)
+        ImGui::Text("　SSAO pass:　%.3f ms GPU　", profiler.getSmoothed("SSAO").gpuTime);
+    else
+        ImGui::TextDisabled("　Needs the profiler for GPU times　");
+    if (outputMode != 0)
+        ImGui::TextDisabled("　Applies to the diffuse texture output only　");
+}
+
+void guiShadows()
+{
+    if (!shadows.enabled)
+    {
+        ImGui::TextDisabled("＞　Disabled");
+        if (ImGui::MenuItem("　　Enable"))
+            shadows.enabled = true;
+        return;
+    }
+    if (ImGui::MenuItem("　　Disable"))
+        shadows.enabled = false;
+    ImGui::TextDisabled("＞　Enabled");
+    if (ImGui::MenuItem(shadows.cacheEnable ? "　　Disable static caching" : "　　Enable static caching"))
+        shadows.cacheEnable = !shadows.cacheEnable;
+    ImGui::SliderFloat("　Sun azimuth", &shadows.sunAzimuth, 0.0f, 360.0f);
+    ImGui::SliderFloat("　Sun elevation", &shadows.sunElevation, 5.0f, 90.0f);
+    ImGui::Separator();
+    ImGui::Text("　Cascades:　%.0f / %.0f / %.0f / %.0f　", shadows.getSplit(0), shadows.getSplit(1), shadows.getSplit(2),
+        shadows.getSplit(3));
+    ImGui::Text("　Redrawn last frame:　%d of %d　", shadows.getRenderedCascades(), SHADOW_CASCADES);
+    if (profiler.enabled)
+        ImGui::Text("　Shadow pass:　%.3f ms cached, %.3f ms uncached　", shadows.getPassTime(true), shadows.getPassTime(false));
+    else
+        ImGui::TextDisabled("　Needs the profiler for GPU times　");
+    if (outputMode != 0)
+        ImGui::TextDisabled("　Applies to the diffuse texture output only　");
+}
+
+void guiMenu(Frame& frame, OverdrawCounter& overdraw, DepthPrepass& depthPrepass)
 {
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
@@ -314,27 +919,66 @@ void guiMenu()
     {
         if (ImGui::BeginMenu("OutputMode"))
         {
-            if (outputMode == 0)
+            for (int i = 0; i < 3; ++i)
             {
-                ImGui::TextDisabled("＞　Diffuse Texture");
-                if (ImGui::MenuItem("　　Normal Vector"))
+                if (outputMode == i)
                 {
-                    outputMode = 1;
+                    ImGui::TextDisabled(("＞　" + string(outputTypes[i])).c_str());
                 }
-            }
-            else
-            {
-                if (ImGui::MenuItem("　　Diffuse Texture"))
+                else if (ImGui::MenuItem(("　　" + string(outputTypes[i])).c_str()))
                 {
-                    outputMode = 0;
+                    outputMode = i;
                 }
-                ImGui::TextDisabled("＞　Normal Vector");
             }
+            if (outputMode == 2)
+            {
+                ImGui::Separator();
+                ImGui::Text("　Average overdraw (covered pixels):　%.2f　", overdraw.getAverage());
+                ImGui::Text("　Average overdraw (frame):　%.2f　", overdraw.getScreenAverage());
+                ImGui::Text("　Max overdraw:　%u　", overdraw.getMax());
+                ImGui::TextDisabled("　Heatmap: blue 1, green 4, red 8+ fragments　");
+            }
+            ImGui::Separator();
+            if (ImGui::MenuItem(depthPrepassEnable ? "　　Disable depth prepass" : "　　Enable depth prepass"))
+                depthPrepassEnable = !depthPrepassEnable;
+            if (profiler.enabled && profiler.isStatisticsSupported())
+            {
+                ImGui::Text("　Fragment invocations:　%.0f without, %.0f with prepass　", depthPrepass.getInvocations(false),
+                    depthPrepass.getInvocations(true));
+                ImGui::Text("　Saved by the prepass:　%.1f%%　", depthPrepass.getSavedFraction() * 100.0f);
+            }
+            else
+                ImGui::TextDisabled("　Needs the profiler with pipeline statistics　");
+            ImGui::EndMenu();
+        }
+        if (ImGui::BeginMenu("Lighting"))
+        {
+            guiLighting();
+            ImGui::EndMenu();
+        }
+        if (ImGui::BeginMenu("Shadows"))
+        {
+            guiShadows();
+            ImGui::EndMenu();
+        }
+        if (ImGui::BeginMenu("SSAO"))
+        {
+            guiAmbientOcclusion();
+            ImGui::EndMenu();
+        }
+        if (ImGui::BeginMenu("Lightmap"))
+        {
+            guiLightmap();
+            ImGui::EndMenu();
+        }
+        if (ImGui::BeginMenu("Probes"))
+        {
+            guiProbes();
             ImGui::EndMenu();
         }
         if (ImGui::BeginMenu("FrameFilter"))
         {
-            for (int i = 0; i < 7; ++i)
+            for (int i = 0; i < 8; ++i)
             {
                 if (filterMode == i)
                 {
@@ -345,6 +989,32 @@ void guiMenu()
                     filterMode = i;
                 }
             }
+            ImGui::Separator();
+            if (ImGui::MenuItem(shaderVariantEnable ? "　　Use generic shader" : "　　Use specialized shaders"))
+                shaderVariantEnable = !shaderVariantEnable;
+            ImGui::TextDisabled("　%s shader, %zu variants compiled　", shaderVariantEnable ? "Specialized" : "Generic", frame.getVariantCount());
+            ImGui::Separator();
+            if (ImGui::MenuItem(temporalEnable ? "　　Disable temporal reuse" : "　　Enable temporal reuse"))
+                temporalEnable = !temporalEnable;
+            if (frame.isTemporalActive())
+                ImGui::Text("　Recomputed:　%.1f%%　", frame.getRecomputedFraction() * 100.0f);
+            else if (temporalEnable)
+                ImGui::TextDisabled("　Abstraction and watercolor at full resolution only　");
+            ImGui::EndMenu();
+        }
+        if (ImGui::BeginMenu("FilterChain"))
+        {
+            guiFilterChain(frame);
+            ImGui::EndMenu();
+        }
+        if (ImGui::BeginMenu("Bloom"))
+        {
+            guiBloom();
+            ImGui::EndMenu();
+        }
+        if (ImGui::BeginMenu("Resolution"))
+        {
+            guiResolution(frame);
             ImGui::EndMenu();
         }
         if (ImGui::BeginMenu("CompareBar"))
@@ -367,6 +1037,16 @@ void guiMenu()
             }
             ImGui::EndMenu();
         }
+        if (ImGui::BeginMenu("Profiler"))
+        {
+            guiProfiler();
+            ImGui::EndMenu();
+        }
+        if (ImGui::BeginMenu("DrawCost"))
+        {
+            guiDrawCost();
+            ImGui::EndMenu();
+        }
         if (ImGui::BeginMenu("ControlHelp"))
         {
             ImGui::Text("　Keyboard:　");
@@ -402,10 +1082,73 @@ void menuCleanup()
     ImGui::DestroyContext();
 }
 
+void parseArguments(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        string argument = argv[i];
+        if (argument == "--scene" && i + 1 < argc)
+            scenePath = argv[++i];
+        else if (argument == "--benchmark" && i + 1 < argc)
+            benchmarkFrames = atoi(argv[++i]);
+        else if (argument == "--filter-sweep")
+            filterSweepRequested = filterSweepExit = true;
+        else if (argument == "--no-shader-cache")
+            Shader::cacheEnable = false;
+        else if (argument == "--continuous")
+            redrawTracker.enabled = false;
+        else if (argument == "--depth-prepass")
+            depthPrepassEnable = true;
+        else if (argument == "--shadows")
+            shadows.enabled = true;
+        else if (argument == "--deferred")
+            deferredEnable = true;
+        else if (argument == "--ssao")
+            ssaoEnable = true;
+        else if (argument == "--no-instancing")
+            GeometryInstancer::enabled = false;
+        else if (argument == "--hierarchy-benchmark" && i + 1 < argc)
+            hierarchyBenchmarkNodes = atoi(argv[++i]);
+        else if (argument == "--probes")
+            probeVolume.enabled = true;
+        else if (argument == "--lightmap")
+            lightmapRequested = true;
+        else if (argument == "--lightmap-samples" && i + 1 < argc)
+        {
+            lightmapBaker.samples = std::max(atoi(argv[++i]), 1);
+            lightmapRequested = true;
+        }
+        else if (argument == "--window" && i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &windowWidth, &windowHeight) == 2)
+            ++i;
+        else if (argument == "--lights" && i + 1 < argc)
+        {
+            lightCount = std::max(atoi(argv[++i]), 1);
+            clusteredLights.enabled = true;
+        }
+        else
+            cout << "Usage: " << argv[0] << " [--scene <file>] [--benchmark <frames>] [--filter-sweep] [--no-shader-cache] [--continuous]"
+                 << " [--depth-prepass] [--lights <count>] [--deferred] [--window <width>x<height>]"
+                 << " [--shadows] [--lightmap] [--lightmap-samples <count>] [--probes] [--ssao] [--no-instancing]"
+                 << " [--hierarchy-benchmark <nodes>]" << endl;
+    }
+    // a benchmark measures every frame
+    if (benchmarkFrames > 0)
+        redrawTracker.enabled = false;
+}
+
 int main(int argc, char **argv)
 {
+    parseArguments(argc, argv);
+
     // initial glfw
     glfwInit();
+    if (hierarchyBenchmarkNodes > 0)
+    {
+        // CPU only, no window needed
+        TransformHierarchy::benchmark(hierarchyBenchmarkNodes);
+        glfwTerminate();
+        return 0;
+    }
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -413,7 +1156,7 @@ int main(int argc, char **argv)
     // specifies whether to use full resolution framebuffers on Retina displays
     glfwWindowHint(GLFW_COCOA_RETINA_FRAMEBUFFER, GLFW_FALSE);
     // create window
-    GLFWwindow* window = glfwCreateWindow(INIT_WIDTH, INIT_HEIGHT, "GPA_Assignment2", NULL, NULL);
+    GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, "GPA_Assignment2", NULL, NULL);
     if (window == NULL)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
@@ -421,6 +1164,9 @@ int main(int argc, char **argv)
         return -1;
     }
     glfwMakeContextCurrent(window);
+    // without vsync, the benchmark frame times are not capped at the refresh rate
+    if (benchmarkFrames > 0)
+        glfwSwapInterval(0);
     
     // load OpenGL function pointer
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
@@ -430,8 +1176,19 @@ int main(int argc, char **argv)
     }
 
     dumpInfo();
+    loadExtensions();
+    double startupTime = glfwGetTime();
+
+    glViewport(INIT_VIEWPORT_X, INIT_VIEWPORT_Y, INIT_WIDTH, INIT_HEIGHT);
+    glClearColor(0.0f, 0.3f, 0.0f, 1.00f);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+
     Shader shader("asset/vertex.vs.glsl", "asset/fragment.fs.glsl");
     Shader frameShader("asset/frameVertex.vs.glsl", "asset/frameFragment.fs.glsl");
+    DepthPrepass depthPrepass;
+    DeferredShading deferred;
+    AmbientOcclusion ambientOcclusion;
     Camera camera = Camera()
                         .withPosition(vec3(0.0f, 125.0f, 0.0f))
                         .withFar(5000.0f)
@@ -439,35 +1196,90 @@ int main(int argc, char **argv)
                         .withTheta(180.0f);
     cout << "DEBUG::MAIN::C-CAMERA-F-GV: " << camera.front.x << " " << camera.front.y << " " << camera.front.z << endl;
     Frame frame = Frame();
+    OverdrawCounter overdraw = OverdrawCounter();
     initialization(window);
+    if (lightmapRequested)
+        bakeLightmap(true);
+    if (probeVolume.enabled)
+        bakeProbes(true);
 
     // register glfw callback functions
     glfwSetFramebufferSizeCallback(window, reshapeResponse);
     glfwSetKeyCallback(window, keyboardResponse);
     glfwSetMouseButtonCallback(window, mouseResponse);
+    glfwSetWindowRefreshCallback(window, refreshResponse);
+    // the callback is not called for the initial size
+    int initWidth, initHeight;
+    glfwGetFramebufferSize(window, &initWidth, &initHeight);
+    if (initWidth != frameWidth || initHeight != frameHeight)
+        reshapeResponse(window, initWidth, initHeight);
     
     cout << "DEBUG::MAIN::F-MAIN::1" << endl;
     // main loop
     float timeDifferent = 0.0f;
-    while (!glfwWindowShouldClose(window))
+    Benchmark benchmark(benchmarkFrames);
+    bool idle = false;
+    while (!glfwWindowShouldClose(window) && !benchmark.isFinished())
     {
+        benchmark.beginFrame();
         // Poll input event
         // cout << "DEBUG::MAIN::C-CAMERA-F-GV: " << camera.front.x << " " << camera.front.y << " " << camera.front.z << endl;
 
-        glfwPollEvents();
+        redrawTracker.waitEvents(idle);
         timerUpdate();
+        // the camera does not move by the time spent waiting
+        if (idle)
+            timerUpdate();
 
         processCameraMove(camera);
         processCameraTrackball(camera, window);
         processCompareBarMove(window);
         processMagnifierResize(window);
         processMagnifierMove(window);
-        windowUpdate(frameShader, shader, camera, frame);
-        guiMenu();
+        animateScene();
+        if (filterSweepRequested)
+        {
+            runFilterSweep(frameShader, shader, depthPrepass, camera, frame);
+            if (filterSweepExit)
+                break;
+        }
+        updateFrameVariable(frame, overdraw);
+        bool sceneChanged = redrawTracker.isSceneChanged(getSceneState(camera, frame));
+        bool frameChanged = frame.isChanged();
+        bool menuChanged = redrawTracker.hasInput(window);
+        // nothing changed, the last presented image stays on screen
+        idle = !sceneChanged && !frameChanged && !menuChanged;
+        if (idle)
+            continue;
+
+        windowUpdate(frameShader, shader, depthPrepass, deferred, ambientOcclusion, camera, frame, overdraw, sceneChanged);
+        profiler.beginPass("Menu");
+        guiMenu(frame, overdraw, depthPrepass);
+        profiler.endPass();
 
         // swap buffer from back to front
         glfwSwapBuffers(window);
+        targetManager.endFrame();
+        profiler.endFrame();
+        benchmark.endFrame();
+        if (startupTime > 0.0)
+        {
+            // shader compilation (or cache loading) and scene loading up to the first frame
+            cout << "DEBUG::MAIN::STARTUP: " << (glfwGetTime() - startupTime) * 1000.0 << " ms to first frame" << endl;
+            startupTime = 0.0;
+        }
+    }
+    BenchmarkSetup setup;
+    setup.lights = clusteredLights.enabled ? lightCount : 0;
+    setup.deferred = isDeferredActive();
+    setup.width = frame.getRenderWidth();
+    setup.height = frame.getRenderHeight();
+    if (deferred.getShadedFrames() > 0)
+    {
+        setup.overflowTiles = deferred.getOverflowTiles();
+        setup.deferredFrames = deferred.getShadedFrames();
     }
+    benchmark.report(scenePath, sceneLoader.stats, setup);
 
     menuCleanup();
     // just for compatibiliy purposes